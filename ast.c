@@ -4,6 +4,8 @@
 #include "token.h"
 #include "vm.h"
 #include "jump.h"
+#include "bounds.h"
+#include "dce.h"
 #include "utf8.h"
 #include "types.h"
 #include <stdint.h>
@@ -18,6 +20,185 @@ void eval(ast_t* ast)
         ast->base->eval(ast);
 }
 
+// Symbol of an array used as a whole (not indexed), NULL otherwise
+symbol_t* ast_array_symbol(ast_t* ast)
+{
+    if (ast == NULL || ast->base->kind != AST_VARIABLE)
+        return NULL;
+
+    ast_variable_t* var = (ast_variable_t*) ast;
+
+    if (var->index_expr != NULL || !is_array_type(var->symbol->type))
+        return NULL;
+
+    return var->symbol;
+}
+
+static void ast_walk_list(vector_t* nodes, ast_visit_t visit, void* arg)
+{
+    for (size_t i = 0; i < vec_size(nodes); i++)
+        ast_walk(vec_get(nodes, i), visit, arg);
+}
+
+// Pre-order walk, children are skipped when the visitor returns false
+void ast_walk(ast_t* ast, ast_visit_t visit, void* arg)
+{
+    if (ast == NULL || !visit(ast, arg))
+        return;
+
+    switch (ast->base->kind)
+    {
+        case AST_UNARY:
+            ast_walk(((ast_unary_t*) ast)->expr, visit, arg);
+            break;
+        case AST_BINARY:
+            ast_walk(((ast_binary_t*) ast)->lhs_expr, visit, arg);
+            ast_walk(((ast_binary_t*) ast)->rhs_expr, visit, arg);
+            break;
+        case AST_BLOCK:
+            ast_walk_list(((ast_block_t*) ast)->nodes, visit, arg);
+            break;
+        case AST_IF_COND:
+        {
+            ast_if_cond_t* if_cond = (ast_if_cond_t*) ast;
+            ast_walk(if_cond->condition, visit, arg);
+            ast_walk(if_cond->if_then, visit, arg);
+            ast_walk(if_cond->if_else, visit, arg);
+            break;
+        }
+        case AST_ASSIGN:
+        {
+            ast_assign_t* assign = (ast_assign_t*) ast;
+            ast_walk(assign->expr, visit, arg);
+            ast_walk(assign->index_expr, visit, arg);
+            break;
+        }
+        case AST_VARIABLE:
+            ast_walk(((ast_variable_t*) ast)->index_expr, visit, arg);
+            break;
+        case AST_FUNC_DECL:
+            ast_walk((ast_t*) ((ast_func_decl_t*) ast)->body, visit, arg);
+            break;
+        case AST_FUNC_CALL:
+            ast_walk_list(((ast_func_call_t*) ast)->args, visit, arg);
+            break;
+        case AST_BUILTIN_CALL:
+            ast_walk_list(((ast_builtin_call_t*) ast)->args, visit, arg);
+            break;
+        case AST_FUNC_RETURN:
+            ast_walk(((ast_func_return_t*) ast)->expr, visit, arg);
+            break;
+        case AST_FOR_LOOP:
+        {
+            ast_for_loop_t* loop = (ast_for_loop_t*) ast;
+            ast_walk(loop->init, visit, arg);
+            ast_walk_list(loop->hoisted, visit, arg);
+            ast_walk(loop->condition, visit, arg);
+            ast_walk(loop->post, visit, arg);
+            ast_walk(loop->body, visit, arg);
+            break;
+        }
+        case AST_ARRAY_SCALAR:
+            ast_walk_list(((ast_array_scalar_t*) ast)->elmnts, visit, arg);
+            break;
+        case AST_FOR_IN:
+        {
+            ast_for_in_t* loop = (ast_for_in_t*) ast;
+            ast_walk(loop->from, visit, arg);
+            ast_walk(loop->to, visit, arg);
+            ast_walk_list(loop->hoisted, visit, arg);
+            ast_walk(loop->body, visit, arg);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+typedef struct
+{
+    symbol_t* symbol;
+    bool_t found;
+} assigns_t;
+
+static bool_t assigns_visit(ast_t* ast, void* arg)
+{
+    assigns_t* assigns = arg;
+
+    if (ast->base->kind == AST_ASSIGN && ((ast_assign_t*) ast)->symbol == assigns->symbol)
+        assigns->found = true;
+    else if (ast->base->kind == AST_FOR_IN && ((ast_for_in_t*) ast)->symbol == assigns->symbol)
+        assigns->found = true;
+
+    return !assigns->found;
+}
+
+// Whether the symbol is assigned anywhere in the tree
+bool_t ast_assigns(ast_t* ast, symbol_t* symbol)
+{
+    assigns_t assigns = { symbol, false };
+    ast_walk(ast, assigns_visit, &assigns);
+    return assigns.found;
+}
+
+// Whether the variable reads what the assignment writes. Compound
+// assignments share the index between the two.
+static bool_t same_target(ast_assign_t* ast, ast_t* expr)
+{
+    if (expr->base->kind != AST_VARIABLE)
+        return false;
+
+    ast_variable_t* var = (ast_variable_t*) expr;
+    return var->symbol == ast->symbol && var->index_expr == ast->index_expr;
+}
+
+// The element load of `a[i] = a[i] <op> e` when both share the index
+ast_variable_t* ast_element_update(ast_assign_t* ast)
+{
+    if (ast->index_expr == NULL || ast->expr->base->kind != AST_BINARY || ((ast_binary_t*) ast->expr)->magic != NULL)
+        return NULL;
+
+    ast_t* lhs = ((ast_binary_t*) ast->expr)->lhs_expr;
+    return same_target(ast, lhs) ? (ast_variable_t*) lhs : NULL;
+}
+
+// The addend of `x = x + c`, `x = c + x` or `x = x - c` for an integer
+// target when it fits the 32 bit operand of the in place opcodes
+static bool_t update_addend(ast_assign_t* ast, int64_t* addend)
+{
+    if (ast->expr->base->kind != AST_BINARY)
+        return false;
+
+    ast_binary_t* binary = (ast_binary_t*) ast->expr;
+    ast_t* lhs = binary->lhs_expr;
+    ast_t* rhs = binary->rhs_expr;
+
+    if (binary->magic != NULL || !is_integer_type(binary->base->type))
+        return false;
+
+    if (binary->op == TK_PLUS && same_target(ast, rhs))
+    {
+        rhs = lhs;
+        lhs = binary->rhs_expr;
+    }
+
+    if ((binary->op != TK_PLUS && binary->op != TK_MINUS) || !same_target(ast, lhs) ||
+        !is_integer_type(lhs->base->type) || rhs->base->kind != AST_CONSTANT || !is_integer_type(rhs->base->type))
+        return false;
+
+    int64_t value = ((ast_constant_t*) rhs)->value.as_int64;
+
+    if (binary->op == TK_MINUS)
+    {
+        if (value == INT64_MIN)
+            return false;
+        value = -value;
+    }
+
+    *addend = value;
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
 void eval_constant(ast_constant_t* ast)
 {
     type_t type = ast->base->type;
@@ -25,37 +206,29 @@ void eval_constant(ast_constant_t* ast)
 
     if (is_integer_type(type) || is_bool_type(type))
     {
-        if (value.as_int64 == 0) {
+        // The constant opcodes sign extend, pick the smallest one holding
+        // the value. Folded values may not fit their type, the VM does not
+        // narrow integers either.
+        int64_t v = value.as_int64;
+
+        if (v == 0) {
             EMIT(ICONST_0);
-        } else if (value.as_int64 == 1) {
+        } else if (v == 1) {
             EMIT(ICONST_1);
+        } else if (v >= INT8_MIN && v <= INT8_MAX) {
+            EMIT(I8CONST, NUM8(value.as_int8));
+        } else if (v >= INT16_MIN && v <= INT16_MAX) {
+            EMIT(I16CONST, NUM16(value.as_int16));
+        } else if (v >= INT32_MIN && v <= INT32_MAX) {
+            EMIT(I32CONST, NUM32(value.as_int32));
         } else {
-            switch(type)
-            {
-                case MT_INT8:
-                case MT_UINT8:
-                    EMIT(I8CONST, NUM8(value.as_int8));
-                    break;
-                case MT_INT16:
-                case MT_UINT16:
-                    EMIT(I16CONST, NUM16(value.as_int16));
-                    break;
-                case MT_INT32:
-                case MT_UINT32:
-                    EMIT(I32CONST, NUM32(value.as_int32));
-                    break;
-                case MT_INT64:
-                case MT_UINT64:
-                    EMIT(I64CONST, NUM64(value.as_int64));
-                    break;
-                default:
-                    ;
-            }
+            EMIT(I64CONST, NUM64(value.as_int64));
         }
     }
     else if (is_real_type(type))
     {
-        if (ast->value.as_real == 0.0)
+        // Bitwise so -0.0 keeps its sign
+        if (ast->value.as_uint64 == 0)
         {
             EMIT(RCONST_0);
         }
@@ -76,42 +249,12 @@ void eval_constant(ast_constant_t* ast)
     }
 }
 
-void eval_binary(ast_binary_t* ast)
+static void emit_binary_op(token_type_t op, type_t lhs_type, type_t rhs_type, type_t type)
 {
-    type_t lhs_type = ast->lhs_expr->base->type;
-    type_t rhs_type = ast->rhs_expr->base->type;
-    
-    eval(ast->lhs_expr);
-
-    if (is_integer_type(lhs_type) && is_real_type(rhs_type))
-    {
-        EMIT(ITOR);
-        lhs_type = MT_REAL;
-    }
-
-    JUMP_NEW(short_circuit);
-
-    if (ast->op == TK_AND || ast->op == TK_OR)
-    {
-        EMIT(DUP);
-        if (ast->op == TK_AND)
-            JUMP(JEZ, short_circuit);
-        else if (ast->op == TK_OR)
-            JUMP(JNZ, short_circuit);
-    }
-
-    eval(ast->rhs_expr);
-
-    if (is_integer_type(rhs_type) && is_real_type(lhs_type))
-    {
-        EMIT(ITOR);
-        rhs_type = MT_REAL;
-    }
-
     if ((is_integer_type(lhs_type) && is_integer_type(rhs_type)) ||
         (is_bool_type(lhs_type) && is_bool_type(rhs_type)))
     {
-        switch (ast->op)
+        switch (op)
         {
         case TK_PLUS:
             EMIT(IADD);
@@ -155,20 +298,25 @@ void eval_binary(ast_binary_t* ast)
         case TK_XOR_BIT:
             EMIT(IBXOR);
             break;
+        case TK_SHL:
+            EMIT(ISHL);
+            break;
+        case TK_SHR:
+            EMIT(is_unsigned_integer_type(type) ? ISHRU : ISHR);
+            break;
         case TK_AND:
             EMIT(IAND);
             break;
         case TK_OR:
             EMIT(IOR);
             break;
-        // Note: Shift operators (ISHL, ISHR) exist in VM but no token types yet
         default:
             panic("Unknown integer binary operation.");
         }
     }
     else if (is_real_type(lhs_type) || is_real_type(rhs_type)) // Is that enough ?
     {
-        switch (ast->op)
+        switch (op)
         {
         case TK_PLUS:
             EMIT(RADD);
@@ -207,6 +355,48 @@ void eval_binary(ast_binary_t* ast)
             panic("Unknown real binary operation.");
         }
     }
+}
+
+void eval_binary(ast_binary_t* ast)
+{
+    type_t lhs_type = ast->lhs_expr->base->type;
+    type_t rhs_type = ast->rhs_expr->base->type;
+    
+    eval(ast->lhs_expr);
+
+    if (ast->magic != NULL)
+    {
+        int32_t divisor = ((ast_constant_t*) ast->rhs_expr)->value.as_int64;
+        EMIT(ast->op == TK_DIV ? IDIVM : IMODM, NUM64(ast->magic->magic), NUM32(divisor), ast->magic->shift);
+        return;
+    }
+
+    if (is_integer_type(lhs_type) && is_real_type(rhs_type))
+    {
+        EMIT(ITOR);
+        lhs_type = MT_REAL;
+    }
+
+    JUMP_NEW(short_circuit);
+
+    if (ast->op == TK_AND || ast->op == TK_OR)
+    {
+        EMIT(DUP);
+        if (ast->op == TK_AND)
+            JUMP(JEZ, short_circuit);
+        else if (ast->op == TK_OR)
+            JUMP(JNZ, short_circuit);
+    }
+
+    eval(ast->rhs_expr);
+
+    if (is_integer_type(rhs_type) && is_real_type(lhs_type))
+    {
+        EMIT(ITOR);
+        rhs_type = MT_REAL;
+    }
+
+    emit_binary_op(ast->op, lhs_type, rhs_type, ast->base->type);
 
     MARK(short_circuit);
 
@@ -256,7 +446,7 @@ void eval_block(ast_block_t* ast)
     {
         uint16_t vars = context_allocated(ast->context);
         uint16_t args = 0;
-        EMIT(ICONST_0, ICONST_0, PROC, NUM16(args), NUM16((vars - args)));
+        EMIT(PROC, NUM16(args), NUM16((vars - args)));
     }
 
     for (size_t i = 0; i < vec_size(ast->nodes); i++)
@@ -271,14 +461,44 @@ void eval_single_opcode(ast_single_opcode_t* ast)
     EMIT(ast->opcode);
 }
 
+// Jumps to target when the condition is jump_if. Short-circuit operators
+// become jumps of their own, so each operand test gets a block and the
+// code after the condition only runs once all of them passed.
+static void eval_branch(ast_t* condition, jump_t* target, bool_t jump_if)
+{
+    if (condition->base->kind == AST_BINARY)
+    {
+        ast_binary_t* binary = (ast_binary_t*) condition;
+
+        if (binary->op == (jump_if ? TK_OR : TK_AND))
+        {
+            eval_branch(binary->lhs_expr, target, jump_if);
+            eval_branch(binary->rhs_expr, target, jump_if);
+            return;
+        }
+
+        if (binary->op == (jump_if ? TK_AND : TK_OR))
+        {
+            JUMP_NEW(skip);
+            eval_branch(binary->lhs_expr, skip, !jump_if);
+            eval_branch(binary->rhs_expr, target, jump_if);
+            MARK(skip);
+            JUMP_FIX(skip);
+            JUMP_FREE(skip);
+            return;
+        }
+    }
+
+    eval(condition);
+    JUMP(jump_if ? JNZ : JEZ, target);
+}
+
 void eval_if_cond(ast_if_cond_t* ast)
 {
     JUMP_NEW(else_addr);
     JUMP_NEW(exit_addr);
 
-    eval(ast->condition);
-
-    JUMP(JEZ, else_addr);
+    eval_branch(ast->condition, else_addr, false);
 
     eval(ast->if_then);
 
@@ -297,23 +517,133 @@ void eval_if_cond(ast_if_cond_t* ast)
     JUMP_FREE(exit_addr);
 }
 
+uint8_t array_load_opcode(type_t elmnt_type)
+{
+    switch (array_elmnt_size(elmnt_type))
+    {
+        case 1: return is_unsigned_integer_type(elmnt_type) || is_bool_type(elmnt_type) ? XLOADIU8 : XLOADI8;
+        case 2: return is_unsigned_integer_type(elmnt_type) ? XLOADIU16 : XLOADI16;
+        case 4: return is_unsigned_integer_type(elmnt_type) ? XLOADIU32 : XLOADI32;
+        default: return XLOADI;
+    }
+}
+
+uint8_t array_store_opcode(type_t elmnt_type)
+{
+    switch (array_elmnt_size(elmnt_type))
+    {
+        case 1: return XSTOREI8;
+        case 2: return XSTOREI16;
+        case 4: return XSTOREI32;
+        default: return XSTOREI;
+    }
+}
+
 void eval_assign(ast_assign_t* ast)
 {
-    eval(ast->expr);
     type_t var_type = ast->symbol->type;
     uint16_t addr_on_stack = ast->symbol->addr_on_stack;
 
-    if (ast->index_expr)
+    int64_t addend;
+    ast_variable_t* update = ast_element_update(ast);
+
+    if (update != NULL)
+    {
+        // The element is located once, then loaded, updated and stored
+        // back through a copy of the index
+        // The value is of the element type, or of the field for an
+        // array of structs
+        ast_binary_t* binary = (ast_binary_t*) ast->expr;
+        type_t elmnt_type = ast->symbol->extra.array.elmnt_type;
+        type_t value_type = update->base->type;
+        type_t rhs_type = binary->rhs_expr->base->type;
+
+        eval(ast->index_expr);
+        if (!bounds_index_safe(ast->index_expr, ast->symbol->extra.array.len))
+            EMIT(ACHECK, NUM16(addr_on_stack));
+
+        if (update_addend(ast, &addend))
+            EMIT(AADDI, NUM16(addr_on_stack), NUM32(addend));
+        else
+        {
+            EMIT(DUP);
+            EMIT(array_load_opcode(elmnt_type), NUM16(addr_on_stack));
+
+            eval(binary->rhs_expr);
+
+            if (is_real_type(value_type) && is_integer_type(rhs_type))
+            {
+                EMIT(ITOR);
+                rhs_type = MT_REAL;
+            }
+
+            emit_binary_op(binary->op, value_type, rhs_type, binary->base->type);
+            EMIT(SWAP);
+            EMIT(array_store_opcode(elmnt_type), NUM16(addr_on_stack));
+        }
+    }
+    else if (var_type == MT_MAP)
+    {
+        // A map starts out empty, so do heaps and deques
+        EMIT(MNEW, NUM16(addr_on_stack), NUM8(ast->symbol->extra.map.key_type));
+    }
+    else if (var_type == MT_HEAP)
+    {
+        EMIT(HNEW, NUM16(addr_on_stack), NUM8(ast->symbol->extra.queue.elmnt_type));
+    }
+    else if (var_type == MT_DEQUE)
     {
+        EMIT(DNEW, NUM16(addr_on_stack));
+    }
+    else if (ast->expr == NULL)
+    {
+        // A sized array starts out zeroed
+        type_t elmnt_type = ast->symbol->extra.array.elmnt_type;
+        uint64_t header = ((uint64_t) ast->symbol->extra.array.len << 16) | elmnt_type;
+        EMIT(I64CONST, NUM64(header));
+        EMIT(XSTORE, NUM16(addr_on_stack));
+        EMIT(AREF, NUM16(addr_on_stack));
+        EMIT(ICONST_0);
+        EMIT(AFILL);
+        EMIT(DROP);
+    }
+    else if (ast->index_expr)
+    {
+        eval(ast->expr);
         eval(ast->index_expr);
-        EMIT(XSTOREI, NUM16(ast->symbol->addr_on_stack));
+        if (!bounds_index_safe(ast->index_expr, ast->symbol->extra.array.len))
+            EMIT(ACHECK, NUM16(addr_on_stack));
+        EMIT(array_store_opcode(ast->symbol->extra.array.elmnt_type), NUM16(addr_on_stack));
+    }
+    else if (is_array_type(var_type) && ast_array_symbol(ast->expr) != NULL)
+    {
+        // Write the header and copy the elements over in one go
+        type_t elmnt_type = ast->symbol->extra.array.elmnt_type;
+        uint64_t header = ((uint64_t) ast->symbol->extra.array.len << 16) | elmnt_type;
+        EMIT(I64CONST, NUM64(header));
+        EMIT(XSTORE, NUM16(addr_on_stack));
+        EMIT(AREF, NUM16(addr_on_stack));
+        eval(ast->expr);
+        EMIT(ACOPY);
+        EMIT(DROP);
     }
     else if (is_array_type(var_type))
     {
+        eval(ast->expr);
         type_t elmnt_type = ast->symbol->extra.array.elmnt_type;
-        size_t array_len = ast->symbol->extra.array.len;
-        EMIT(ASTORE, NUM16(addr_on_stack), NUM16(array_len), NUM8(elmnt_type));
+        uint32_t array_len = ast->symbol->extra.array.len;
+        EMIT(ASTORE, NUM16(addr_on_stack), NUM32(array_len), NUM8(elmnt_type));
+    }
+    else if (is_integer_type(var_type) && update_addend(ast, &addend))
+    {
+        if (addend == 1)
+            EMIT(XINC, NUM16(addr_on_stack));
+        else if (addend == -1)
+            EMIT(XDEC, NUM16(addr_on_stack));
+        else
+            EMIT(XADDI, NUM16(addr_on_stack), NUM32(addend));
     } else {
+        eval(ast->expr);
         EMIT(XSTORE, NUM16(addr_on_stack));
     }
 
@@ -325,13 +655,18 @@ void eval_assign(ast_assign_t* ast)
 
 void eval_variable(ast_variable_t* ast)
 {
-    type_t var_type = ast->symbol->type;
     uint16_t addr_on_stack = ast->symbol->addr_on_stack;
 
     if (ast->index_expr)
     {
         eval(ast->index_expr);
-        EMIT(XLOADI, NUM16(addr_on_stack));
+        if (!bounds_index_safe(ast->index_expr, ast->symbol->extra.array.len))
+            EMIT(ACHECK, NUM16(addr_on_stack));
+        EMIT(array_load_opcode(ast->symbol->extra.array.elmnt_type), NUM16(addr_on_stack));
+    }
+    else if (is_array_type(ast->symbol->type))
+    {
+        EMIT(AREF, NUM16(addr_on_stack));
     }
     else
     {
@@ -339,28 +674,23 @@ void eval_variable(ast_variable_t* ast)
     }
 }
 
+// Function bodies are laid out after the main body, see ast_emit_func
 void eval_func_decl(ast_func_decl_t* ast)
 {
-    JUMP_NEW(func_end);
-    JUMP_NEW(func_beg);
-    JUMP(JMP, func_end);
-    MARK(func_beg);
+}
+
+void ast_emit_func(ast_func_decl_t* ast)
+{
+    MARK(ast->symbol->extra.func.entry);
 
     uint16_t vars = context_allocated(ast->body->context);
     uint16_t args = ast->args;
     EMIT(PROC, NUM16(args), NUM16((vars - args)));
 
-    ast->symbol->extra.func.call_addr = func_beg->label;
-
     eval((ast_t*) ast->body);
 
-    EMIT(ICONST_0, RET);
-    MARK(func_end);
-
-    JUMP_FIX(func_end);
-    JUMP_FIX(func_beg);
-    JUMP_FREE(func_end);
-    JUMP_FREE(func_beg);
+    if (!dce_terminates((ast_t*) ast->body))
+        EMIT(ICONST_0, RET);
 }
 
 void eval_func_call(ast_func_call_t* ast)
@@ -370,7 +700,7 @@ void eval_func_call(ast_func_call_t* ast)
         eval(vec_get(ast->args, i));
     }
     
-    EMIT(CALL, NUM16(ast->symbol->extra.func.call_addr));
+    JUMP(CALL, ast->symbol->extra.func.entry);
 }
 
 void eval_builtin_call(ast_builtin_call_t* ast)
@@ -436,19 +766,127 @@ void eval_func_return(ast_func_return_t* ast)
     EMIT(RET);
 }
 
+static void eval_int(int64_t value)
+{
+    eval((ast_t*) ast_new_constant(MT_INT64, (value_t) { .as_int64 = value }));
+}
+
+// The array element a for-in loop is at
+static void eval_for_in_element(ast_for_in_t* ast)
+{
+    // The index never leaves the array, no check needed
+    EMIT(XLOAD, NUM16(ast->index_addr));
+    EMIT(array_load_opcode(ast->array->extra.array.elmnt_type), NUM16(ast->array->addr_on_stack));
+    EMIT(XSTORE, NUM16(ast->symbol->addr_on_stack));
+}
+
+static void eval_unrolled_body(ast_t* loop, ast_t* body)
+{
+    if (loop->base->kind == AST_FOR_IN && ((ast_for_in_t*) loop)->array != NULL)
+        eval_for_in_element((ast_for_in_t*) loop);
+    eval(body);
+}
+
+// Emits a fully unrolled loop and returns true, or the unrolled iterations
+// of a partially unrolled one and returns false so the loop itself follows
+// for the remaining ones
+static bool_t eval_unrolled(ast_t* loop, ast_t* body, unroll_t* unroll)
+{
+    bounds_enter_loop(loop);
+
+    if (unroll->full)
+    {
+        for (uint16_t i = 0; i < unroll->copies; i++)
+        {
+            eval_int(unroll->from + (int64_t) i * unroll->step);
+            EMIT(XSTORE, NUM16(unroll->counter_addr));
+            eval_unrolled_body(loop, body);
+        }
+
+        // The counter of a for loop may be used after it
+        if (loop->base->kind == AST_FOR_LOOP && unroll->copies > 0)
+        {
+            eval_int(unroll->from + (int64_t) unroll->copies * unroll->step);
+            EMIT(XSTORE, NUM16(unroll->counter_addr));
+        }
+
+        bounds_leave_loop(loop);
+        return true;
+    }
+
+    // Every copy runs while the counter of the last one is in range
+    if (unroll->limit != NULL)
+        eval(unroll->limit);
+    else
+        EMIT(XLOAD, NUM16(((ast_for_in_t*) loop)->limit_addr));
+    eval_int((int64_t) (unroll->copies - 1) * unroll->step);
+    EMIT(ISUB);
+    EMIT(XSTORE, NUM16(unroll->limit_addr));
+
+    JUMP_NEW(begin);
+    JUMP_NEW(end);
+
+    JUMP(FORI, end);
+    EMIT(NUM16(unroll->counter_addr), NUM16(unroll->limit_addr), NUM16(unroll->step));
+    MARK(begin);
+
+    for (uint16_t i = 0; i < unroll->copies; i++)
+    {
+        if (i > 0)
+        {
+            EMIT(XLOAD, NUM16(unroll->counter_addr));
+            eval_int(unroll->step);
+            EMIT(IADD);
+            EMIT(XSTORE, NUM16(unroll->counter_addr));
+        }
+        eval_unrolled_body(loop, body);
+    }
+
+    JUMP(FORNEXT, begin);
+    EMIT(NUM16(unroll->counter_addr), NUM16(unroll->limit_addr), NUM16(unroll->step));
+    MARK(end);
+
+    JUMP_FIX(begin);
+    JUMP_FIX(end);
+    JUMP_FREE(begin);
+    JUMP_FREE(end);
+
+    bounds_leave_loop(loop);
+    return false;
+}
+
 void eval_for_loop(ast_for_loop_t* ast)
 {
     if (ast->loop == NULL)
         return;
 
     eval(ast->init);
+    // init and post are expressions unless init declares the variable,
+    // a struct is declared by an untyped block of field assignments
+    if (ast->init && !(ast->init->base->kind == AST_ASSIGN && ((ast_assign_t*) ast->init)->new_variable) &&
+        !(ast->init->base->kind == AST_BLOCK && ast->init->base->type == MT_UNKNOWN))
+        EMIT(DROP);
+    for (size_t i = 0; i < vec_size(ast->hoisted); i++)
+        eval(vec_get(ast->hoisted, i));
+
+    if (ast->unroll != NULL && eval_unrolled((ast_t*) ast, ast->body, ast->unroll))
+    {
+        JUMP_FREE(ast->loop->begin);
+        JUMP_FREE(ast->loop->end);
+        JUMP_FREE(ast->loop->post);
+        return;
+    }
+
     MARK(ast->loop->begin);
-    eval(ast->condition);
     if (ast->condition)
-        JUMP(JEZ, ast->loop->end);
+        eval_branch(ast->condition, ast->loop->end, false);
+    bounds_enter_loop((ast_t*) ast);
     eval(ast->body);
+    bounds_leave_loop((ast_t*) ast);
     MARK(ast->loop->post);
     eval(ast->post);
+    if (ast->post)
+        EMIT(DROP);
     JUMP(JMP, ast->loop->begin);
     MARK(ast->loop->end);
     
@@ -460,6 +898,108 @@ void eval_for_loop(ast_for_loop_t* ast)
     JUMP_FREE(ast->loop->post);
 }
 
+// MNEXT finds the first key at the position or after it, -1 past the
+// last one. The map must not change while it is iterated.
+static void eval_for_in_map(ast_for_in_t* ast)
+{
+    uint16_t map_addr = ast->map->addr_on_stack;
+
+    EMIT(ICONST_0);
+    EMIT(XSTORE, NUM16(ast->index_addr));
+    MARK(ast->loop->begin);
+    EMIT(XLOAD, NUM16(map_addr));
+    EMIT(XLOAD, NUM16(ast->index_addr));
+    EMIT(MNEXT);
+    EMIT(XSTORE, NUM16(ast->index_addr));
+    EMIT(XLOAD, NUM16(ast->index_addr));
+    EMIT(ICONST_0);
+    EMIT(ILT);
+    JUMP(JNZ, ast->loop->end);
+    EMIT(XLOAD, NUM16(map_addr));
+    EMIT(XLOAD, NUM16(ast->index_addr));
+    EMIT(MKEY);
+    EMIT(XSTORE, NUM16(ast->symbol->addr_on_stack));
+
+    eval(ast->body);
+
+    MARK(ast->loop->post);
+    EMIT(XINC, NUM16(ast->index_addr));
+    JUMP(JMP, ast->loop->begin);
+    MARK(ast->loop->end);
+
+    JUMP_FIX(ast->loop->begin);
+    JUMP_FIX(ast->loop->end);
+    JUMP_FIX(ast->loop->post);
+    JUMP_FREE(ast->loop->begin);
+    JUMP_FREE(ast->loop->end);
+    JUMP_FREE(ast->loop->post);
+}
+
+// FORI enters the loop only if the counter has not passed the limit yet,
+// FORNEXT steps the counter and jumps back to the body while it has not
+void eval_for_in(ast_for_in_t* ast)
+{
+    if (ast->loop == NULL)
+        return;
+
+    for (size_t i = 0; i < vec_size(ast->hoisted); i++)
+        eval(vec_get(ast->hoisted, i));
+
+    if (ast->map != NULL)
+    {
+        eval_for_in_map(ast);
+        return;
+    }
+
+    if (ast->array != NULL)
+    {
+        EMIT(ICONST_0);
+        EMIT(XSTORE, NUM16(ast->index_addr));
+        EMIT(I32CONST, NUM32(ast->array->extra.array.len));
+    }
+    else
+    {
+        eval(ast->from);
+        EMIT(XSTORE, NUM16(ast->index_addr));
+        eval(ast->to);
+    }
+    EMIT(XSTORE, NUM16(ast->limit_addr));
+
+    if (ast->unroll != NULL && eval_unrolled((ast_t*) ast, ast->body, ast->unroll))
+    {
+        JUMP_FREE(ast->loop->begin);
+        JUMP_FREE(ast->loop->end);
+        JUMP_FREE(ast->loop->post);
+        return;
+    }
+
+    JUMP_NEW(body);
+    JUMP(FORI, ast->loop->end);
+    EMIT(NUM16(ast->index_addr), NUM16(ast->limit_addr), NUM16(ast->step));
+    MARK(body);
+
+    if (ast->array != NULL)
+        eval_for_in_element(ast);
+
+    bounds_enter_loop((ast_t*) ast);
+    eval(ast->body);
+    bounds_leave_loop((ast_t*) ast);
+
+    MARK(ast->loop->post);
+    JUMP(FORNEXT, body);
+    EMIT(NUM16(ast->index_addr), NUM16(ast->limit_addr), NUM16(ast->step));
+    MARK(ast->loop->end);
+
+    JUMP_FIX(body);
+    JUMP_FIX(ast->loop->begin);
+    JUMP_FIX(ast->loop->end);
+    JUMP_FIX(ast->loop->post);
+    JUMP_FREE(body);
+    JUMP_FREE(ast->loop->begin);
+    JUMP_FREE(ast->loop->end);
+    JUMP_FREE(ast->loop->post);
+}
+
 void eval_break_loop(ast_break_loop_t* ast)
 {
     JUMP(JMP, ast->loop->end);
@@ -478,19 +1018,20 @@ void eval_array_scalar(ast_array_scalar_t* ast)
     }
 }
 
-ast_t* ast_new(type_t type, eval_t eval)
+ast_t* ast_new(ast_kind_t kind, type_t type, eval_t eval)
 {
     ast_t* ast = malloc(sizeof (ast_t));
     ast->base = NULL;
     ast->eval = eval;
     ast->type = type;
+    ast->kind = kind;
     return ast;
 }
 
 ast_constant_t* ast_new_constant(type_t type, value_t value)
 {
     ast_constant_t* ast_constant = malloc(sizeof (ast_constant_t));
-    ast_constant->base = ast_new(type, (eval_t)eval_constant);
+    ast_constant->base = ast_new(AST_CONSTANT, type, (eval_t)eval_constant);
     ast_constant->value = value;
     return ast_constant;
 }
@@ -498,7 +1039,7 @@ ast_constant_t* ast_new_constant(type_t type, value_t value)
 ast_unary_t* ast_new_unary(type_t type, token_type_t op, ast_t* expr)
 {
     ast_unary_t* ast_unary = malloc(sizeof (ast_unary_t));
-    ast_unary->base = ast_new(type, (eval_t) eval_unary);
+    ast_unary->base = ast_new(AST_UNARY, type, (eval_t) eval_unary);
     ast_unary->expr = expr;
     ast_unary->op = op;
     return ast_unary;
@@ -507,17 +1048,18 @@ ast_unary_t* ast_new_unary(type_t type, token_type_t op, ast_t* expr)
 ast_binary_t* ast_new_binary(type_t type, token_type_t op, ast_t* lhs_expr, ast_t* rhs_expr)
 {
     ast_binary_t* ast_binary = malloc(sizeof (ast_binary_t));
-    ast_binary->base = ast_new(type, (eval_t) eval_binary);
+    ast_binary->base = ast_new(AST_BINARY, type, (eval_t) eval_binary);
     ast_binary->lhs_expr = lhs_expr;
     ast_binary->rhs_expr = rhs_expr;
     ast_binary->op = op;
+    ast_binary->magic = NULL;
     return ast_binary;
 }
 
 ast_block_t* ast_new_block(type_t type, context_t* context)
 {
     ast_block_t* ast_block = malloc(sizeof (ast_block_t));
-    ast_block->base = ast_new(type, (eval_t) eval_block);
+    ast_block->base = ast_new(AST_BLOCK, type, (eval_t) eval_block);
     ast_block->context = context;
     ast_block->nodes = vec_new(0);
     return ast_block;
@@ -526,7 +1068,7 @@ ast_block_t* ast_new_block(type_t type, context_t* context)
 ast_single_opcode_t* ast_new_single_opcode(type_t type, uint8_t opcode)
 {
     ast_single_opcode_t* ast_single_opcode = malloc(sizeof (ast_single_opcode_t));
-    ast_single_opcode->base = ast_new(type, (eval_t) eval_single_opcode);
+    ast_single_opcode->base = ast_new(AST_SINGLE_OPCODE, type, (eval_t) eval_single_opcode);
     ast_single_opcode->opcode = opcode;
     return ast_single_opcode;
 }
@@ -534,7 +1076,7 @@ ast_single_opcode_t* ast_new_single_opcode(type_t type, uint8_t opcode)
 ast_if_cond_t* ast_new_if_cond(type_t type, ast_t* condition, ast_t* if_then, ast_t* if_else)
 {
     ast_if_cond_t* ast_if_cond = malloc(sizeof (ast_if_cond_t));
-    ast_if_cond->base = ast_new(type, (eval_t) eval_if_cond);
+    ast_if_cond->base = ast_new(AST_IF_COND, type, (eval_t) eval_if_cond);
     ast_if_cond->condition = condition;
     ast_if_cond->if_then = if_then;
     ast_if_cond->if_else = if_else;
@@ -544,7 +1086,7 @@ ast_if_cond_t* ast_new_if_cond(type_t type, ast_t* condition, ast_t* if_then, as
 ast_assign_t* ast_new_assign(type_t type, symbol_t* symbol, ast_t* expr, ast_t* index_expr, bool_t new_variable)
 {
     ast_assign_t* ast_assign = malloc(sizeof (ast_assign_t));
-    ast_assign->base = ast_new(type, (eval_t) eval_assign);
+    ast_assign->base = ast_new(AST_ASSIGN, type, (eval_t) eval_assign);
     ast_assign->symbol = symbol;
     ast_assign->expr = expr;
     ast_assign->index_expr = index_expr;
@@ -555,7 +1097,7 @@ ast_assign_t* ast_new_assign(type_t type, symbol_t* symbol, ast_t* expr, ast_t*
 ast_variable_t* ast_new_variable(type_t type, symbol_t* symbol, ast_t* index_expr)
 {
     ast_variable_t* ast_variable = malloc(sizeof (ast_variable_t));
-    ast_variable->base = ast_new(type, (eval_t) eval_variable);
+    ast_variable->base = ast_new(AST_VARIABLE, type, (eval_t) eval_variable);
     ast_variable->symbol = symbol;
     ast_variable->index_expr = index_expr;
     return ast_variable;
@@ -564,7 +1106,7 @@ ast_variable_t* ast_new_variable(type_t type, symbol_t* symbol, ast_t* index_exp
 ast_func_decl_t* ast_new_func_decl(type_t type, symbol_t* symbol, ast_block_t* body, uint16_t args)
 {
     ast_func_decl_t* ast_func_decl = malloc(sizeof (ast_func_decl_t));
-    ast_func_decl->base = ast_new(type, (eval_t) eval_func_decl);
+    ast_func_decl->base = ast_new(AST_FUNC_DECL, type, (eval_t) eval_func_decl);
     ast_func_decl->symbol = symbol;
     ast_func_decl->body = body;
     ast_func_decl->args = args;
@@ -575,7 +1117,7 @@ ast_func_decl_t* ast_new_func_decl(type_t type, symbol_t* symbol, ast_block_t* b
 ast_func_call_t* ast_new_func_call(type_t type, symbol_t* symbol, vector_t* args)
 {
     ast_func_call_t* ast_func_call = malloc(sizeof (ast_func_call_t));
-    ast_func_call->base = ast_new(type, (eval_t) eval_func_call);
+    ast_func_call->base = ast_new(AST_FUNC_CALL, type, (eval_t) eval_func_call);
     ast_func_call->symbol = symbol;
     ast_func_call->args = args;
     return ast_func_call;
@@ -584,7 +1126,7 @@ ast_func_call_t* ast_new_func_call(type_t type, symbol_t* symbol, vector_t* args
 ast_builtin_call_t* ast_new_builtin_call(type_t type, const char* name, vector_t* args)
 {
     ast_builtin_call_t* ast_builtin_call = malloc(sizeof (ast_builtin_call_t));
-    ast_builtin_call->base = ast_new(type, (eval_t) eval_builtin_call);
+    ast_builtin_call->base = ast_new(AST_BUILTIN_CALL, type, (eval_t) eval_builtin_call);
     ast_builtin_call->name = name;
     ast_builtin_call->args = args;
     return ast_builtin_call;
@@ -593,7 +1135,7 @@ ast_builtin_call_t* ast_new_builtin_call(type_t type, const char* name, vector_t
 ast_func_return_t* ast_new_func_return(type_t type, ast_t* expr)
 {
     ast_func_return_t* ast_func_return = malloc(sizeof (ast_func_return_t));
-    ast_func_return->base = ast_new(type, (eval_t) eval_func_return);
+    ast_func_return->base = ast_new(AST_FUNC_RETURN, type, (eval_t) eval_func_return);
     ast_func_return->expr = expr;
     return ast_func_return;
 }
@@ -601,19 +1143,40 @@ ast_func_return_t* ast_new_func_return(type_t type, ast_t* expr)
 ast_for_loop_t* ast_new_for_loop(type_t type, ast_t* init, ast_t* condition, ast_t* post, ast_t* body)
 {
     ast_for_loop_t* ast_for_loop = malloc(sizeof (ast_for_loop_t));
-    ast_for_loop->base = ast_new(type, (eval_t) eval_for_loop);
+    ast_for_loop->base = ast_new(AST_FOR_LOOP, type, (eval_t) eval_for_loop);
     ast_for_loop->init = init;
     ast_for_loop->condition = condition;
     ast_for_loop->post = post;
     ast_for_loop->body = body;
     ast_for_loop->loop = body == NULL ? NULL : context_get_loop(((ast_block_t*) body)->context);
+    ast_for_loop->hoisted = NULL;
+    ast_for_loop->unroll = NULL;
     return ast_for_loop;
 }
 
+ast_for_in_t* ast_new_for_in(type_t type, symbol_t* symbol, ast_t* from, ast_t* to, int16_t step, symbol_t* array, symbol_t* map, uint16_t index_addr, uint16_t limit_addr, ast_t* body)
+{
+    ast_for_in_t* ast_for_in = malloc(sizeof (ast_for_in_t));
+    ast_for_in->base = ast_new(AST_FOR_IN, type, (eval_t) eval_for_in);
+    ast_for_in->symbol = symbol;
+    ast_for_in->from = from;
+    ast_for_in->to = to;
+    ast_for_in->step = step;
+    ast_for_in->array = array;
+    ast_for_in->map = map;
+    ast_for_in->index_addr = index_addr;
+    ast_for_in->limit_addr = limit_addr;
+    ast_for_in->body = body;
+    ast_for_in->loop = body == NULL ? NULL : context_get_loop(((ast_block_t*) body)->context);
+    ast_for_in->hoisted = NULL;
+    ast_for_in->unroll = NULL;
+    return ast_for_in;
+}
+
 ast_break_loop_t* ast_new_break_loop(type_t type, loop_t* loop)
 {
     ast_break_loop_t* ast_break_loop = malloc(sizeof (ast_break_loop_t));
-    ast_break_loop->base = ast_new(type, (eval_t) eval_break_loop);
+    ast_break_loop->base = ast_new(AST_BREAK_LOOP, type, (eval_t) eval_break_loop);
     ast_break_loop->loop = loop;
     return ast_break_loop;
 }
@@ -621,7 +1184,7 @@ ast_break_loop_t* ast_new_break_loop(type_t type, loop_t* loop)
 ast_continue_loop_t* ast_new_continue_loop(type_t type, loop_t* loop)
 {
     ast_continue_loop_t* ast_continue_loop = malloc(sizeof (ast_continue_loop_t));
-    ast_continue_loop->base = ast_new(type, (eval_t) eval_continue_loop);
+    ast_continue_loop->base = ast_new(AST_CONTINUE_LOOP, type, (eval_t) eval_continue_loop);
     ast_continue_loop->loop = loop;
     return ast_continue_loop;
 }
@@ -629,7 +1192,7 @@ ast_continue_loop_t* ast_new_continue_loop(type_t type, loop_t* loop)
 ast_array_scalar_t* ast_new_array_scalar(type_t type, type_t elmnt_type, vector_t* elmnts)
 {
     ast_array_scalar_t* ast_array_scalar = malloc(sizeof (ast_array_scalar_t));
-    ast_array_scalar->base = ast_new(type, (eval_t) eval_array_scalar);
+    ast_array_scalar->base = ast_new(AST_ARRAY_SCALAR, type, (eval_t) eval_array_scalar);
     ast_array_scalar->elmnts = elmnts;
     ast_array_scalar->elmnt_type = elmnt_type;
     return ast_array_scalar;
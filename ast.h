@@ -15,11 +15,33 @@ extern "C"
 
 typedef void(*eval_t)(void*);
 
+typedef enum
+{
+    AST_CONSTANT,
+    AST_UNARY,
+    AST_BINARY,
+    AST_BLOCK,
+    AST_SINGLE_OPCODE,
+    AST_IF_COND,
+    AST_ASSIGN,
+    AST_VARIABLE,
+    AST_FUNC_DECL,
+    AST_FUNC_CALL,
+    AST_BUILTIN_CALL,
+    AST_FUNC_RETURN,
+    AST_FOR_LOOP,
+    AST_BREAK_LOOP,
+    AST_CONTINUE_LOOP,
+    AST_ARRAY_SCALAR,
+    AST_FOR_IN,
+} ast_kind_t;
+
 struct ast_t
 {
     struct ast_t* base;
     eval_t eval;
     type_t type;
+    ast_kind_t kind;
 };
 
 typedef struct ast_t ast_t;
@@ -37,12 +59,20 @@ typedef struct
     token_type_t op;
 } ast_unary_t;
 
+// Division by a constant as a multiply by its magic number, see strength.c
+typedef struct
+{
+    int64_t magic;
+    uint8_t shift;
+} magic_t;
+
 typedef struct
 {
     ast_t* base;
     ast_t* lhs_expr;
     ast_t* rhs_expr;
     token_type_t op;
+    magic_t* magic;     // the constant divisor of a / or % is not divided by
 } ast_binary_t;
 
 typedef struct
@@ -112,6 +142,18 @@ typedef struct
     ast_t* expr;
 } ast_func_return_t;
 
+// How a counted loop is unrolled, see unroll.c
+typedef struct
+{
+    uint16_t copies;        // body copies per iteration, the trip count when full
+    bool_t full;            // every iteration is a copy, no loop is left
+    int64_t from;           // first counter value when full
+    int16_t step;
+    uint16_t counter_addr;
+    uint16_t limit_addr;    // hidden limit of the unrolled iterations
+    ast_t* limit;           // exclusive loop limit, NULL for the for-in one
+} unroll_t;
+
 typedef struct
 {
     ast_t* base;
@@ -120,9 +162,30 @@ typedef struct
     ast_t* post;
     ast_t* body;
     loop_t* loop;
-
+    vector_t* hoisted;  // loop invariant assigns run before the loop
+    unroll_t* unroll;
 } ast_for_loop_t;
 
+// for symbol in from..to step n, or for symbol in array where the
+// hidden index slot walks the elements, or for symbol in map where it
+// holds the position of the key in the table
+typedef struct
+{
+    ast_t* base;
+    symbol_t* symbol;
+    ast_t* from;
+    ast_t* to;
+    int16_t step;
+    symbol_t* array;
+    symbol_t* map;
+    uint16_t index_addr;
+    uint16_t limit_addr;
+    ast_t* body;
+    loop_t* loop;
+    vector_t* hoisted;
+    unroll_t* unroll;
+} ast_for_in_t;
+
 typedef struct
 {
     ast_t* base;
@@ -142,7 +205,14 @@ typedef struct
     type_t elmnt_type;
 } ast_array_scalar_t;
 
+typedef bool_t (*ast_visit_t)(ast_t* ast, void* arg);
+
 void eval(ast_t* ast);
+void ast_walk(ast_t* ast, ast_visit_t visit, void* arg);
+symbol_t* ast_array_symbol(ast_t* ast);
+bool_t ast_assigns(ast_t* ast, symbol_t* symbol);
+ast_variable_t* ast_element_update(ast_assign_t* ast);
+void ast_emit_func(ast_func_decl_t* ast);
 ast_constant_t* ast_new_constant(type_t type, value_t value);
 ast_unary_t* ast_new_unary(type_t type, token_type_t op, ast_t* expr);
 ast_binary_t* ast_new_binary(type_t type, token_type_t op, ast_t* lhs_expr, ast_t* rhs_expr);
@@ -156,6 +226,7 @@ ast_func_call_t* ast_new_func_call(type_t type, symbol_t* symbol, vector_t* args
 ast_builtin_call_t* ast_new_builtin_call(type_t type, const char* name, vector_t* args);
 ast_func_return_t* ast_new_func_return(type_t type, ast_t* expr);
 ast_for_loop_t* ast_new_for_loop(type_t type, ast_t* init, ast_t* condition, ast_t* post, ast_t* body);
+ast_for_in_t* ast_new_for_in(type_t type, symbol_t* symbol, ast_t* from, ast_t* to, int16_t step, symbol_t* array, symbol_t* map, uint16_t index_addr, uint16_t limit_addr, ast_t* body);
 ast_break_loop_t* ast_new_break_loop(type_t type, loop_t* loop);
 ast_continue_loop_t* ast_new_continue_loop(type_t type, loop_t* loop);
 ast_array_scalar_t* ast_new_array_scalar(type_t type, type_t elmnt_type, vector_t* elmnts);
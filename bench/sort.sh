@@ -0,0 +1,73 @@
+#!/bin/sh
+# Compares the native sort() builtin against the insertion sort our
+# examples hand-code. Usage: bench/sort.sh [sizes...]
+#
+# Array literals are the only way to fill an array, so sizes are bounded
+# by the VM: an array must fit in 65535 stack slots (131070 i32 elements)
+# and code after a literal of more than ~12K i32 elements is beyond the
+# 16-bit jump addresses, which the insertion sort loops need. Insertion
+# sort is skipped above INSERTION_MAX elements.
+
+LIME=${LIME:-./build/lime}
+TMP=${TMPDIR:-/tmp}/lime-bench-sort
+SIZES=${*:-1000 10000 100000}
+INSERTION_MAX=${INSERTION_MAX:-10000}
+
+mkdir -p "$TMP"
+
+gen()
+{
+    # $1: size, $2: sort kind
+    awk -v n="$1" -v kind="$2" 'BEGIN {
+        srand(42)
+        printf "var a = ["
+        for (i = 0; i < n; i++)
+            printf "%s%d", (i ? ", " : ""), int(rand() * 2000000) - 1000000
+        printf "]\n"
+        if (kind == "native")
+            print "sort(a)"
+        else
+        {
+            # Same insertion sort as examples/code-bubble-sort.lm
+            print "for var i: i32 = 1; i < alen(a); i = i + 1 {"
+            print "    var x = a[i]"
+            print "    var j = i"
+            print "    for 0; j > 0 and a[j - 1] > x; 0 {"
+            print "        a[j] = a[j - 1]"
+            print "        j = j - 1"
+            print "    }"
+            print "    a[j] = x"
+            print "}"
+        }
+        print "print(a[0], \" \", a[alen(a) - 1], \"\\n\")"
+    }' > "$TMP/$2-$1.lm"
+}
+
+run()
+{
+    # Prints the best wall time out of three runs in seconds
+    $LIME --c --gen "${1%.lm}.lmx" "$1" || exit 1
+    best=
+    for r in 1 2 3; do
+        start=$(date +%s.%N)
+        $LIME --x "${1%.lm}.lmx" > /dev/null
+        end=$(date +%s.%N)
+        best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if (NF == 3 && $3 < t) t = $3; printf "%.4f", t }')
+    done
+    echo "$best"
+}
+
+printf "%10s %12s %12s %10s\n" size insertion native speedup
+for n in $SIZES; do
+    gen "$n" native
+    t2=$(run "$TMP/native-$n.lm")
+    if [ "$n" -le "$INSERTION_MAX" ]; then
+        gen "$n" insertion
+        t1=$(run "$TMP/insertion-$n.lm")
+        speedup=$(echo "$t1 $t2" | awk '{ printf "%.1fx", $1 / $2 }')
+    else
+        t1=-
+        speedup=-
+    fi
+    printf "%10s %12s %12s %10s\n" "$n" "$t1" "$t2" "$speedup"
+done
@@ -0,0 +1,262 @@
+#include "bounds.h"
+#include "ast.h"
+#include "builtins.h"
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Array accesses are checked against the array header at run time unless
+// the index is proven to be in range. Inside a counted loop like
+//
+//   for var i: i32 = 0; i < alen(arr); i = i + 1 { ... arr[i] ... }
+//
+// the induction variable stays in [lo, hi) as long as the body does not
+// assign it, so arr[i], arr[i + c] and arr[i - c] need no check when that
+// range shifted by c fits the array. The same holds for the counter of
+// `for i in lo..hi` loops.
+
+#define BOUNDS_MAX_LOOPS 32
+
+typedef struct
+{
+    ast_t* loop;
+    symbol_t* symbol;
+    int64_t lo;
+    int64_t hi;  // exclusive
+} bounds_range_t;
+
+static bounds_range_t ranges[BOUNDS_MAX_LOOPS];
+static size_t ranges_count = 0;
+
+// Value of an expression known at compile time, array lengths included
+static bool_t static_int(ast_t* ast, int64_t* value)
+{
+    if (ast == NULL)
+        return false;
+
+    switch (ast->base->kind)
+    {
+        case AST_CONSTANT:
+            if (!is_integer_type(ast->base->type))
+                return false;
+            *value = ((ast_constant_t*) ast)->value.as_int64;
+            return true;
+        case AST_UNARY:
+        {
+            ast_unary_t* unary = (ast_unary_t*) ast;
+            if (unary->op != TK_MINUS || !static_int(unary->expr, value))
+                return false;
+            *value = -*value;
+            return true;
+        }
+        case AST_BUILTIN_CALL:
+        {
+            ast_builtin_call_t* call = (ast_builtin_call_t*) ast;
+            const builtin_func_t* builtin = builtin_lookup(call->name);
+            if (builtin == NULL || builtin->opcode != ALEN)
+                return false;
+            symbol_t* array = ast_array_symbol(vec_first(call->args));
+            if (array == NULL)
+                return false;
+            *value = array->extra.array.len;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static symbol_t* scalar_symbol(ast_t* ast)
+{
+    if (ast == NULL || ast->base->kind != AST_VARIABLE)
+        return NULL;
+
+    ast_variable_t* var = (ast_variable_t*) ast;
+    if (var->index_expr != NULL || !is_integer_type(var->symbol->type))
+        return NULL;
+
+    return var->symbol;
+}
+
+// A symbol times a positive constant, i * k or i << k
+static symbol_t* scaled_symbol(ast_t* ast, int64_t* scale)
+{
+    *scale = 1;
+
+    if (ast->base->kind != AST_BINARY)
+        return scalar_symbol(ast);
+
+    ast_binary_t* binary = (ast_binary_t*) ast;
+    symbol_t* symbol = NULL;
+    int64_t value;
+
+    if (binary->op == TK_MUL && (symbol = scalar_symbol(binary->lhs_expr)) != NULL && static_int(binary->rhs_expr, &value))
+        *scale = value;
+    else if (binary->op == TK_MUL && (symbol = scalar_symbol(binary->rhs_expr)) != NULL && static_int(binary->lhs_expr, &value))
+        *scale = value;
+    else if (binary->op == TK_SHL && (symbol = scalar_symbol(binary->lhs_expr)) != NULL &&
+        static_int(binary->rhs_expr, &value) && value >= 0 && value < 16)
+        *scale = (int64_t) 1 << value;
+    else
+        return NULL;
+
+    return *scale > 0 && *scale <= UINT16_MAX ? symbol : NULL;
+}
+
+// Splits an index into symbol * scale + constant offset, the fields of
+// an array of structs are indexed by i * <fields> + <field>
+static symbol_t* index_offset(ast_t* ast, int64_t* scale, int64_t* offset)
+{
+    *offset = 0;
+
+    if (ast->base->kind != AST_BINARY || (((ast_binary_t*) ast)->op != TK_PLUS && ((ast_binary_t*) ast)->op != TK_MINUS))
+        return scaled_symbol(ast, scale);
+
+    ast_binary_t* binary = (ast_binary_t*) ast;
+    symbol_t* symbol;
+
+    if (binary->op == TK_PLUS)
+    {
+        if ((symbol = scaled_symbol(binary->lhs_expr, scale)) != NULL && static_int(binary->rhs_expr, offset))
+            return symbol;
+        if ((symbol = scaled_symbol(binary->rhs_expr, scale)) != NULL && static_int(binary->lhs_expr, offset))
+            return symbol;
+    }
+    else if (binary->op == TK_MINUS)
+    {
+        if ((symbol = scaled_symbol(binary->lhs_expr, scale)) != NULL && static_int(binary->rhs_expr, offset))
+        {
+            *offset = -*offset;
+            return symbol;
+        }
+    }
+
+    return NULL;
+}
+
+// Matches `i = <const>`, `i < <const>` (or <=) and `i = i + <positive const>`
+static bool_t loop_range(ast_for_loop_t* loop, bounds_range_t* range)
+{
+    if (loop->init == NULL || loop->condition == NULL || loop->post == NULL)
+        return false;
+
+    if (loop->init->base->kind != AST_ASSIGN)
+        return false;
+
+    ast_assign_t* init = (ast_assign_t*) loop->init;
+    symbol_t* symbol = init->symbol;
+
+    if (init->index_expr != NULL || !is_integer_type(symbol->type) || !static_int(init->expr, &range->lo))
+        return false;
+
+    if (loop->condition->base->kind != AST_BINARY)
+        return false;
+
+    ast_binary_t* cond = (ast_binary_t*) loop->condition;
+
+    if ((cond->op != TK_LT && cond->op != TK_LTE) || scalar_symbol(cond->lhs_expr) != symbol ||
+        !static_int(cond->rhs_expr, &range->hi))
+        return false;
+
+    if (cond->op == TK_LTE)
+        range->hi++;
+
+    if (loop->post->base->kind != AST_ASSIGN)
+        return false;
+
+    ast_assign_t* post = (ast_assign_t*) loop->post;
+    int64_t scale;
+    int64_t step;
+
+    if (post->symbol != symbol || post->index_expr != NULL || index_offset(post->expr, &scale, &step) != symbol ||
+        scale != 1 || step <= 0)
+        return false;
+
+    if (ast_assigns(loop->body, symbol))
+        return false;
+
+    range->symbol = symbol;
+    return true;
+}
+
+static bool_t for_in_range(ast_for_in_t* loop, bounds_range_t* range)
+{
+    int64_t from;
+    int64_t to;
+
+    if (loop->array != NULL || !static_int(loop->from, &from) || !static_int(loop->to, &to))
+        return false;
+
+    if (ast_assigns(loop->body, loop->symbol))
+        return false;
+
+    if (loop->step > 0)
+    {
+        range->lo = from;
+        range->hi = to;
+    }
+    else
+    {
+        range->lo = to + 1;
+        range->hi = from + 1;
+    }
+
+    range->symbol = loop->symbol;
+    return true;
+}
+
+void bounds_enter_loop(ast_t* loop)
+{
+    if (ranges_count == BOUNDS_MAX_LOOPS)
+        return;
+
+    bounds_range_t* range = &ranges[ranges_count];
+    bool_t found = false;
+
+    if (loop->base->kind == AST_FOR_LOOP)
+        found = loop_range((ast_for_loop_t*) loop, range);
+    else if (loop->base->kind == AST_FOR_IN)
+        found = for_in_range((ast_for_in_t*) loop, range);
+
+    if (found)
+    {
+        range->loop = loop;
+        ranges_count++;
+    }
+}
+
+void bounds_leave_loop(ast_t* loop)
+{
+    if (ranges_count > 0 && ranges[ranges_count - 1].loop == loop)
+        ranges_count--;
+}
+
+bool_t bounds_index_safe(ast_t* index_expr, size_t len)
+{
+    int64_t value;
+
+    if (static_int(index_expr, &value))
+        return value >= 0 && (uint64_t) value < len;
+
+    int64_t scale;
+    int64_t offset;
+    symbol_t* symbol = index_offset(index_expr, &scale, &offset);
+
+    if (symbol == NULL || offset < INT32_MIN || offset > INT32_MAX)
+        return false;
+
+    for (size_t i = ranges_count; i > 0; i--)
+    {
+        bounds_range_t* range = &ranges[i - 1];
+
+        if (range->symbol != symbol)
+            continue;
+
+        if (range->lo < INT32_MIN || range->hi > INT32_MAX || range->lo >= range->hi)
+            return false;
+
+        return range->lo * scale + offset >= 0 && (range->hi - 1) * scale + offset < (int64_t) len;
+    }
+
+    return false;
+}
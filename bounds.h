@@ -0,0 +1,20 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include "ast.h"
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void bounds_enter_loop(ast_t* loop);
+void bounds_leave_loop(ast_t* loop);
+bool_t bounds_index_safe(ast_t* index_expr, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOUNDS_H */
@@ -9,6 +9,12 @@ static const type_t REAL_TYPES[] = {MT_REAL, MT_UNKNOWN};
 static const type_t STR_TYPES[] = {MT_STR, MT_UNKNOWN};
 static const type_t ARRAY_TYPES[] = {MT_ARRAY, MT_UNKNOWN};
 static const type_t NUMERIC_TYPES[] = {MT_INT8, MT_INT16, MT_INT32, MT_INT64, MT_UINT8, MT_UINT16, MT_UINT32, MT_UINT64, MT_REAL, MT_BOOL, MT_UNKNOWN};
+static const type_t COUNT_EQ_TYPES[] = {MT_ARRAY, MT_INT8, MT_INT16, MT_INT32, MT_INT64, MT_UINT8, MT_UINT16, MT_UINT32, MT_UINT64, MT_REAL, MT_UNKNOWN};
+static const type_t FILL_TYPES[] = {MT_ARRAY, MT_INT8, MT_INT16, MT_INT32, MT_INT64, MT_UINT8, MT_UINT16, MT_UINT32, MT_UINT64, MT_REAL, MT_BOOL, MT_STR, MT_UNKNOWN};
+static const type_t SLICE_TYPES[] = {MT_ARRAY, MT_INT8, MT_INT16, MT_INT32, MT_INT64, MT_UINT8, MT_UINT16, MT_UINT32, MT_UINT64, MT_UNKNOWN};
+static const type_t MAP_TYPES[] = {MT_MAP, MT_INT8, MT_INT16, MT_INT32, MT_INT64, MT_UINT8, MT_UINT16, MT_UINT32, MT_UINT64, MT_REAL, MT_BOOL, MT_STR, MT_UNKNOWN};
+static const type_t HEAP_TYPES[] = {MT_HEAP, MT_INT8, MT_INT16, MT_INT32, MT_INT64, MT_UINT8, MT_UINT16, MT_UINT32, MT_UINT64, MT_REAL, MT_BOOL, MT_UNKNOWN};
+static const type_t DEQUE_TYPES[] = {MT_DEQUE, MT_INT8, MT_INT16, MT_INT32, MT_INT64, MT_UINT8, MT_UINT16, MT_UINT32, MT_UINT64, MT_REAL, MT_BOOL, MT_STR, MT_UNKNOWN};
 static const type_t PRINT_TYPES[] = {MT_INT8, MT_INT16, MT_INT32, MT_INT64, MT_UINT8, MT_UINT16, MT_UINT32, MT_UINT64, MT_REAL, MT_BOOL, MT_STR, MT_UNKNOWN};
 
 static const builtin_func_t BUILTIN_FUNCTIONS[] = {
@@ -41,6 +47,36 @@ static const builtin_func_t BUILTIN_FUNCTIONS[] = {
     {"rtoi", 1, MT_INT64, RTOI, REAL_TYPES},
     {"slen", 1, MT_INT64, SLEN, STR_TYPES},
     {"alen", 1, MT_INT64, ALEN, ARRAY_TYPES},
+    {"sum", 1, MT_UNKNOWN, ASUM, ARRAY_TYPES},  // return type depends on the element type
+    {"min", 1, MT_UNKNOWN, AMIN, ARRAY_TYPES},
+    {"max", 1, MT_UNKNOWN, AMAX, ARRAY_TYPES},
+    {"dot", 2, MT_UNKNOWN, ADOT, ARRAY_TYPES},
+    {"count_eq", 2, MT_INT64, ACOUNT, COUNT_EQ_TYPES},
+    {"argmin", 1, MT_INT64, AARGMIN, ARRAY_TYPES},
+    {"argmax", 1, MT_INT64, AARGMAX, ARRAY_TYPES},
+    {"sort", 1, MT_VOID, ASORT, ARRAY_TYPES},
+    {"sort_desc", 1, MT_VOID, ASORTD, ARRAY_TYPES},
+    {"copy", 2, MT_VOID, ACOPY, ARRAY_TYPES},
+    {"fill", 2, MT_VOID, AFILL, FILL_TYPES},
+    {"copy_slice", 5, MT_VOID, ASLICE_COPY, SLICE_TYPES},  // dst, dst_at, src, src_at, count
+    {"equal", 2, MT_BOOL, AEQ, ARRAY_TYPES},
+    {"get", 2, MT_UNKNOWN, MGET, MAP_TYPES},  // return type is the value type of the map
+    {"get_or", 3, MT_UNKNOWN, MGETD, MAP_TYPES},  // map, key, value if the key is missing
+    {"set", 3, MT_UNKNOWN, MSET, MAP_TYPES},
+    {"has", 2, MT_BOOL, MHAS, MAP_TYPES},
+    {"del", 2, MT_BOOL, MDEL, MAP_TYPES},
+    {"mlen", 1, MT_INT64, MLEN, MAP_TYPES},
+    {"hpush", 2, MT_UNKNOWN, HPUSH, HEAP_TYPES},  // return type is the element type
+    {"hpop", 1, MT_UNKNOWN, HPOP, HEAP_TYPES},  // the least element
+    {"htop", 1, MT_UNKNOWN, HTOP, HEAP_TYPES},
+    {"hlen", 1, MT_INT64, HLEN, HEAP_TYPES},
+    {"push_back", 2, MT_UNKNOWN, DPUSH, DEQUE_TYPES},
+    {"push_front", 2, MT_UNKNOWN, DPUSHF, DEQUE_TYPES},
+    {"pop_back", 1, MT_UNKNOWN, DPOP, DEQUE_TYPES},
+    {"pop_front", 1, MT_UNKNOWN, DPOPF, DEQUE_TYPES},
+    {"front", 1, MT_UNKNOWN, DFRONT, DEQUE_TYPES},
+    {"back", 1, MT_UNKNOWN, DBACK, DEQUE_TYPES},
+    {"dlen", 1, MT_INT64, DLEN, DEQUE_TYPES},
 };
 
 // TODO: inc and dec for integer and real types need passing address of the variable to the builtin function
@@ -64,11 +100,103 @@ const builtin_func_t* builtin_lookup(const char* name)
     return NULL;
 }
 
+const builtin_datatype_t* builtin_datatype_lookup(const char* name)
+{
+    for (int i = 0; i < sizeof (BUILTIN_DATATYPES) / sizeof (BUILTIN_DATATYPES[0]); i++)
+    {
+        if (strcmp(BUILTIN_DATATYPES[i].name, name) == 0)
+        {
+            return &BUILTIN_DATATYPES[i];
+        }
+    }
+    return NULL;
+}
+
 bool_t builtin_is_reserved(const char* name)
 {
     return builtin_lookup(name) != NULL;
 }
 
+// Return type of a builtin taking an array with the given element type,
+// MT_UNKNOWN if the builtin can not work on such elements
+type_t builtin_array_ret_type(const builtin_func_t* builtin, type_t elmnt_type)
+{
+    switch (builtin->opcode)
+    {
+        case ALEN:
+            return builtin->ret_type;
+        case ASORT:
+        case ASORTD:
+        case ACOPY:
+        case AFILL:
+        case ASLICE_COPY:
+        case AEQ:
+            if (is_integer_type(elmnt_type) || is_real_type(elmnt_type) ||
+                is_bool_type(elmnt_type) || is_str_type(elmnt_type))
+                return builtin->ret_type;
+            return MT_UNKNOWN;
+    }
+
+    if (!is_integer_type(elmnt_type) && !is_real_type(elmnt_type))
+        return MT_UNKNOWN;
+
+    switch (builtin->opcode)
+    {
+        case ASUM:
+        case ADOT:
+            if (is_real_type(elmnt_type))
+                return MT_REAL;
+            return is_unsigned_integer_type(elmnt_type) ? MT_UINT64 : MT_INT64;
+        case AMIN:
+        case AMAX:
+            return elmnt_type;
+        default:
+            return builtin->ret_type;
+    }
+}
+
+// Return type of a builtin taking a map with the given value type
+type_t builtin_map_ret_type(const builtin_func_t* builtin, type_t value_type)
+{
+    switch (builtin->opcode)
+    {
+        case MGET:
+        case MGETD:
+        case MSET:
+            return value_type;
+        case MHAS:
+        case MDEL:
+        case MLEN:
+            return builtin->ret_type;
+        default:
+            return MT_UNKNOWN;
+    }
+}
+
+// Return type of a builtin taking a heap or a deque with the given
+// element type
+type_t builtin_queue_ret_type(const builtin_func_t* builtin, type_t elmnt_type)
+{
+    switch (builtin->opcode)
+    {
+        case HPUSH:
+        case HPOP:
+        case HTOP:
+        case DPUSH:
+        case DPUSHF:
+        case DPOP:
+        case DPOPF:
+        case DFRONT:
+        case DBACK:
+            return elmnt_type;
+        case HLEN:
+        case DLEN:
+            return builtin->ret_type;
+        default:
+            return MT_UNKNOWN;
+    }
+}
+
 bool is_builtin_type_acceptable(type_t type, const type_t* acceptable_types)
 {
     if (acceptable_types == NULL)
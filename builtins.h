@@ -39,11 +39,19 @@ static const builtin_datatype_t BUILTIN_DATATYPES[] = {
     {TK_BOOL_T, MT_BOOL, "bool"},
     {TK_VOID_T, MT_VOID, "void"},
     {TK_ARRAY_T, MT_ARRAY, "array"},
+    {TK_SOA_T, MT_ARRAY, "soa"},
+    {TK_MAP_T, MT_MAP, "map"},
+    {TK_HEAP_T, MT_HEAP, "heap"},
+    {TK_DEQUE_T, MT_DEQUE, "deque"},
 };
 
 const builtin_func_t* builtin_lookup(const char* name);
+const builtin_datatype_t* builtin_datatype_lookup(const char* name);
 bool_t builtin_is_reserved(const char* name);
 bool_t is_builtin_type_acceptable(type_t type, const type_t* acceptable_types);
+type_t builtin_array_ret_type(const builtin_func_t* builtin, type_t elmnt_type);
+type_t builtin_map_ret_type(const builtin_func_t* builtin, type_t value_type);
+type_t builtin_queue_ret_type(const builtin_func_t* builtin, type_t elmnt_type);
 
 #ifdef __cplusplus
 }
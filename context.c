@@ -1,17 +1,28 @@
 #include "context.h"
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 context_t * const global_context = &(context_t){NULL, MB_GLOBAL, NULL};
 
+// The function or global context whose frame holds the slots
+static context_t* context_frame(context_t* context)
+{
+    context_t* func_context = context_get_func(context);
+    return func_context != NULL ? func_context : global_context;
+}
+
 context_t* context_new(context_t* parent, block_t block_type)
 {
     context_t* context = malloc(sizeof (context_t));
     context->symbols = NULL;
     context->parent = parent;
     context->allocated = 0;
+    context->peak = 0;
+    context->mark = block_type == MB_FUNC ? 0 : context_frame(parent)->allocated;
+    context->temps = NULL;
     context->block_type = block_type;
     if (block_type == MB_LOOP)
     {
@@ -29,20 +40,61 @@ context_t* context_clone(context_t* context)
     cloned->block_type = context->block_type;
     cloned->symbols = vec_clone(context->symbols);
     cloned->allocated = context->allocated;
+    cloned->peak = context->peak;
+    cloned->mark = context->mark;
+    cloned->temps = context->temps != NULL ? vec_clone(context->temps) : NULL;
     return cloned;
 }
 
 void context_free(context_t* context)
 {
     vec_free(context->symbols);
+    if (context->temps != NULL)
+        vec_free(context->temps);
     free(context);
 }
 
+// The slots of a block's variables go back to the frame when the block
+// ends, so blocks that never live at the same time share them. Hidden
+// temps may outlive the block they were made in, they get slots of their
+// own on top of the frame once the whole function is parsed.
+void context_close(context_t* context)
+{
+    if (context->block_type != MB_FUNC && !context_is_global(context))
+    {
+        context_frame(context)->allocated = context->mark;
+        return;
+    }
+
+    for (size_t i = 0; i < vec_size(context->temps); i++)
+        ((symbol_t*) vec_get(context->temps, i))->addr_on_stack = ++context->peak;
+
+    if (context->temps != NULL)
+        vec_free(context->temps);
+    context->temps = NULL;
+}
+
 bool_t context_is_global(context_t* context)
 {
     return context == global_context;
 }
 
+static symbol_t* symbol_new(const char* id, type_t type, uint16_t addr_on_stack)
+{
+    symbol_t* symbol = malloc(sizeof (symbol_t));
+    symbol->id = id;
+    symbol->type = type;
+    symbol->addr_on_stack = addr_on_stack;
+    symbol->immutable = false;
+    symbol->constant = false;
+    symbol->value.as_int64 = 0;
+    symbol->extra.func.ret_type = MT_UNKNOWN;
+    symbol->extra.func.param_types = NULL;
+    symbol->extra.array.strct = NULL;
+    symbol->extra.array.columns = NULL;
+    return symbol;
+}
+
 symbol_t* context_add(context_t* context, const char* id, type_t type)
 {
     symbol_t* symbol = context_get(context, id, true);
@@ -53,12 +105,7 @@ symbol_t* context_add(context_t* context, const char* id, type_t type)
         return symbol;
     }
 
-    symbol_t* new_symbol = malloc(sizeof (symbol_t));
-    new_symbol->id = id;
-    new_symbol->type = type;
-    new_symbol->addr_on_stack = context_alloc_stack_addr(context, 1);
-    new_symbol->extra.func.ret_type = MT_UNKNOWN;
-    new_symbol->extra.func.param_types = NULL;
+    symbol_t* new_symbol = symbol_new(id, type, context_alloc_stack_addr(context, 1));
 
     if (context->symbols == NULL)
         context->symbols = vec_new(0);
@@ -66,6 +113,72 @@ symbol_t* context_add(context_t* context, const char* id, type_t type)
     return (symbol_t*) vec_append(context->symbols, new_symbol);
 }
 
+// A struct variable is its fields, each a variable of its own named
+// `id.field` in consecutive slots. The first field shares the slot of the
+// struct symbol, which only holds them together.
+symbol_t* context_add_struct(context_t* context, const char* id, struct_t* def)
+{
+    symbol_t* symbol = context_add(context, id, MT_STRUCT);
+    size_t count = vec_size(def->fields);
+
+    symbol->extra.strct.def = def;
+    symbol->extra.strct.fields = malloc(sizeof (symbol_t*) * count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        field_t* field = vec_get(def->fields, i);
+        char* name = malloc(strlen(id) + strlen(field->id) + 2);
+        sprintf(name, "%s.%s", id, field->id);
+
+        uint16_t addr = i == 0 ? symbol->addr_on_stack : context_alloc_stack_addr(context, 1);
+        symbol->extra.strct.fields[i] = vec_append(context->symbols, symbol_new(name, field->type, addr));
+    }
+
+    return symbol;
+}
+
+// An array of structs laid out by columns, an array of len elements for
+// every field named `id.field`, one after the other. The first column
+// shares the slot of the array symbol, so its header gives the length.
+void context_add_columns(context_t* context, symbol_t* symbol, struct_t* def, size_t len)
+{
+    size_t count = vec_size(def->fields);
+
+    symbol->type = MT_ARRAY;
+    symbol->extra.array.elmnt_type = ((field_t*) vec_get(def->fields, 0))->type;
+    symbol->extra.array.len = len;
+    symbol->extra.array.strct = def;
+    symbol->extra.array.columns = malloc(sizeof (symbol_t*) * count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        field_t* field = vec_get(def->fields, i);
+        char* name = malloc(strlen(symbol->id) + strlen(field->id) + 2);
+        sprintf(name, "%s.%s", symbol->id, field->id);
+
+        uint16_t addr = i == 0 ? symbol->addr_on_stack : context_alloc_stack_addr(context, 1);
+        symbol_t* column = symbol_new(name, MT_ARRAY, addr);
+        column->extra.array.elmnt_type = field->type;
+        column->extra.array.len = len;
+        context_alloc_stack_addr(context, array_slots(field->type, len));
+
+        symbol->extra.array.columns[i] = vec_append(context->symbols, column);
+    }
+}
+
+// Anonymous slot for values the compiler keeps on its own, it can not be
+// looked up by name. The slot is known once the frame is closed.
+symbol_t* context_add_temp(context_t* context, type_t type)
+{
+    context_t* frame = context_frame(context);
+    symbol_t* symbol = symbol_new("", type, 0);
+
+    if (frame->temps == NULL)
+        frame->temps = vec_new(0);
+
+    return (symbol_t*) vec_append(frame->temps, symbol);
+}
+
 symbol_t* context_get(context_t* context, const char* id, bool_t local)
 {
     for (context_t* c = context; c != NULL; c = c->parent)
@@ -99,7 +212,7 @@ size_t context_symbols_count(context_t* context)
 
 uint16_t context_allocated(context_t* context)
 {
-    return context->allocated;
+    return context->peak;
 }
 
 loop_t* context_get_loop(context_t* context)
@@ -127,12 +240,11 @@ context_t* context_get_func(context_t* context)
 
 uint16_t context_alloc_stack_addr(context_t* context, uint16_t size)
 {
-    context_t* func_context = context_get_func(context);
-    if (func_context != NULL)
-    {
-        func_context->allocated += size;
-        return func_context->allocated;
-    }
-    global_context->allocated += size;
-    return global_context->allocated;
+    context_t* frame = context_frame(context);
+
+    frame->allocated += size;
+    if (frame->allocated > frame->peak)
+        frame->peak = frame->allocated;
+
+    return frame->allocated;
 }
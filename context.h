@@ -10,21 +10,50 @@ extern "C"
 {
 #endif
 
+// A value struct, its fields take one slot each, in order
 typedef struct
+{
+    const char* id;
+    vector_t* fields;
+} struct_t;
+
+typedef struct
+{
+    const char* id;
+    type_t type;
+} field_t;
+
+typedef struct symbol_t
 {
     const char* id;
     type_t type;
     uint16_t addr_on_stack;
+    bool_t immutable;  // declared with let
+    bool_t constant;   // immutable with a compile time value
+    value_t value;
     union {
         struct {
-            uint16_t call_addr;
+            jump_t* entry;
             type_t ret_type;
             vector_t* param_types;
         } func;
         struct {
             type_t elmnt_type;
             size_t len;
+            struct_t* strct;        // element struct, NULL for plain arrays
+            struct symbol_t** columns;  // an array for every field, NULL unless soa
         } array;
+        struct {
+            struct_t* def;
+            struct symbol_t** fields;
+        } strct;
+        struct {
+            type_t key_type;
+            type_t value_type;
+        } map;
+        struct {
+            type_t elmnt_type;
+        } queue;
     } extra;
 } symbol_t;
 
@@ -40,14 +69,21 @@ typedef struct context_t
     struct context_t* parent;
     block_t block_type;
     vector_t* symbols;
-    uint16_t allocated;
+    uint16_t allocated;     // slots in use, of a function or the global frame
+    uint16_t peak;          // frame size
+    uint16_t mark;          // frame slots in use when a block started
+    vector_t* temps;        // hidden slots placed on top of the frame
     loop_t loop;
 } context_t;
 
 context_t* context_new(context_t* parent, block_t block_type);
 context_t* context_clone(context_t* context);
 void context_free(context_t* context);
+void context_close(context_t* context);
 symbol_t* context_add(context_t* context, const char* id, type_t type);
+symbol_t* context_add_struct(context_t* context, const char* id, struct_t* def);
+void context_add_columns(context_t* context, symbol_t* symbol, struct_t* def, size_t len);
+symbol_t* context_add_temp(context_t* context, type_t type);
 symbol_t* context_get(context_t* context, const char* id, bool_t local);
 bool_t context_is_global(context_t* context);
 size_t context_symbols_count(context_t* context);
@@ -0,0 +1,150 @@
+#include "dce.h"
+#include "ast.h"
+#include "context.h"
+#include "vector.h"
+#include <stddef.h>
+
+// Whether control never falls through the statement
+bool_t dce_terminates(ast_t* ast)
+{
+    if (ast == NULL)
+        return false;
+
+    switch (ast->base->kind)
+    {
+        case AST_FUNC_RETURN:
+        case AST_BREAK_LOOP:
+        case AST_CONTINUE_LOOP:
+            return true;
+        case AST_BLOCK:
+        {
+            vector_t* nodes = ((ast_block_t*) ast)->nodes;
+            for (size_t i = 0; i < vec_size(nodes); i++)
+            {
+                if (dce_terminates(vec_get(nodes, i)))
+                    return true;
+            }
+            return false;
+        }
+        case AST_IF_COND:
+        {
+            ast_if_cond_t* if_cond = (ast_if_cond_t*) ast;
+            return dce_terminates(if_cond->if_then) && dce_terminates(if_cond->if_else);
+        }
+        default:
+            return false;
+    }
+}
+
+static bool_t prune_visit(ast_t* ast, void* arg)
+{
+    if (ast->base->kind == AST_IF_COND)
+    {
+        // A folded condition leaves one branch that can never run
+        ast_if_cond_t* if_cond = (ast_if_cond_t*) ast;
+        if (if_cond->condition != NULL && if_cond->condition->base->kind == AST_CONSTANT)
+        {
+            if (((ast_constant_t*) if_cond->condition)->value.as_int64 != 0)
+                if_cond->if_else = NULL;
+            else
+                if_cond->if_then = NULL;
+        }
+    }
+    else if (ast->base->kind == AST_BLOCK)
+    {
+        // Statements after a return, break or continue are dropped.
+        // Function declarations stay, they do not run in place.
+        vector_t* nodes = ((ast_block_t*) ast)->nodes;
+        size_t used = 0;
+        bool_t dead = false;
+
+        for (size_t i = 0; i < vec_size(nodes); i++)
+        {
+            ast_t* node = vec_get(nodes, i);
+
+            if (!dead || (node != NULL && node->base->kind == AST_FUNC_DECL))
+                vec_set(nodes, used++, node);
+
+            if (dce_terminates(node))
+                dead = true;
+        }
+
+        if (used < vec_size(nodes))
+            vec_resize(nodes, used);
+    }
+
+    return true;
+}
+
+void dce_prune(ast_t* ast)
+{
+    ast_walk(ast, prune_visit, NULL);
+}
+
+typedef struct
+{
+    vector_t* decls;
+    vector_t* called;
+} reach_t;
+
+static bool_t decls_visit(ast_t* ast, void* arg)
+{
+    if (ast->base->kind == AST_FUNC_DECL)
+        vec_append(arg, ast);
+    return true;
+}
+
+static bool_t calls_visit(ast_t* ast, void* arg)
+{
+    reach_t* reach = arg;
+
+    if (ast->base->kind == AST_FUNC_DECL)
+        return false;
+
+    if (ast->base->kind == AST_FUNC_CALL)
+    {
+        symbol_t* symbol = ((ast_func_call_t*) ast)->symbol;
+
+        for (size_t i = 0; i < vec_size(reach->called); i++)
+        {
+            if (vec_get(reach->called, i) == symbol)
+                return true;
+        }
+        vec_append(reach->called, symbol);
+    }
+
+    return true;
+}
+
+// Declarations of the functions the main body can end up calling, in the
+// order they are first reached
+vector_t* dce_reachable_funcs(ast_t* ast)
+{
+    reach_t reach = { vec_new(0), vec_new(0) };
+    vector_t* funcs = vec_new(0);
+
+    ast_walk(ast, decls_visit, reach.decls);
+    ast_walk(ast, calls_visit, &reach);
+
+    // The called list grows while the bodies are walked
+    for (size_t i = 0; i < vec_size(reach.called); i++)
+    {
+        symbol_t* symbol = vec_get(reach.called, i);
+
+        for (size_t j = 0; j < vec_size(reach.decls); j++)
+        {
+            ast_func_decl_t* decl = vec_get(reach.decls, j);
+            if (decl->symbol == symbol)
+            {
+                vec_append(funcs, decl);
+                ast_walk((ast_t*) decl->body, calls_visit, &reach);
+                break;
+            }
+        }
+    }
+
+    vec_free(reach.decls);
+    vec_free(reach.called);
+
+    return funcs;
+}
@@ -0,0 +1,21 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "ast.h"
+#include "types.h"
+#include "vector.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+bool_t dce_terminates(ast_t* ast);
+void dce_prune(ast_t* ast);
+vector_t* dce_reachable_funcs(ast_t* ast);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DCE_H */
@@ -0,0 +1,227 @@
+#include "fold.h"
+#include "ast.h"
+#include "builtins.h"
+#include "types.h"
+#include "utf8.h"
+#include "vm.h"
+#include <math.h>
+#include <stdint.h>
+
+// Folds expressions whose operands are constants into a constant of the
+// type the parser inferred for them. Integers are computed as int64 and
+// reals as doubles, exactly like the VM does, so a folded expression has
+// the value it would have at run time. Divisions by zero are left for the
+// VM.
+
+static bool_t constant(ast_t* ast, value_t* value)
+{
+    if (ast->base->kind != AST_CONSTANT)
+        return false;
+
+    *value = ((ast_constant_t*) ast)->value;
+    return true;
+}
+
+static real_t as_real(ast_t* ast, value_t value)
+{
+    return is_real_type(ast->base->type) ? value.as_real : (real_t) value.as_int64;
+}
+
+static bool_t fold_integer(token_type_t op, bool_t is_unsigned, int64_t a, int64_t b, int64_t* r)
+{
+    switch (op)
+    {
+        case TK_PLUS: *r = (int64_t) ((uint64_t) a + (uint64_t) b); return true;
+        case TK_MINUS: *r = (int64_t) ((uint64_t) a - (uint64_t) b); return true;
+        case TK_MUL: *r = (int64_t) ((uint64_t) a * (uint64_t) b); return true;
+        case TK_DIV:
+        case TK_MOD:
+            if (b == 0 || (a == INT64_MIN && b == -1))
+                return false;
+            *r = op == TK_DIV ? a / b : a % b;
+            return true;
+        case TK_EQ: *r = a == b; return true;
+        case TK_NE: *r = a != b; return true;
+        case TK_LT: *r = a < b; return true;
+        case TK_LTE: *r = a <= b; return true;
+        case TK_GT: *r = a > b; return true;
+        case TK_GTE: *r = a >= b; return true;
+        case TK_AND_BIT: *r = a & b; return true;
+        case TK_OR_BIT: *r = a | b; return true;
+        case TK_XOR_BIT: *r = a ^ b; return true;
+        case TK_SHL: *r = (int64_t) ((uint64_t) a << (b & 63)); return true;
+        case TK_SHR: *r = is_unsigned ? (int64_t) ((uint64_t) a >> (b & 63)) : a >> (b & 63); return true;
+        // The short circuit leaves the left operand when it decides
+        case TK_AND: *r = a == 0 ? a : (a && b); return true;
+        case TK_OR: *r = a != 0 ? a : (a || b); return true;
+        default: return false;
+    }
+}
+
+static bool_t fold_real(token_type_t op, real_t a, real_t b, value_t* r)
+{
+    switch (op)
+    {
+        case TK_PLUS: r->as_real = a + b; return true;
+        case TK_MINUS: r->as_real = a - b; return true;
+        case TK_MUL: r->as_real = a * b; return true;
+        case TK_DIV: r->as_real = a / b; return true;
+        case TK_MOD: r->as_real = fmod(a, b); return true;
+        case TK_EQ: r->as_int64 = a == b; return true;
+        case TK_NE: r->as_int64 = a != b; return true;
+        case TK_LT: r->as_int64 = a < b; return true;
+        case TK_LTE: r->as_int64 = a <= b; return true;
+        case TK_GT: r->as_int64 = a > b; return true;
+        case TK_GTE: r->as_int64 = a >= b; return true;
+        default: return false;
+    }
+}
+
+static ast_t* fold_binary(ast_binary_t* ast)
+{
+    value_t a, b, r;
+
+    if (!constant(ast->lhs_expr, &a) || !constant(ast->rhs_expr, &b))
+        return (ast_t*) ast;
+
+    type_t lhs_type = ast->lhs_expr->base->type;
+    type_t rhs_type = ast->rhs_expr->base->type;
+
+    if (is_real_type(lhs_type) || is_real_type(rhs_type))
+    {
+        if (!fold_real(ast->op, as_real(ast->lhs_expr, a), as_real(ast->rhs_expr, b), &r))
+            return (ast_t*) ast;
+    }
+    else if (!fold_integer(ast->op, is_unsigned_integer_type(ast->base->type), a.as_int64, b.as_int64, &r.as_int64))
+    {
+        return (ast_t*) ast;
+    }
+
+    return (ast_t*) ast_new_constant(ast->base->type, r);
+}
+
+static ast_t* fold_unary(ast_unary_t* ast)
+{
+    value_t v;
+
+    if (!constant(ast->expr, &v))
+        return (ast_t*) ast;
+
+    if (is_real_type(ast->base->type))
+    {
+        if (ast->op == TK_MINUS)
+            v.as_real = -v.as_real;
+        else if (ast->op != TK_PLUS)
+            return (ast_t*) ast;
+    }
+    else
+    {
+        if (ast->op == TK_MINUS)
+            v.as_int64 = (int64_t) (0 - (uint64_t) v.as_int64);
+        else if (ast->op == TK_NOT)
+            v.as_int64 = !v.as_int64;
+        else if (ast->op != TK_PLUS)
+            return (ast_t*) ast;
+    }
+
+    return (ast_t*) ast_new_constant(ast->base->type, v);
+}
+
+static ast_t* fold_builtin_call(ast_builtin_call_t* ast)
+{
+    const builtin_func_t* builtin = builtin_lookup(ast->name);
+    value_t a, b, r;
+
+    if (builtin == NULL || vec_size(ast->args) == 0)
+        return (ast_t*) ast;
+
+    ast_t* arg = vec_first(ast->args);
+
+    if (builtin->opcode == ALEN)
+    {
+        symbol_t* array = ast_array_symbol(arg);
+        if (array == NULL)
+            return (ast_t*) ast;
+        r.as_int64 = array->extra.array.len;
+        return (ast_t*) ast_new_constant(ast->base->type, r);
+    }
+
+    if (builtin->opcode == SLEN)
+    {
+        // A let bound string stays a variable but its value is known
+        const char* str = NULL;
+        if (constant(arg, &a))
+            str = a.as_str;
+        else if (arg->base->kind == AST_VARIABLE && ((ast_variable_t*) arg)->symbol->constant)
+            str = ((ast_variable_t*) arg)->symbol->value.as_str;
+        if (str == NULL || !is_str_type(arg->base->type))
+            return (ast_t*) ast;
+        r.as_int64 = utf8len((const utf8_int8_t*) str);
+        return (ast_t*) ast_new_constant(ast->base->type, r);
+    }
+
+    // Arguments of a wrong type are reported when the call is emitted
+    for (size_t i = 0; i < vec_size(ast->args); i++)
+    {
+        if (!is_builtin_type_acceptable(((ast_t*) vec_get(ast->args, i))->base->type, builtin->acceptable_types))
+            return (ast_t*) ast;
+    }
+
+    if (!constant(arg, &a))
+        return (ast_t*) ast;
+
+    if (vec_size(ast->args) == 2 && !constant(vec_get(ast->args, 1), &b))
+        return (ast_t*) ast;
+
+    switch (builtin->opcode)
+    {
+        case I8CAST: r.as_int64 = a.as_int8; break;
+        case I16CAST: r.as_int64 = a.as_int16; break;
+        case I32CAST: r.as_int64 = a.as_int32; break;
+        case I64CAST: r.as_int64 = a.as_int64; break;
+        case IU8CAST: r.as_int64 = a.as_uint8; break;
+        case IU16CAST: r.as_int64 = a.as_uint16; break;
+        case IU32CAST: r.as_int64 = a.as_uint32; break;
+        case IU64CAST: r.as_int64 = a.as_uint64; break;
+        case ITOR: r.as_real = (real_t) a.as_int64; break;
+        case RTOI:
+            // Out of range conversions are undefined, leave them to the VM
+            if (!(a.as_real > -9223372036854775808.0 && a.as_real < 9223372036854775808.0))
+                return (ast_t*) ast;
+            r.as_int64 = (int64_t) a.as_real;
+            break;
+        case RSQRT: r.as_real = sqrt(a.as_real); break;
+        case REXP: r.as_real = exp(a.as_real); break;
+        case RSIN: r.as_real = sin(a.as_real); break;
+        case RCOS: r.as_real = cos(a.as_real); break;
+        case RTAN: r.as_real = tan(a.as_real); break;
+        case RACOS: r.as_real = acos(a.as_real); break;
+        case RLOG: r.as_real = log(a.as_real); break;
+        case RLOG10: r.as_real = log10(a.as_real); break;
+        case RLOG2: r.as_real = log2(a.as_real); break;
+        case RCEIL: r.as_real = ceil(a.as_real); break;
+        case RFLOOR: r.as_real = floor(a.as_real); break;
+        case RROUND: r.as_real = round(a.as_real); break;
+        case RMOD: r.as_real = fmod(a.as_real, b.as_real); break;
+        case RPOW: r.as_real = pow(a.as_real, b.as_real); break;
+        case RATAN2: r.as_real = atan2(a.as_real, b.as_real); break;
+        default: return (ast_t*) ast;
+    }
+
+    return (ast_t*) ast_new_constant(ast->base->type, r);
+}
+
+ast_t* fold(ast_t* ast)
+{
+    switch (ast->base->kind)
+    {
+        case AST_BINARY:
+            return fold_binary((ast_binary_t*) ast);
+        case AST_UNARY:
+            return fold_unary((ast_unary_t*) ast);
+        case AST_BUILTIN_CALL:
+            return fold_builtin_call((ast_builtin_call_t*) ast);
+        default:
+            return ast;
+    }
+}
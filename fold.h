@@ -0,0 +1,17 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "ast.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+ast_t* fold(ast_t* ast);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FOLD_H */
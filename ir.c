@@ -0,0 +1,1685 @@
+#include "ir.h"
+#include "types.h"
+#include "vm.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Middle-end over the emitted code. The main body and every function are
+// split into basic blocks and lifted into SSA form: each value the code
+// computes gets an id, the scalar slots and the operand stack are the
+// variables, and phis merge them where control flow joins. Loads yield
+// the value last stored instead of a new one, so copies vanish and
+// values are numbered globally (GVN). The code is then lowered back:
+// loads are rewritten to a constant or to the slot the value was first
+// stored in, recomputations of a value some slot already holds become
+// a load of that slot, and stores nobody reads (DSE) are dropped along
+// with the side effect free code computing them.
+//
+// Array elements are values too. Every array has a memory variable whose
+// value changes with each store to an element and with anything writing
+// arrays as a whole, a load takes it as an operand. Loads of one element
+// between two writes are thus congruent. When a value is recomputed where
+// an earlier computation of it dominates, the earlier one also stores it
+// in a hidden slot added to the frame and the recomputation becomes a
+// load of that slot (CSE).
+//
+// Slots used as arrays or anything else than plain XLOAD/XSTORE and the
+// FORI/FORNEXT counters are left alone. Frames are private to a call, so
+// a CALL never touches the slots of its caller.
+
+#define IR_NONE ((uint32_t) -1)
+#define IR_ROUNDS 8
+#define IR_SPILL_SIZE 4     // DUP, XSTORE slot
+
+enum
+{
+    IR_VALID = 1,
+    IR_PURE = 2,        // the result depends only on operands and arguments
+    IR_TRAP = 4,        // may stop the program
+    IR_EFFECT = 8,      // writes memory, prints or transfers control
+    IR_LOAD = 16,       // reads an array element
+};
+
+typedef struct
+{
+    uint8_t pops;
+    uint8_t pushes;
+    uint8_t flags;
+    type_t type;
+} ir_op_t;
+
+#define OP(POPS, PUSHES, FLAGS, TYPE) { POPS, PUSHES, (FLAGS) | IR_VALID, TYPE }
+#define INT_UNARY OP(1, 1, IR_PURE, MT_INT64)
+#define INT_BINARY OP(2, 1, IR_PURE, MT_INT64)
+#define INT_CONST OP(0, 1, IR_PURE, MT_INT64)
+#define REAL_UNARY OP(1, 1, IR_PURE, MT_REAL)
+#define REAL_BINARY OP(2, 1, IR_PURE, MT_REAL)
+#define REAL_CONST OP(0, 1, IR_PURE, MT_REAL)
+#define COMPARE OP(2, 1, IR_PURE, MT_BOOL)
+#define ARRAY_LOAD OP(1, 1, 0, MT_UNKNOWN)
+#define ELEMENT_LOAD OP(1, 1, IR_LOAD, MT_UNKNOWN)
+#define ARRAY_STORE OP(2, 0, IR_EFFECT, MT_UNKNOWN)
+
+// Stack effect of every opcode. DUP, SWAP, PROC, CALL, ASTORE, ACHECK,
+// XLOAD and XSTORE get a closer look while lifting.
+static const ir_op_t IR_OPS[256] = {
+    [NOP] = OP(0, 0, 0, MT_UNKNOWN),
+    [DUP] = OP(1, 2, 0, MT_UNKNOWN),
+    [DROP] = OP(1, 0, 0, MT_UNKNOWN),
+    [ALLC] = OP(0, 1, 0, MT_UNKNOWN),
+    [SWAP] = OP(2, 2, 0, MT_UNKNOWN),
+    [PROC] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [CALL] = OP(0, 1, IR_EFFECT, MT_UNKNOWN),
+    [RET] = OP(1, 0, IR_EFFECT, MT_UNKNOWN),
+    [JNZ] = OP(1, 0, IR_EFFECT, MT_UNKNOWN),
+    [JEZ] = OP(1, 0, IR_EFFECT, MT_UNKNOWN),
+    [JMP] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [HALT] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [IINC] = INT_UNARY,
+    [IDEC] = INT_UNARY,
+    [INEG] = INT_UNARY,
+    [IABS] = INT_UNARY,
+    [INOT] = OP(1, 1, IR_PURE, MT_BOOL),
+    [IADD] = INT_BINARY,
+    [ISUB] = INT_BINARY,
+    [IDIV] = OP(2, 1, IR_PURE | IR_TRAP, MT_INT64),
+    [IMOD] = OP(2, 1, IR_PURE | IR_TRAP, MT_INT64),
+    [IMUL] = INT_BINARY,
+    [IAND] = COMPARE,
+    [IOR] = COMPARE,
+    [IBXOR] = INT_BINARY,
+    [IBOR] = INT_BINARY,
+    [IBAND] = INT_BINARY,
+    [ISHL] = INT_BINARY,
+    [ISHR] = INT_BINARY,
+    [IGT] = COMPARE,
+    [ILT] = COMPARE,
+    [IGE] = COMPARE,
+    [ILE] = COMPARE,
+    [IEQ] = COMPARE,
+    [INQ] = COMPARE,
+    [I8CONST] = INT_CONST,
+    [I16CONST] = INT_CONST,
+    [I32CONST] = INT_CONST,
+    [I64CONST] = INT_CONST,
+    [ICONST_0] = INT_CONST,
+    [ICONST_1] = INT_CONST,
+    [IPRINT] = OP(1, 0, IR_EFFECT, MT_UNKNOWN),
+    [I8CAST] = INT_UNARY,
+    [I16CAST] = INT_UNARY,
+    [I32CAST] = INT_UNARY,
+    [I64CAST] = INT_UNARY,
+    [IU8CAST] = INT_UNARY,
+    [IU16CAST] = INT_UNARY,
+    [IU32CAST] = INT_UNARY,
+    [IU64CAST] = INT_UNARY,
+    [ITOR] = REAL_UNARY,
+    [RINC] = REAL_UNARY,
+    [RDEC] = REAL_UNARY,
+    [RNEG] = REAL_UNARY,
+    [RABS] = REAL_UNARY,
+    [RADD] = REAL_BINARY,
+    [RSUB] = REAL_BINARY,
+    [RDIV] = REAL_BINARY,
+    [RMOD] = REAL_BINARY,
+    [RMUL] = REAL_BINARY,
+    [RPOW] = REAL_BINARY,
+    [RSQRT] = REAL_UNARY,
+    [REXP] = REAL_UNARY,
+    [RSIN] = REAL_UNARY,
+    [RCOS] = REAL_UNARY,
+    [RTAN] = REAL_UNARY,
+    [RASIN] = REAL_UNARY,
+    [RACOS] = REAL_UNARY,
+    [RATAN2] = REAL_BINARY,
+    [RLOG] = REAL_UNARY,
+    [RLOG10] = REAL_UNARY,
+    [RLOG2] = REAL_UNARY,
+    [RCEIL] = REAL_UNARY,
+    [RFLOOR] = REAL_UNARY,
+    [RROUND] = REAL_UNARY,
+    [RGT] = COMPARE,
+    [RLT] = COMPARE,
+    [RGE] = COMPARE,
+    [RLE] = COMPARE,
+    [REQ] = COMPARE,
+    [RNQ] = COMPARE,
+    [RCONST] = REAL_CONST,
+    [RCONST_0] = REAL_CONST,
+    [RCONST_1] = REAL_CONST,
+    [RCONST_PI] = REAL_CONST,
+    [RPRINT] = OP(1, 0, IR_EFFECT, MT_UNKNOWN),
+    [RTOI] = INT_UNARY,
+    [XLOAD] = OP(0, 1, 0, MT_UNKNOWN),
+    [XSTORE] = OP(1, 0, 0, MT_UNKNOWN),
+    [XLOADI] = ELEMENT_LOAD,
+    [XSTOREI] = ARRAY_STORE,
+    [XCONST] = OP(0, 1, IR_PURE, MT_STR),
+    [SPRINT] = OP(1, 0, IR_EFFECT, MT_UNKNOWN),
+    [SLEN] = INT_UNARY,
+    [ASTORE] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [ALEN] = OP(1, 1, 0, MT_INT64),
+    [NPRINT] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [XLOADI8] = ELEMENT_LOAD,
+    [XLOADIU8] = ELEMENT_LOAD,
+    [XLOADI16] = ELEMENT_LOAD,
+    [XLOADIU16] = ELEMENT_LOAD,
+    [XLOADI32] = ELEMENT_LOAD,
+    [XLOADIU32] = ELEMENT_LOAD,
+    [XSTOREI8] = ARRAY_STORE,
+    [XSTOREI16] = ARRAY_STORE,
+    [XSTOREI32] = ARRAY_STORE,
+    [AREF] = OP(0, 1, IR_PURE, MT_ARRAY),
+    [ASUM] = ARRAY_LOAD,
+    [AMIN] = ARRAY_LOAD,
+    [AMAX] = ARRAY_LOAD,
+    [ADOT] = OP(2, 1, 0, MT_UNKNOWN),
+    [ACOUNT] = OP(2, 1, 0, MT_INT64),
+    [AARGMIN] = OP(1, 1, 0, MT_INT64),
+    [AARGMAX] = OP(1, 1, 0, MT_INT64),
+    [ASORT] = OP(1, 1, IR_EFFECT, MT_ARRAY),
+    [ASORTD] = OP(1, 1, IR_EFFECT, MT_ARRAY),
+    [ACOPY] = OP(2, 1, IR_EFFECT, MT_ARRAY),
+    [AFILL] = OP(2, 1, IR_EFFECT, MT_ARRAY),
+    [ASLICE_COPY] = OP(5, 1, IR_EFFECT | IR_TRAP, MT_ARRAY),
+    [AEQ] = OP(2, 1, 0, MT_BOOL),
+    [ACHECK] = OP(1, 1, IR_TRAP, MT_UNKNOWN),
+    [FORI] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [FORNEXT] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [ISHRU] = INT_BINARY,
+    [IDIVM] = INT_UNARY,
+    [IMODM] = INT_UNARY,
+    [AADDI] = OP(1, 0, IR_EFFECT, MT_UNKNOWN),
+    [MNEW] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [MGET] = OP(2, 1, IR_TRAP, MT_UNKNOWN),
+    [MGETD] = OP(3, 1, 0, MT_UNKNOWN),
+    [MSET] = OP(3, 1, IR_EFFECT, MT_UNKNOWN),
+    [MHAS] = OP(2, 1, 0, MT_BOOL),
+    [MDEL] = OP(2, 1, IR_EFFECT, MT_BOOL),
+    [MLEN] = OP(1, 1, 0, MT_INT64),
+    [MNEXT] = OP(2, 1, 0, MT_INT64),
+    [MKEY] = OP(2, 1, IR_TRAP, MT_UNKNOWN),
+    [HNEW] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [HPUSH] = OP(2, 1, IR_EFFECT, MT_UNKNOWN),
+    [HPOP] = OP(1, 1, IR_EFFECT | IR_TRAP, MT_UNKNOWN),
+    [HTOP] = OP(1, 1, IR_TRAP, MT_UNKNOWN),
+    [HLEN] = OP(1, 1, 0, MT_INT64),
+    [DNEW] = OP(0, 0, IR_EFFECT, MT_UNKNOWN),
+    [DPUSH] = OP(2, 1, IR_EFFECT, MT_UNKNOWN),
+    [DPUSHF] = OP(2, 1, IR_EFFECT, MT_UNKNOWN),
+    [DPOP] = OP(1, 1, IR_EFFECT | IR_TRAP, MT_UNKNOWN),
+    [DPOPF] = OP(1, 1, IR_EFFECT | IR_TRAP, MT_UNKNOWN),
+    [DFRONT] = OP(1, 1, IR_TRAP, MT_UNKNOWN),
+    [DBACK] = OP(1, 1, IR_TRAP, MT_UNKNOWN),
+    [DLEN] = OP(1, 1, 0, MT_INT64),
+};
+
+enum
+{
+    VAL_UNKNOWN,    // entry values, loads from memory, call results
+    VAL_OP,
+    VAL_PHI,
+};
+
+typedef struct
+{
+    uint8_t kind;
+    uint8_t op;
+    uint8_t size;
+    uint8_t args[16];
+    type_t type;
+    uint32_t operands[2];
+    uint8_t n_operands;
+    uint32_t forward;       // value a trivial phi was replaced by
+    uint32_t vn;            // value number, the id of the first congruent value
+    uint32_t home;          // variable the value was first stored in
+    size_t block;           // phis only
+    size_t phi_args;        // first operand of a phi in the pool
+} ir_value_t;
+
+typedef struct
+{
+    uint8_t op;
+    uint8_t size;
+    uint8_t args[16];
+    size_t target;
+    bool_t dead;
+    uint32_t out;           // value pushed
+    uint16_t spill;         // hidden slot the value is stored in as well
+    size_t addr;
+} ir_insn_t;
+
+typedef struct
+{
+    size_t first;
+    size_t last;            // one past the last instruction
+    size_t succs[2];
+    uint8_t n_succs;
+    size_t* preds;
+    size_t n_preds;
+    int region;             // -1 when unreachable
+    int depth;              // operand stack depth on entry
+    uint32_t* entry;        // value of every variable on entry
+    uint32_t* exit;
+    uint8_t* live_in;
+    uint8_t* live_out;
+    size_t idom;            // immediate dominator
+    size_t rpo;             // position in the reverse postorder
+} ir_block_t;
+
+// A value on the operand stack while lowering, with the contiguous run
+// of instructions that computed it when there is one
+typedef struct
+{
+    uint32_t vn;
+    size_t first;
+    size_t last;
+    bool_t clean;           // no side effects, can be replaced by a load
+    bool_t safe;            // cannot trap either, can be removed
+} ir_entry_t;
+
+static ir_insn_t* insns;
+static size_t count;
+static ir_block_t* blocks;
+static size_t n_blocks;
+static size_t* block_of;
+
+static ir_value_t* values;
+static size_t n_values;
+static size_t cap_values;
+static uint32_t* pool;
+static size_t n_pool;
+static size_t cap_pool;
+
+// Variables of the region being optimized: promotable slots first, the
+// memory of every array next, then the operand stack positions live
+// across blocks
+static int32_t var_of_slot[UINT16_MAX + 1];
+static uint16_t* slot_of_var;
+static size_t n_slot_vars;
+static uint16_t* slot_of_mem;
+static size_t n_mem_vars;
+static size_t n_state_vars;
+static size_t n_vars;
+
+static uint16_t* touched;   // slots var_of_slot has to be reset for
+static size_t n_touched;
+
+static size_t* order;       // reverse postorder of the region
+static size_t n_order;
+
+static uint32_t* cls_const;
+static uint32_t* cls_home;
+static uint32_t* avail;     // instruction computing a value CSE can reuse
+static uint16_t frame_size; // slots of the region's frame
+static uint16_t n_spills;
+
+static uint16_t operand(ir_insn_t* insn)
+{
+    return insn->args[0] | (insn->args[1] << 8);
+}
+
+static void set_operand(ir_insn_t* insn, uint16_t x)
+{
+    insn->args[0] = x & 0xFF;
+    insn->args[1] = (x >> 8) & 0xFF;
+}
+
+static bool_t is_branch(uint8_t op)
+{
+    return op == JMP || op == JEZ || op == JNZ || op == CALL || op == FORI || op == FORNEXT;
+}
+
+static bool_t ends_block(uint8_t op)
+{
+    return (is_branch(op) && op != CALL) || op == RET || op == HALT;
+}
+
+static void decode_insn(uint8_t op, uint8_t* args, size_t ip)
+{
+    ir_insn_t* insn = &insns[count++];
+    insn->op = op;
+    insn->size = OPCODES[op].arg_size;
+    insn->dead = false;
+    insn->out = IR_NONE;
+    insn->spill = 0;
+    insn->addr = ip;
+    memcpy(insn->args, args, insn->size);
+}
+
+static bool_t decode()
+{
+    uint8_t* code = vm_code_ptr();
+    size_t size = vm_code_addr();
+
+    // An in place update takes up to four instructions
+    insns = malloc(sizeof (ir_insn_t) * (2 * size + 1));
+    count = 0;
+
+    size_t* index = malloc(sizeof (size_t) * (size + 1));
+    for (size_t ip = 0; ip <= size; ip++)
+        index[ip] = IR_NONE;
+
+    for (size_t ip = 0; ip < size; ip += 1 + OPCODES[code[ip]].arg_size)
+    {
+        uint8_t op = code[ip];
+        uint8_t* args = code + ip + 1;
+
+        index[ip] = count;
+
+        // Slot updates are split into load, add and store so the slot
+        // stays a variable, the peephole pass joins them again
+        if (op == XINC || op == XDEC || op == XADDI)
+        {
+            decode_insn(XLOAD, args, ip);
+            decode_insn(op == XADDI ? I32CONST : ICONST_1, args + 2, ip);
+            decode_insn(op == XDEC ? ISUB : IADD, args, ip);
+            decode_insn(XSTORE, args, ip);
+        }
+        else
+            decode_insn(op, args, ip);
+    }
+
+    insns[count].op = HALT;
+    insns[count].size = 0;
+    insns[count].dead = false;
+    insns[count].spill = 0;
+    index[size] = count;
+
+    bool_t ok = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!(IR_OPS[insns[i].op].flags & IR_VALID))
+            ok = false;
+        else if (is_branch(insns[i].op))
+        {
+            insns[i].target = index[operand(&insns[i])];
+            if (insns[i].target == IR_NONE || (insns[i].op == CALL && insns[insns[i].target].op != PROC))
+                ok = false;
+        }
+    }
+
+    free(index);
+    return ok;
+}
+
+static size_t call_args(ir_insn_t* insn)
+{
+    return operand(&insns[insn->target]);
+}
+
+static size_t insn_pops(ir_insn_t* insn)
+{
+    if (insn->op == CALL)
+        return call_args(insn);
+    if (insn->op == ASTORE)
+        return insn->args[2] | (insn->args[3] << 8) | (insn->args[4] << 16) | ((size_t) insn->args[5] << 24);
+    return IR_OPS[insn->op].pops;
+}
+
+static void build_blocks()
+{
+    bool_t* leader = calloc(count + 1, sizeof (bool_t));
+    leader[0] = true;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (is_branch(insns[i].op))
+            leader[insns[i].target] = true;
+        if (ends_block(insns[i].op))
+            leader[i + 1] = true;
+    }
+
+    block_of = malloc(sizeof (size_t) * (count + 1));
+    blocks = malloc(sizeof (ir_block_t) * (count + 1));
+    n_blocks = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (leader[i])
+        {
+            if (n_blocks > 0)
+                blocks[n_blocks - 1].last = i;
+            memset(&blocks[n_blocks], 0, sizeof (ir_block_t));
+            blocks[n_blocks].first = i;
+            blocks[n_blocks].region = -1;
+            blocks[n_blocks].depth = -1;
+            n_blocks++;
+        }
+        block_of[i] = n_blocks - 1;
+    }
+    if (n_blocks > 0)
+        blocks[n_blocks - 1].last = count;
+    block_of[count] = IR_NONE;
+
+    // Branches to the end of the code stop the program like HALT does
+    for (size_t b = 0; b < n_blocks; b++)
+    {
+        ir_block_t* block = &blocks[b];
+        ir_insn_t* tail = &insns[block->last - 1];
+
+        if (is_branch(tail->op) && tail->op != CALL && block_of[tail->target] != IR_NONE)
+            block->succs[block->n_succs++] = block_of[tail->target];
+        if (tail->op != JMP && tail->op != RET && tail->op != HALT && block->last < count)
+            block->succs[block->n_succs++] = b + 1;
+    }
+
+    free(leader);
+}
+
+// Marks the blocks reachable from an entry, false if they overlap another
+// region
+static bool_t mark_region(size_t entry, int region)
+{
+    size_t* work = malloc(sizeof (size_t) * (n_blocks + 1));
+    size_t n = 0;
+    bool_t ok = true;
+
+    if (blocks[entry].region != -1)
+        ok = blocks[entry].region == region;
+    else
+    {
+        blocks[entry].region = region;
+        work[n++] = entry;
+    }
+
+    while (n > 0 && ok)
+    {
+        ir_block_t* block = &blocks[work[--n]];
+        for (int s = 0; s < block->n_succs; s++)
+        {
+            ir_block_t* succ = &blocks[block->succs[s]];
+            if (succ->region == -1)
+            {
+                succ->region = region;
+                work[n++] = block->succs[s];
+            }
+            else if (succ->region != region)
+                ok = false;
+        }
+    }
+
+    free(work);
+    return ok;
+}
+
+static void link_preds()
+{
+    for (size_t b = 0; b < n_blocks; b++)
+    {
+        if (blocks[b].region == -1)
+            continue;
+        for (int s = 0; s < blocks[b].n_succs; s++)
+            blocks[blocks[b].succs[s]].n_preds++;
+    }
+
+    for (size_t b = 0; b < n_blocks; b++)
+    {
+        blocks[b].preds = malloc(sizeof (size_t) * (blocks[b].n_preds + 1));
+        blocks[b].n_preds = 0;
+    }
+
+    for (size_t b = 0; b < n_blocks; b++)
+    {
+        if (blocks[b].region == -1)
+            continue;
+        for (int s = 0; s < blocks[b].n_succs; s++)
+        {
+            ir_block_t* succ = &blocks[blocks[b].succs[s]];
+            succ->preds[succ->n_preds++] = b;
+        }
+    }
+}
+
+static void reverse_postorder(size_t entry)
+{
+    // Iterative DFS, the successor index of every block on the path
+    size_t* path = malloc(sizeof (size_t) * (n_blocks + 1));
+    int* next = malloc(sizeof (int) * (n_blocks + 1));
+    bool_t* seen = calloc(n_blocks, sizeof (bool_t));
+    size_t n = 0;
+
+    n_order = 0;
+    path[n] = entry;
+    next[n++] = 0;
+    seen[entry] = true;
+
+    while (n > 0)
+    {
+        ir_block_t* block = &blocks[path[n - 1]];
+        if (next[n - 1] < block->n_succs)
+        {
+            size_t succ = block->succs[next[n - 1]++];
+            if (!seen[succ])
+            {
+                seen[succ] = true;
+                path[n] = succ;
+                next[n++] = 0;
+            }
+        }
+        else
+            order[n_order++] = path[--n];
+    }
+
+    for (size_t i = 0; i < n_order / 2; i++)
+    {
+        size_t t = order[i];
+        order[i] = order[n_order - 1 - i];
+        order[n_order - 1 - i] = t;
+    }
+
+    free(path);
+    free(next);
+    free(seen);
+}
+
+// Operand stack depths on entry to every block of the region, false if
+// they disagree or the code pops more than it pushed
+static bool_t compute_depths(int* max_depth)
+{
+    *max_depth = 0;
+    blocks[order[0]].depth = 0;
+
+    for (size_t o = 0; o < n_order; o++)
+    {
+        ir_block_t* block = &blocks[order[o]];
+        int depth = block->depth;
+
+        if (depth < 0)
+            return false;
+
+        for (size_t i = block->first; i < block->last; i++)
+        {
+            ir_insn_t* insn = &insns[i];
+            if (insn->op == PROC)
+            {
+                depth = 0;
+                continue;
+            }
+            size_t n = insn_pops(insn);
+            if ((size_t) depth < n)
+                return false;
+            depth += IR_OPS[insn->op].pushes - (int) n;
+        }
+
+        if (depth > *max_depth)
+            *max_depth = depth;
+        if (block->depth > *max_depth)
+            *max_depth = block->depth;
+
+        for (int s = 0; s < block->n_succs; s++)
+        {
+            ir_block_t* succ = &blocks[block->succs[s]];
+            if (succ->depth == -1)
+                succ->depth = depth;
+            else if (succ->depth != depth)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static bool_t is_promotable_ref(ir_insn_t* insn)
+{
+    return insn->op == XLOAD || insn->op == XSTORE;
+}
+
+static bool_t is_element_store(uint8_t op)
+{
+    return op == XSTOREI || op == XSTOREI8 || op == XSTOREI16 || op == XSTOREI32 || op == AADDI;
+}
+
+// Writes arrays it does not name, or through a reference
+static bool_t clobbers_arrays(uint8_t op)
+{
+    switch (op)
+    {
+        case ASTORE: case ASORT: case ASORTD: case ACOPY:
+        case AFILL: case ASLICE_COPY: case CALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Memory variable of the array in a slot
+static size_t mem_var(uint16_t slot)
+{
+    for (size_t m = 0; m < n_mem_vars; m++)
+    {
+        if (slot_of_mem[m] == slot)
+            return n_slot_vars + m;
+    }
+    return IR_NONE;
+}
+
+static uint16_t counter_slot(ir_insn_t* insn)
+{
+    return insn->args[2] | (insn->args[3] << 8);
+}
+
+static uint16_t limit_slot(ir_insn_t* insn)
+{
+    return insn->args[4] | (insn->args[5] << 8);
+}
+
+static void pin(uint16_t slot, size_t n)
+{
+    for (size_t s = slot; s <= slot + n && s <= UINT16_MAX; s++)
+    {
+        if (var_of_slot[s] == -1)
+            touched[n_touched++] = s;
+        var_of_slot[s] = -2;
+    }
+}
+
+// Slots only ever accessed by XLOAD and XSTORE become variables
+static void collect_vars()
+{
+    for (size_t o = 0; o < n_order; o++)
+    {
+        ir_block_t* block = &blocks[order[o]];
+        for (size_t i = block->first; i < block->last; i++)
+        {
+            ir_insn_t* insn = &insns[i];
+            switch (insn->op)
+            {
+                case XLOADI: case XLOADI8: case XLOADIU8: case XLOADI16:
+                case XLOADIU16: case XLOADI32: case XLOADIU32: case XSTOREI:
+                case XSTOREI8: case XSTOREI16: case XSTOREI32: case AADDI: case AREF: case ACHECK:
+                case MNEW: case HNEW: case DNEW:
+                    pin(operand(insn), 0);
+                    break;
+                case ASTORE:
+                {
+                    size_t len = insn_pops(insn);
+                    pin(operand(insn), array_slots(insn->args[6], len));
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+
+    n_slot_vars = 0;
+    n_mem_vars = 0;
+    for (size_t o = 0; o < n_order; o++)
+    {
+        ir_block_t* block = &blocks[order[o]];
+        for (size_t i = block->first; i < block->last; i++)
+        {
+            uint16_t slot = operand(&insns[i]);
+            if (is_promotable_ref(&insns[i]) && var_of_slot[slot] == -1)
+            {
+                touched[n_touched++] = slot;
+                var_of_slot[slot] = n_slot_vars;
+                slot_of_var[n_slot_vars++] = slot;
+            }
+        }
+    }
+
+    for (size_t o = 0; o < n_order; o++)
+    {
+        ir_block_t* block = &blocks[order[o]];
+        for (size_t i = block->first; i < block->last; i++)
+        {
+            ir_insn_t* insn = &insns[i];
+            if ((IR_OPS[insn->op].flags & IR_LOAD) || is_element_store(insn->op))
+            {
+                if (mem_var(operand(insn)) == IR_NONE)
+                    slot_of_mem[n_mem_vars++] = operand(insn);
+            }
+        }
+    }
+
+    n_state_vars = n_slot_vars + n_mem_vars;
+}
+
+static void clear_vars()
+{
+    for (size_t i = 0; i < n_touched; i++)
+        var_of_slot[touched[i]] = -1;
+    n_touched = 0;
+}
+
+static uint32_t new_value(uint8_t kind, uint8_t op, type_t type)
+{
+    if (n_values == cap_values)
+    {
+        cap_values = cap_values ? cap_values * 2 : 256;
+        values = realloc(values, sizeof (ir_value_t) * cap_values);
+    }
+
+    ir_value_t* value = &values[n_values];
+    memset(value, 0, sizeof (ir_value_t));
+    value->kind = kind;
+    value->op = op;
+    value->type = type;
+    value->forward = IR_NONE;
+    value->home = IR_NONE;
+    value->vn = n_values;
+    return n_values++;
+}
+
+static uint32_t new_phi(size_t block, uint32_t var)
+{
+    uint32_t phi = new_value(VAL_PHI, 0, MT_UNKNOWN);
+    size_t n = blocks[block].n_preds;
+
+    if (n_pool + n > cap_pool)
+    {
+        cap_pool = (n_pool + n) * 2;
+        pool = realloc(pool, sizeof (uint32_t) * cap_pool);
+    }
+
+    values[phi].block = block;
+    values[phi].phi_args = n_pool;
+    if (var < n_slot_vars)
+        values[phi].home = var;
+    n_pool += n;
+    return phi;
+}
+
+static uint32_t resolve(uint32_t v)
+{
+    while (values[v].forward != IR_NONE)
+        v = values[v].forward;
+    return v;
+}
+
+// Lifts one block, its entry state already set
+static void lift_block(ir_block_t* block, uint32_t* stack)
+{
+    uint32_t* state = block->exit;
+    int sp = block->depth;
+
+    memcpy(state, block->entry, sizeof (uint32_t) * n_vars);
+    for (int k = 0; k < sp; k++)
+        stack[k] = block->entry[n_state_vars + k];
+
+    for (size_t i = block->first; i < block->last; i++)
+    {
+        ir_insn_t* insn = &insns[i];
+        const ir_op_t* info = &IR_OPS[insn->op];
+
+        switch (insn->op)
+        {
+            case PROC:
+                sp = 0;
+                break;
+            case DUP:
+                stack[sp] = stack[sp - 1];
+                sp++;
+                break;
+            case SWAP:
+            {
+                uint32_t t = stack[sp - 1];
+                stack[sp - 1] = stack[sp - 2];
+                stack[sp - 2] = t;
+                break;
+            }
+            case ACHECK:
+                insn->out = stack[sp - 1];
+                break;
+            case XLOADI: case XLOADI8: case XLOADIU8: case XLOADI16:
+            case XLOADIU16: case XLOADI32: case XLOADIU32:
+            {
+                uint32_t v = new_value(VAL_OP, insn->op, MT_UNKNOWN);
+                values[v].size = insn->size;
+                memcpy(values[v].args, insn->args, insn->size);
+                values[v].n_operands = 2;
+                values[v].operands[0] = stack[sp - 1];
+                values[v].operands[1] = state[mem_var(operand(insn))];
+                insn->out = v;
+                stack[sp - 1] = v;
+                break;
+            }
+            case XSTOREI: case XSTOREI8: case XSTOREI16: case XSTOREI32: case AADDI:
+                sp -= insn_pops(insn);
+                state[mem_var(operand(insn))] = new_value(VAL_UNKNOWN, insn->op, MT_UNKNOWN);
+                break;
+            case FORNEXT:
+            {
+                int32_t var = var_of_slot[counter_slot(insn)];
+                if (var >= 0)
+                    state[var] = new_value(VAL_UNKNOWN, FORNEXT, MT_INT64);
+                break;
+            }
+            case XLOAD:
+            {
+                int32_t var = var_of_slot[operand(insn)];
+                insn->out = var >= 0 ? state[var] : new_value(VAL_UNKNOWN, XLOAD, MT_UNKNOWN);
+                stack[sp++] = insn->out;
+                break;
+            }
+            case XSTORE:
+            {
+                int32_t var = var_of_slot[operand(insn)];
+                uint32_t v = stack[--sp];
+                if (var >= 0)
+                {
+                    state[var] = v;
+                    if (values[v].home == IR_NONE)
+                        values[v].home = var;
+                }
+                break;
+            }
+            default:
+            {
+                size_t n = insn_pops(insn);
+                sp -= n;
+
+                if (info->pushes == 0)
+                    break;
+
+                if ((info->flags & IR_PURE) && n <= 2)
+                {
+                    uint32_t v = new_value(VAL_OP, insn->op, info->type);
+                    values[v].size = insn->size;
+                    memcpy(values[v].args, insn->args, insn->size);
+                    values[v].n_operands = n;
+                    for (size_t k = 0; k < n; k++)
+                        values[v].operands[k] = stack[sp + k];
+                    insn->out = v;
+                }
+                else
+                    insn->out = new_value(VAL_UNKNOWN, insn->op, info->type);
+
+                stack[sp++] = insn->out;
+                break;
+            }
+        }
+
+        if (clobbers_arrays(insn->op))
+        {
+            for (size_t m = n_slot_vars; m < n_state_vars; m++)
+                state[m] = new_value(VAL_UNKNOWN, insn->op, MT_UNKNOWN);
+        }
+    }
+
+    for (int k = 0; k < sp && (size_t) k < n_vars - n_state_vars; k++)
+        state[n_state_vars + k] = stack[k];
+}
+
+static void lift(size_t max_block)
+{
+    uint32_t* stack = malloc(sizeof (uint32_t) * (n_vars + max_block + 1));
+
+    for (size_t o = 0; o < n_order; o++)
+    {
+        size_t b = order[o];
+        ir_block_t* block = &blocks[b];
+        block->entry = malloc(sizeof (uint32_t) * (n_vars + 1));
+        block->exit = malloc(sizeof (uint32_t) * (n_vars + 1));
+
+        for (size_t v = 0; v < n_vars; v++)
+            block->entry[v] = IR_NONE;
+
+        if (o == 0)
+        {
+            for (size_t v = 0; v < n_state_vars; v++)
+            {
+                block->entry[v] = new_value(VAL_UNKNOWN, 0, MT_UNKNOWN);
+                if (v < n_slot_vars)
+                    values[block->entry[v]].home = v;
+            }
+        }
+        else if (block->n_preds == 1)
+            memcpy(block->entry, blocks[block->preds[0]].exit, sizeof (uint32_t) * n_vars);
+        else
+        {
+            for (size_t v = 0; v < n_state_vars + block->depth; v++)
+                block->entry[v] = new_phi(b, v);
+        }
+
+        lift_block(block, stack);
+    }
+
+    // Every block is lifted, the phis can take their operands
+    for (size_t o = 1; o < n_order; o++)
+    {
+        ir_block_t* block = &blocks[order[o]];
+        if (block->n_preds == 1)
+            continue;
+        for (size_t v = 0; v < n_state_vars + block->depth; v++)
+        {
+            ir_value_t* phi = &values[block->entry[v]];
+            for (size_t p = 0; p < block->n_preds; p++)
+                pool[phi->phi_args + p] = blocks[block->preds[p]].exit[v];
+        }
+    }
+
+    free(stack);
+}
+
+// Phis merging a single value (besides themselves) stand for that value
+static void remove_trivial_phis()
+{
+    bool_t changed = true;
+
+    while (changed)
+    {
+        changed = false;
+        for (size_t v = 0; v < n_values; v++)
+        {
+            ir_value_t* phi = &values[v];
+            if (phi->kind != VAL_PHI || phi->forward != IR_NONE)
+                continue;
+
+            uint32_t same = IR_NONE;
+            bool_t trivial = true;
+            for (size_t p = 0; p < blocks[phi->block].n_preds && trivial; p++)
+            {
+                uint32_t x = resolve(pool[phi->phi_args + p]);
+                if (x == v || x == same)
+                    continue;
+                if (same != IR_NONE)
+                    trivial = false;
+                same = x;
+            }
+
+            if (trivial && same != IR_NONE)
+            {
+                phi->forward = same;
+                if (values[same].home == IR_NONE)
+                    values[same].home = phi->home;
+                changed = true;
+            }
+        }
+    }
+}
+
+static uint32_t vn(uint32_t v)
+{
+    return values[resolve(v)].vn;
+}
+
+static bool_t is_commutative(uint8_t op)
+{
+    switch (op)
+    {
+        case IADD: case IMUL: case IAND: case IOR: case IBXOR:
+        case IBOR: case IBAND: case IEQ: case INQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void value_key(ir_value_t* value, uint32_t* a, uint32_t* b)
+{
+    *a = value->n_operands > 0 ? vn(value->operands[0]) : IR_NONE;
+    *b = value->n_operands > 1 ? vn(value->operands[1]) : IR_NONE;
+    if (is_commutative(value->op) && *a > *b)
+    {
+        uint32_t t = *a;
+        *a = *b;
+        *b = t;
+    }
+}
+
+static uint64_t value_hash(uint32_t v)
+{
+    ir_value_t* value = &values[v];
+    uint64_t h = value->kind * 31 + value->op;
+
+    if (value->kind == VAL_PHI)
+    {
+        h = h * 1000003 + value->block;
+        for (size_t p = 0; p < blocks[value->block].n_preds; p++)
+            h = h * 1000003 + vn(pool[value->phi_args + p]);
+    }
+    else
+    {
+        uint32_t a, b;
+        value_key(value, &a, &b);
+        for (int k = 0; k < value->size; k++)
+            h = h * 131 + value->args[k];
+        h = h * 1000003 + a;
+        h = h * 1000003 + b;
+    }
+
+    return h ^ (h >> 29);
+}
+
+static bool_t value_equal(uint32_t x, uint32_t y)
+{
+    ir_value_t* a = &values[x];
+    ir_value_t* b = &values[y];
+
+    if (a->kind != b->kind || a->op != b->op || a->type != b->type)
+        return false;
+
+    if (a->kind == VAL_PHI)
+    {
+        if (a->block != b->block)
+            return false;
+        for (size_t p = 0; p < blocks[a->block].n_preds; p++)
+        {
+            if (vn(pool[a->phi_args + p]) != vn(pool[b->phi_args + p]))
+                return false;
+        }
+        return true;
+    }
+
+    uint32_t a0, a1, b0, b1;
+    value_key(a, &a0, &a1);
+    value_key(b, &b0, &b1);
+    return a->size == b->size && memcmp(a->args, b->args, a->size) == 0 && a0 == b0 && a1 == b1;
+}
+
+// Pessimistic value numbering: values start out distinct and merge when
+// they apply the same operation to congruent operands, until nothing
+// changes. Phis of one block merging congruent values are congruent.
+static void number_values()
+{
+    size_t size = 16;
+    while (size < n_values * 2)
+        size *= 2;
+    uint32_t* table = malloc(sizeof (uint32_t) * size);
+
+    for (int round = 0; round < IR_ROUNDS; round++)
+    {
+        bool_t changed = false;
+
+        for (size_t i = 0; i < size; i++)
+            table[i] = IR_NONE;
+
+        for (size_t v = 0; v < n_values; v++)
+        {
+            ir_value_t* value = &values[v];
+            if (value->forward != IR_NONE || value->kind == VAL_UNKNOWN)
+                continue;
+
+            size_t h = value_hash(v) & (size - 1);
+            while (table[h] != IR_NONE && !value_equal(table[h], v))
+                h = (h + 1) & (size - 1);
+
+            uint32_t number = v;
+            if (table[h] == IR_NONE)
+                table[h] = v;
+            else
+                number = values[table[h]].vn;
+
+            if (value->vn != number)
+            {
+                value->vn = number;
+                changed = true;
+            }
+        }
+
+        if (!changed)
+            break;
+    }
+
+    free(table);
+
+    // The constant of every class and the variable it was stored in first
+    cls_const = malloc(sizeof (uint32_t) * (n_values + 1));
+    cls_home = malloc(sizeof (uint32_t) * (n_values + 1));
+    for (size_t v = 0; v < n_values; v++)
+    {
+        cls_const[v] = IR_NONE;
+        cls_home[v] = IR_NONE;
+    }
+
+    for (size_t v = 0; v < n_values; v++)
+    {
+        ir_value_t* value = &values[v];
+        uint32_t number = vn(v);
+
+        if (value->kind == VAL_OP && value->n_operands == 0 && value->op != AREF && cls_const[number] == IR_NONE)
+            cls_const[number] = v;
+        if (value->home != IR_NONE && cls_home[number] == IR_NONE)
+            cls_home[number] = value->home;
+    }
+}
+
+static size_t prev_live(size_t i, size_t first)
+{
+    while (i > first && insns[i - 1].dead)
+        i--;
+    return i > first ? i - 1 : IR_NONE;
+}
+
+static void kill_range(size_t first, size_t last)
+{
+    for (size_t i = first; i <= last; i++)
+        insns[i].dead = true;
+}
+
+static bool_t has_spill(size_t first, size_t last)
+{
+    for (size_t i = first; i <= last; i++)
+    {
+        if (!insns[i].dead && insns[i].spill != 0)
+            return true;
+    }
+    return false;
+}
+
+static void set_op(ir_insn_t* insn, uint8_t op)
+{
+    insn->op = op;
+    insn->size = OPCODES[op].arg_size;
+}
+
+// Immediate dominators of the region's blocks, see Cooper, Harvey and
+// Kennedy's "A Simple, Fast Dominance Algorithm"
+static void compute_dominators()
+{
+    for (size_t o = 0; o < n_order; o++)
+    {
+        blocks[order[o]].rpo = o;
+        blocks[order[o]].idom = IR_NONE;
+    }
+    blocks[order[0]].idom = order[0];
+
+    bool_t changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t o = 1; o < n_order; o++)
+        {
+            ir_block_t* block = &blocks[order[o]];
+            size_t idom = IR_NONE;
+
+            for (size_t p = 0; p < block->n_preds; p++)
+            {
+                size_t a = block->preds[p];
+                if (blocks[a].idom == IR_NONE)
+                    continue;
+                if (idom == IR_NONE)
+                {
+                    idom = a;
+                    continue;
+                }
+                size_t b = idom;
+                while (a != b)
+                {
+                    while (blocks[a].rpo > blocks[b].rpo)
+                        a = blocks[a].idom;
+                    while (blocks[b].rpo > blocks[a].rpo)
+                        b = blocks[b].idom;
+                }
+                idom = a;
+            }
+
+            if (block->idom != idom)
+            {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool_t dominates(size_t a, size_t b)
+{
+    while (blocks[b].rpo > blocks[a].rpo)
+        b = blocks[b].idom;
+    return a == b;
+}
+
+// Replaces the recomputation of a value ending at instruction i by a load
+// of the hidden slot a dominating computation of it stores it in. A first
+// reuse has to pay for the store, so short recomputations are kept.
+static bool_t reuse(uint32_t v, size_t b, size_t first, size_t i)
+{
+    size_t def = avail[v];
+
+    if (def == IR_NONE || insns[def].dead || !dominates(block_of[def], b) || has_spill(first, i - 1))
+        return false;
+
+    if (insns[def].spill == 0)
+    {
+        size_t size = 0;
+        bool_t load = false;
+        for (size_t k = first; k <= i; k++)
+        {
+            if (insns[k].dead)
+                continue;
+            size++;
+            load = load || (IR_OPS[insns[k].op].flags & IR_LOAD);
+        }
+
+        if (size < (load ? 3 : 4) || frame_size + n_spills >= UINT16_MAX)
+            return false;
+
+        insns[def].spill = frame_size + ++n_spills;
+    }
+
+    kill_range(first, i - 1);
+    set_op(&insns[i], XLOAD);
+    set_operand(&insns[i], insns[def].spill);
+    return true;
+}
+
+static uint32_t slot_holding(uint32_t* cur, uint32_t v)
+{
+    uint32_t home = cls_home[v];
+    if (home != IR_NONE && cur[home] == v)
+        return home;
+
+    for (size_t k = 0; k < n_slot_vars; k++)
+    {
+        if (cur[k] == v)
+            return k;
+    }
+    return IR_NONE;
+}
+
+// Lowers a block back to opcodes. With rewrite set loads and redundant
+// computations are replaced, dropped side effect free code goes either way.
+static void lower_block(size_t b, ir_entry_t* stack, uint32_t* cur, bool_t rewrite)
+{
+    ir_block_t* block = &blocks[b];
+    int sp = block->depth;
+
+    for (size_t k = 0; k < n_slot_vars; k++)
+        cur[k] = vn(block->entry[k]);
+    for (int k = 0; k < sp; k++)
+        stack[k] = (ir_entry_t) { vn(block->entry[n_state_vars + k]), IR_NONE, IR_NONE, false, false };
+
+    for (size_t i = block->first; i < block->last; i++)
+    {
+        ir_insn_t* insn = &insns[i];
+        const ir_op_t* info = &IR_OPS[insn->op];
+
+        if (insn->dead)
+            continue;
+
+        switch (insn->op)
+        {
+            case PROC:
+                sp = 0;
+                break;
+            case DUP:
+                stack[sp] = stack[sp - 1];
+                stack[sp].first = IR_NONE;
+                sp++;
+                break;
+            case SWAP:
+            {
+                ir_entry_t t = stack[sp - 1];
+                stack[sp - 1] = stack[sp - 2];
+                stack[sp - 2] = t;
+                stack[sp - 1].first = IR_NONE;
+                stack[sp - 2].first = IR_NONE;
+                break;
+            }
+            case ACHECK:
+            {
+                // The check stays with the index it guards, an element load
+                // congruent to an earlier one was checked already
+                ir_entry_t* e = &stack[sp - 1];
+                if (e->first != IR_NONE && e->last == prev_live(i, block->first))
+                {
+                    e->last = i;
+                    e->safe = false;
+                }
+                else
+                    e->first = IR_NONE;
+                break;
+            }
+            case XLOAD:
+            {
+                int32_t var = var_of_slot[operand(insn)];
+                uint32_t v = vn(insn->out);
+
+                if (rewrite && var >= 0)
+                {
+                    uint32_t c = cls_const[v];
+                    uint32_t k = slot_holding(cur, v);
+                    if (c != IR_NONE)
+                    {
+                        set_op(insn, values[c].op);
+                        memcpy(insn->args, values[c].args, values[c].size);
+                    }
+                    else if (k != IR_NONE && k != (uint32_t) var)
+                        set_operand(insn, slot_of_var[k]);
+                }
+
+                stack[sp++] = (ir_entry_t) { v, i, i, true, true };
+                break;
+            }
+            case XSTORE:
+            {
+                int32_t var = var_of_slot[operand(insn)];
+                sp--;
+                if (var >= 0)
+                    cur[var] = stack[sp].vn;
+                break;
+            }
+            case DROP:
+            {
+                ir_entry_t* e = &stack[--sp];
+                if (e->safe && e->first != IR_NONE && e->last == prev_live(i, block->first) &&
+                    !has_spill(e->first, e->last))
+                {
+                    kill_range(e->first, e->last);
+                    insn->dead = true;
+                }
+                break;
+            }
+            default:
+            {
+                int n = insn_pops(insn);
+                sp -= n;
+
+                if (info->pushes == 0)
+                    break;
+
+                ir_entry_t* operands = &stack[sp];
+                uint32_t v = vn(insn->out);
+                size_t first = i;
+                bool_t clean = !(info->flags & IR_EFFECT);
+                bool_t safe = !(info->flags & IR_TRAP);
+
+                // The operands have to be computed right before, in order
+                for (int k = n - 1; k >= 0 && clean; k--)
+                {
+                    ir_entry_t* e = &operands[k];
+                    clean = e->first != IR_NONE && e->clean && e->last == prev_live(first, block->first);
+                    safe = safe && e->safe;
+                    first = e->first;
+                }
+                safe = safe && clean;
+
+                if (rewrite && clean && (info->flags & (IR_PURE | IR_LOAD)) && first != i)
+                {
+                    uint32_t k = slot_holding(cur, v);
+                    if (k != IR_NONE && !has_spill(first, i - 1))
+                    {
+                        kill_range(first, i - 1);
+                        set_op(insn, XLOAD);
+                        set_operand(insn, slot_of_var[k]);
+                        first = i;
+                        safe = true;
+                    }
+                    else if (reuse(v, b, first, i))
+                    {
+                        first = i;
+                        safe = true;
+                    }
+                }
+
+                if (rewrite && insn->op != XLOAD && (info->flags & (IR_PURE | IR_LOAD)) &&
+                    (avail[v] == IR_NONE || insns[avail[v]].dead || !dominates(block_of[avail[v]], b)))
+                    avail[v] = i;
+
+                stack[sp++] = (ir_entry_t) { v, clean ? first : IR_NONE, i, clean, safe };
+                break;
+            }
+        }
+    }
+}
+
+// FORI and FORNEXT read the counter and the limit
+static void mark_loop_uses(ir_insn_t* insn, uint8_t* live)
+{
+    int32_t counter = var_of_slot[counter_slot(insn)];
+    int32_t limit = var_of_slot[limit_slot(insn)];
+
+    if (counter >= 0)
+        live[counter] = true;
+    if (limit >= 0)
+        live[limit] = true;
+}
+
+// Backward liveness of the variables, stores nobody reads turn into drops
+static void eliminate_dead_stores()
+{
+    for (size_t o = 0; o < n_order; o++)
+    {
+        ir_block_t* block = &blocks[order[o]];
+        block->live_in = calloc(n_slot_vars + 1, 1);
+        block->live_out = calloc(n_slot_vars + 1, 1);
+    }
+
+    uint8_t* live = malloc(n_slot_vars + 1);
+    bool_t changed = true;
+
+    while (changed)
+    {
+        changed = false;
+        for (size_t o = n_order; o-- > 0;)
+        {
+            ir_block_t* block = &blocks[order[o]];
+
+            memset(block->live_out, 0, n_slot_vars);
+            for (int s = 0; s < block->n_succs; s++)
+            {
+                uint8_t* in = blocks[block->succs[s]].live_in;
+                for (size_t k = 0; k < n_slot_vars; k++)
+                    block->live_out[k] |= in[k];
+            }
+
+            memcpy(live, block->live_out, n_slot_vars);
+            for (size_t i = block->last; i-- > block->first;)
+            {
+                ir_insn_t* insn = &insns[i];
+                if (!insn->dead && (insn->op == FORI || insn->op == FORNEXT))
+                    mark_loop_uses(insn, live);
+                if (insn->dead || !is_promotable_ref(insn) || var_of_slot[operand(insn)] < 0)
+                    continue;
+                int32_t var = var_of_slot[operand(insn)];
+                live[var] = insn->op == XLOAD;
+            }
+
+            if (memcmp(live, block->live_in, n_slot_vars) != 0)
+            {
+                memcpy(block->live_in, live, n_slot_vars);
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t o = 0; o < n_order; o++)
+    {
+        ir_block_t* block = &blocks[order[o]];
+
+        memcpy(live, block->live_out, n_slot_vars);
+        for (size_t i = block->last; i-- > block->first;)
+        {
+            ir_insn_t* insn = &insns[i];
+            if (!insn->dead && (insn->op == FORI || insn->op == FORNEXT))
+                mark_loop_uses(insn, live);
+            if (insn->dead || !is_promotable_ref(insn) || var_of_slot[operand(insn)] < 0)
+                continue;
+            int32_t var = var_of_slot[operand(insn)];
+            if (insn->op == XSTORE && !live[var])
+                set_op(insn, DROP);
+            else
+                live[var] = insn->op == XLOAD;
+        }
+    }
+
+    free(live);
+}
+
+static void optimize_region(size_t entry)
+{
+    reverse_postorder(entry);
+
+    int max_depth;
+    if (blocks[entry].n_preds > 0 || !compute_depths(&max_depth))
+        return;
+
+    collect_vars();
+    n_vars = n_state_vars + max_depth;
+    n_values = 0;
+    n_pool = 0;
+
+    size_t max_block = 0;
+    for (size_t o = 0; o < n_order; o++)
+    {
+        ir_block_t* block = &blocks[order[o]];
+        if (block->last - block->first > max_block)
+            max_block = block->last - block->first;
+    }
+
+    lift(max_block);
+    remove_trivial_phis();
+    number_values();
+    compute_dominators();
+
+    // Hidden slots go after the ones PROC reserves, no PROC no CSE
+    size_t proc = IR_NONE;
+    for (size_t i = blocks[entry].first; i < blocks[entry].last && proc == IR_NONE; i++)
+    {
+        if (insns[i].op == PROC)
+            proc = i;
+    }
+    frame_size = proc == IR_NONE ? UINT16_MAX : operand(&insns[proc]) + (insns[proc].args[2] | (insns[proc].args[3] << 8));
+    n_spills = 0;
+
+    avail = malloc(sizeof (uint32_t) * (n_values + 1));
+    for (size_t v = 0; v < n_values; v++)
+        avail[v] = IR_NONE;
+
+    ir_entry_t* stack = malloc(sizeof (ir_entry_t) * (n_vars + max_block + 1));
+    uint32_t* cur = malloc(sizeof (uint32_t) * (n_slot_vars + 1));
+
+    for (size_t o = 0; o < n_order; o++)
+        lower_block(order[o], stack, cur, true);
+
+    eliminate_dead_stores();
+
+    for (size_t o = 0; o < n_order; o++)
+        lower_block(order[o], stack, cur, false);
+
+    if (n_spills > 0)
+    {
+        uint16_t vars = (insns[proc].args[2] | (insns[proc].args[3] << 8)) + n_spills;
+        insns[proc].args[2] = vars & 0xFF;
+        insns[proc].args[3] = (vars >> 8) & 0xFF;
+    }
+
+    free(stack);
+    free(cur);
+    free(avail);
+    free(cls_const);
+    free(cls_home);
+    clear_vars();
+}
+
+static void layout()
+{
+    size_t addr = 0;
+
+    for (size_t i = 0; i <= count; i++)
+    {
+        insns[i].addr = addr;
+        if (!insns[i].dead && i < count)
+            addr += 1 + insns[i].size + (insns[i].spill != 0 ? IR_SPILL_SIZE : 0);
+    }
+
+    uint8_t* code = malloc(addr + 1);
+    size_t ip = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ir_insn_t* insn = &insns[i];
+
+        if (insn->dead)
+            continue;
+
+        if (is_branch(insn->op))
+        {
+            size_t t = insn->target;
+            while (t < count && insns[t].dead)
+                t++;
+            set_operand(insn, insns[t].addr);
+        }
+
+        code[ip] = insn->op;
+        memcpy(code + ip + 1, insn->args, insn->size);
+        ip += 1 + insn->size;
+
+        if (insn->spill != 0)
+        {
+            code[ip++] = DUP;
+            code[ip++] = XSTORE;
+            code[ip++] = insn->spill & 0xFF;
+            code[ip++] = (insn->spill >> 8) & 0xFF;
+        }
+    }
+
+    vm_code_replace(code, ip);
+    free(code);
+}
+
+void ir_optimize()
+{
+    for (size_t s = 0; s <= UINT16_MAX; s++)
+        var_of_slot[s] = -1;
+
+    if (vm_code_addr() == 0 || !decode())
+    {
+        free(insns);
+        return;
+    }
+
+    build_blocks();
+
+    // The main body starts the code, every call target starts a function
+    size_t* entries = malloc(sizeof (size_t) * (n_blocks + 1));
+    size_t n_regions = 1;
+    bool_t ok = mark_region(0, 0);
+    entries[0] = 0;
+
+    for (size_t i = 0; i < count && ok; i++)
+    {
+        size_t entry = insns[i].op == CALL ? block_of[insns[i].target] : IR_NONE;
+        if (entry != IR_NONE && blocks[entry].region == -1)
+        {
+            entries[n_regions] = entry;
+            ok = mark_region(entry, n_regions++);
+        }
+    }
+
+    if (ok)
+    {
+        link_preds();
+
+        order = malloc(sizeof (size_t) * (n_blocks + 1));
+        slot_of_var = malloc(sizeof (uint16_t) * (UINT16_MAX + 1));
+        slot_of_mem = malloc(sizeof (uint16_t) * (UINT16_MAX + 1));
+        touched = malloc(sizeof (uint16_t) * (UINT16_MAX + 1));
+
+        for (size_t r = 0; r < n_regions; r++)
+            optimize_region(entries[r]);
+
+        layout();
+
+        free(order);
+        free(slot_of_var);
+        free(slot_of_mem);
+        free(touched);
+    }
+
+    free(entries);
+
+    for (size_t b = 0; b < n_blocks; b++)
+    {
+        free(blocks[b].preds);
+        free(blocks[b].entry);
+        free(blocks[b].exit);
+        free(blocks[b].live_in);
+        free(blocks[b].live_out);
+    }
+
+    free(blocks);
+    free(block_of);
+    free(insns);
+    free(values);
+    free(pool);
+    values = NULL;
+    pool = NULL;
+    cap_values = 0;
+    cap_pool = 0;
+}
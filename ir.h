@@ -0,0 +1,15 @@
+#ifndef IR_H
+#define IR_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void ir_optimize();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IR_H */
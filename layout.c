@@ -0,0 +1,351 @@
+#include "layout.h"
+#include "types.h"
+#include "vm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Profile guided code layout. The code is cut into basic blocks and laid
+// out again in chains that follow the hot edges, so the common path falls
+// through:
+//
+//   - a JEZ or JNZ taken more often than not is followed by its target,
+//     and inverted to branch to the old fallthrough instead
+//   - a JMP is followed by its target and removed, unless that would
+//     pull the target away from the block falling into it, like the test
+//     at the bottom of a loop
+//   - a block whose fallthrough is placed elsewhere ends in a JMP to it
+//
+// The main body stays first, the functions follow it by their call
+// counts, the hottest first, each still from its PROC to the next PROC.
+// The profile holds counts by address of the code it was taken on, it is
+// used only when that code is exactly what the compiler made again.
+
+typedef struct
+{
+    uint8_t op;
+    uint8_t size;       // operand bytes
+    uint8_t args[16];
+    size_t addr;
+    size_t target;      // branch target as a block index
+} insn_t;
+
+typedef struct
+{
+    size_t first;       // insns[first..last] are the block
+    size_t last;
+    size_t region;
+    bool_t placed;
+    size_t addr;        // new address
+    uint8_t op;         // new last instruction, NOP when removed
+    bool_t jump;        // a JMP to the fallthrough is appended
+} bblock_t;
+
+static insn_t* insns;
+static size_t count;
+static bblock_t* blocks;
+static size_t n_blocks;
+static profile_t* profile;
+
+static bool_t is_branch(uint8_t op)
+{
+    return op == JMP || op == JEZ || op == JNZ || op == CALL || op == FORI || op == FORNEXT;
+}
+
+static bool_t falls_through(uint8_t op)
+{
+    return op != JMP && op != RET && op != HALT;
+}
+
+static bool_t ends_block(uint8_t op)
+{
+    return op == JMP || op == JEZ || op == JNZ || op == FORI || op == FORNEXT || op == RET || op == HALT;
+}
+
+static uint16_t operand(insn_t* insn)
+{
+    return insn->args[0] | (insn->args[1] << 8);
+}
+
+// Instructions and blocks of the code, false if a branch leads nowhere
+static bool_t decode(uint8_t* code, size_t size)
+{
+    size_t* block_of = malloc(sizeof (size_t) * (size + 1));
+    bool_t* leader = calloc(size + 1, sizeof (bool_t));
+    bool_t* called = calloc(size + 1, sizeof (bool_t));
+    bool_t ok = true;
+
+    insns = malloc(sizeof (insn_t) * (size + 1));
+    count = 0;
+    leader[0] = true;
+
+    for (size_t ip = 0; ip < size; count++)
+    {
+        insn_t* insn = &insns[count];
+        insn->op = code[ip];
+        insn->size = OPCODES[insn->op].arg_size;
+        insn->addr = ip;
+        memcpy(insn->args, code + ip + 1, insn->size);
+        ip += 1 + insn->size;
+
+        if (ends_block(insn->op) && ip <= size)
+            leader[ip] = true;
+
+        if (is_branch(insn->op))
+        {
+            uint16_t target = operand(insn);
+
+            // The end of the code is no block to move
+            if (target >= size)
+                ok = false;
+            else
+                leader[target] = true;
+
+            if (insn->op == CALL && target < size)
+                called[target] = true;
+        }
+    }
+
+    blocks = malloc(sizeof (bblock_t) * (count + 1));
+    n_blocks = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t addr = insns[i].addr;
+
+        if (leader[addr])
+        {
+            bblock_t* block = &blocks[n_blocks++];
+            memset(block, 0, sizeof (bblock_t));
+            block->first = i;
+            block->region = n_blocks == 1 ? 0 : blocks[n_blocks - 2].region;
+            if (insns[i].op == PROC && called[addr])
+                block->region = block->region + 1;
+        }
+
+        blocks[n_blocks - 1].last = i;
+        block_of[addr] = n_blocks - 1;
+    }
+
+    for (size_t i = 0; i < count && ok; i++)
+    {
+        // A branch into the middle of an instruction
+        if (is_branch(insns[i].op) && !leader[operand(&insns[i])])
+            ok = false;
+        else if (is_branch(insns[i].op))
+            insns[i].target = block_of[operand(&insns[i])];
+    }
+
+    free(block_of);
+    free(leader);
+    free(called);
+    return ok;
+}
+
+static insn_t* last_insn(size_t b)
+{
+    return &insns[blocks[b].last];
+}
+
+// Where the block goes when it does not branch, n_blocks if nowhere
+static size_t fallthrough(size_t b)
+{
+    return falls_through(last_insn(b)->op) ? b + 1 : n_blocks;
+}
+
+static bool_t can_place(size_t b, size_t region)
+{
+    return b < n_blocks && !blocks[b].placed && blocks[b].region == region;
+}
+
+// The block to place after b in its chain, n_blocks to end the chain
+static size_t successor(size_t b)
+{
+    insn_t* last = last_insn(b);
+    size_t region = blocks[b].region;
+
+    switch (last->op)
+    {
+        case JEZ:
+        case JNZ:
+            if (profile->taken[last->addr] > profile->not_taken[last->addr] && can_place(last->target, region))
+                return last->target;
+            break;
+        case JMP:
+            // The block before the target falls into it, keep them together
+            if (last->target > 0 && fallthrough(last->target - 1) == last->target)
+                return n_blocks;
+            return can_place(last->target, region) ? last->target : n_blocks;
+        default:
+            break;
+    }
+
+    size_t next = fallthrough(b);
+    return can_place(next, region) ? next : n_blocks;
+}
+
+static int compare_regions(const void* a, const void* b)
+{
+    const size_t* x = a;
+    const size_t* y = b;
+    uint64_t cx = profile->calls[insns[blocks[x[1]].first].addr];
+    uint64_t cy = profile->calls[insns[blocks[y[1]].first].addr];
+
+    if (cx != cy)
+        return cx > cy ? -1 : 1;
+    return x[0] < y[0] ? -1 : x[0] > y[0];
+}
+
+// Block order, chained region by region
+static size_t* order_blocks()
+{
+    size_t n_regions = blocks[n_blocks - 1].region + 1;
+    size_t (*regions)[2] = malloc(sizeof (size_t[2]) * n_regions);
+    size_t* order = malloc(sizeof (size_t) * n_blocks);
+    size_t n = 0;
+
+    // Region and its first block, functions sorted by their calls
+    for (size_t b = 0; b < n_blocks; b++)
+    {
+        if (b == 0 || blocks[b].region != blocks[b - 1].region)
+        {
+            regions[blocks[b].region][0] = blocks[b].region;
+            regions[blocks[b].region][1] = b;
+        }
+    }
+
+    qsort(regions + 1, n_regions - 1, sizeof (size_t[2]), compare_regions);
+
+    for (size_t r = 0; r < n_regions; r++)
+    {
+        size_t region = regions[r][0];
+
+        for (size_t seed = regions[r][1]; seed < n_blocks && blocks[seed].region == region; seed++)
+        {
+            for (size_t b = seed; can_place(b, region); b = successor(b))
+            {
+                blocks[b].placed = true;
+                order[n++] = b;
+            }
+        }
+    }
+
+    free(regions);
+    return order;
+}
+
+// Fixes the last instruction of every block for the block placed after
+// it, false if the code would not fit
+static bool_t link_blocks(size_t* order)
+{
+    size_t addr = 0;
+
+    for (size_t k = 0; k < n_blocks; k++)
+    {
+        bblock_t* block = &blocks[order[k]];
+        insn_t* last = last_insn(order[k]);
+        size_t next = k + 1 < n_blocks ? order[k + 1] : n_blocks;
+        size_t f = fallthrough(order[k]);
+
+        block->op = last->op;
+        block->jump = false;
+
+        if (last->op == JMP && last->target == next)
+            block->op = NOP;
+        else if ((last->op == JEZ || last->op == JNZ) && f != next && last->target == next)
+        {
+            block->op = last->op == JEZ ? JNZ : JEZ;
+            last->target = f;
+        }
+        else if (f != next)
+        {
+            // Running off the end of the code, nowhere to jump to
+            if (f == n_blocks && falls_through(last->op))
+                return false;
+            block->jump = f < n_blocks;
+        }
+
+        block->addr = addr;
+        for (size_t i = block->first; i < block->last; i++)
+            addr += 1 + insns[i].size;
+        if (block->op != NOP)
+            addr += 1 + last->size;
+        if (block->jump)
+            addr += 3;
+    }
+
+    return addr <= UINT16_MAX;
+}
+
+static size_t emit_insn(uint8_t* code, size_t ip, uint8_t op, insn_t* insn)
+{
+    code[ip] = op;
+    memcpy(code + ip + 1, insn->args, insn->size);
+
+    if (is_branch(op))
+    {
+        uint16_t target = blocks[insn->target].addr;
+        code[ip + 1] = target & 0xFF;
+        code[ip + 2] = (target >> 8) & 0xFF;
+    }
+
+    return ip + 1 + insn->size;
+}
+
+static void emit_blocks(size_t* order, size_t size)
+{
+    uint8_t* code = malloc(size + 3 * n_blocks);
+    size_t ip = 0;
+
+    for (size_t k = 0; k < n_blocks; k++)
+    {
+        bblock_t* block = &blocks[order[k]];
+
+        for (size_t i = block->first; i < block->last; i++)
+            ip = emit_insn(code, ip, insns[i].op, &insns[i]);
+
+        if (block->op != NOP)
+            ip = emit_insn(code, ip, block->op, last_insn(order[k]));
+
+        if (block->jump)
+        {
+            uint16_t target = blocks[fallthrough(order[k])].addr;
+            uint8_t jump[] = { JMP, NUM16(target) };
+            memcpy(code + ip, jump, sizeof (jump));
+            ip += sizeof (jump);
+        }
+    }
+
+    vm_code_replace(code, ip);
+    free(code);
+}
+
+void layout_optimize(profile_t* prof)
+{
+    uint8_t* code = vm_code_ptr();
+    size_t size = vm_code_addr();
+
+    if (size != prof->size || profile_checksum(code, size) != prof->checksum)
+    {
+        fprintf(stderr, "Warning: Profile does not match the code, ignored\n");
+        return;
+    }
+
+    profile = prof;
+    insns = NULL;
+    blocks = NULL;
+
+    if (size > 0 && decode(code, size))
+    {
+        size_t* order = order_blocks();
+
+        if (link_blocks(order))
+            emit_blocks(order, size);
+
+        free(order);
+    }
+
+    free(insns);
+    free(blocks);
+}
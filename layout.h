@@ -0,0 +1,17 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "profile.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void layout_optimize(profile_t* profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LAYOUT_H */
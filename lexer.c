@@ -14,6 +14,7 @@ static bool_t is_stdin;
 static char look;
 static size_t row;
 static size_t col;
+static bool_t pending_dotdot;
 
 typedef struct
 {
@@ -32,6 +33,7 @@ static const keyword_t KEYWORDS[] = {
     {"loop", TK_LOOP},
     {"for", TK_FOR},
     {"in", TK_IN},
+    {"step", TK_STEP},
     {"break", TK_BREAK},
     {"continue", TK_CONTINUE},
     {"return", TK_RETURN},
@@ -50,6 +52,7 @@ void lexer_load_file(const char* filename)
     row = 0;
     col = 0;
     look = 0;
+    pending_dotdot = false;
     is_stdin = false;
     file = fopen(filename, "r");
     // TODO: handle if can not open file
@@ -60,6 +63,7 @@ void lexer_load_stdin()
     row = 0;
     col = 0;
     look = 0;
+    pending_dotdot = false;
     is_stdin = true;
     file = stdin;
 }
@@ -135,6 +139,15 @@ token_type_t find_keyword(const char* name)
 
 token_t lexer_next()
 {
+    // An integer right before a range consumed the .. already
+    if (pending_dotdot)
+    {
+        pending_dotdot = false;
+        token_t token = {TK_DOTDOT, {0}, row, col};
+        col += 2;
+        return token;
+    }
+
     lexer_skip_white();
     lexer_skip_line_comment();
 
@@ -195,14 +208,39 @@ token_t lexer_next()
     {
         token.type = TK_SEMICOLON;
     }
+    else if (look == '+' && fpeek(file) == '+')
+    {
+        token.type = TK_INC;
+        look = fgetc(file);
+    }
+    else if (look == '+' && fpeek(file) == '=')
+    {
+        token.type = TK_PLUS_ASSIGN;
+        look = fgetc(file);
+    }
     else if (look == '+')
     {
         token.type = TK_PLUS;
     }
+    else if (look == '-' && fpeek(file) == '-')
+    {
+        token.type = TK_DEC;
+        look = fgetc(file);
+    }
+    else if (look == '-' && fpeek(file) == '=')
+    {
+        token.type = TK_MINUS_ASSIGN;
+        look = fgetc(file);
+    }
     else if (look == '-')
     {
         token.type = TK_MINUS;
     }
+    else if (look == '*' && fpeek(file) == '=')
+    {
+        token.type = TK_MUL_ASSIGN;
+        look = fgetc(file);
+    }
     else if (look == '*')
     {
         token.type = TK_MUL;
@@ -244,6 +282,11 @@ token_t lexer_next()
     {
         token.type = TK_ASSIGN;
     }
+    else if (look == '>' && fpeek(file) == '>')
+    {
+        token.type = TK_SHR;
+        look = fgetc(file);
+    }
     else if (look == '>' && fpeek(file) == '=')
     {
         token.type = TK_GTE;
@@ -253,6 +296,11 @@ token_t lexer_next()
     {
         token.type = TK_GT;
     }
+    else if (look == '<' && fpeek(file) == '<')
+    {
+        token.type = TK_SHL;
+        look = fgetc(file);
+    }
     else if (look == '<' && fpeek(file) == '=')
     {
         token.type = TK_LTE;
@@ -303,7 +351,19 @@ token_t lexer_next()
             if (isdigit(peek) || (peek == '.' && !is_real))
             {
                 if (peek == '.')
+                {
+                    look = fgetc(file);
+                    if (fpeek(file) == '.')
+                    {
+                        fgetc(file);
+                        pending_dotdot = true;
+                        break;
+                    }
                     is_real = true;
+                    col++;
+                    buffer_add(&number, look);
+                    continue;
+                }
 
                 if ((look = fgetc(file)) != EOF)
                 {
@@ -315,6 +375,7 @@ token_t lexer_next()
             break;
         }
 
+        if (!pending_dotdot)
         {
             char peek = fpeek(file);
             if (peek == 'u' || peek == 'U')
@@ -0,0 +1,279 @@
+#include "licm.h"
+#include "ast.h"
+#include "builtins.h"
+#include "context.h"
+#include "types.h"
+#include "vector.h"
+#include <stddef.h>
+#include <string.h>
+
+// Loop invariant code motion. An expression in a loop's condition, post or
+// body that only reads constants and variables the loop never assigns has
+// the same value on every iteration. It is computed once into a hidden slot
+// before the loop starts and the loop reads the slot instead. Moved code
+// runs even when the loop body never does, so expressions that can trap
+// (integer division by a variable) stay where they are.
+
+typedef struct
+{
+    vector_t* assigned;
+    vector_t* hoisted;
+    context_t* context;
+} licm_t;
+
+static bool_t collect_visit(ast_t* ast, void* arg)
+{
+    vector_t* assigned = arg;
+
+    if (ast->base->kind == AST_ASSIGN)
+        vec_append(assigned, ((ast_assign_t*) ast)->symbol);
+    else if (ast->base->kind == AST_FOR_IN)
+        vec_append(assigned, ((ast_for_in_t*) ast)->symbol);
+
+    return true;
+}
+
+static bool_t is_assigned(licm_t* licm, symbol_t* symbol)
+{
+    for (size_t i = 0; i < vec_size(licm->assigned); i++)
+    {
+        if (vec_get(licm->assigned, i) == symbol)
+            return true;
+    }
+    return false;
+}
+
+static bool_t is_scalar_type(type_t type)
+{
+    return is_integer_type(type) || is_real_type(type) || is_bool_type(type);
+}
+
+// Integer division and modulo fault on a zero divisor and on the most
+// negative value divided by -1
+static bool_t may_trap(ast_binary_t* ast)
+{
+    if (ast->op != TK_DIV && ast->op != TK_MOD)
+        return false;
+
+    if (is_real_type(ast->lhs_expr->base->type) || is_real_type(ast->rhs_expr->base->type))
+        return false;
+
+    if (ast->rhs_expr->base->kind != AST_CONSTANT)
+        return true;
+
+    int64_t divisor = ((ast_constant_t*) ast->rhs_expr)->value.as_int64;
+    return divisor == 0 || divisor == -1;
+}
+
+static bool_t invariant(licm_t* licm, ast_t* ast)
+{
+    switch (ast->base->kind)
+    {
+        case AST_CONSTANT:
+            return true;
+        case AST_VARIABLE:
+        {
+            ast_variable_t* var = (ast_variable_t*) ast;
+            return var->index_expr == NULL && !is_array_type(var->symbol->type) && !is_assigned(licm, var->symbol);
+        }
+        case AST_UNARY:
+            return is_scalar_type(ast->base->type) && invariant(licm, ((ast_unary_t*) ast)->expr);
+        case AST_BINARY:
+        {
+            ast_binary_t* binary = (ast_binary_t*) ast;
+            return is_scalar_type(ast->base->type) && !may_trap(binary) &&
+                invariant(licm, binary->lhs_expr) && invariant(licm, binary->rhs_expr);
+        }
+        case AST_BUILTIN_CALL:
+        {
+            // Builtins on scalars are pure, the ones on arrays and
+            // containers read memory the loop may write
+            ast_builtin_call_t* call = (ast_builtin_call_t*) ast;
+            const builtin_func_t* builtin = builtin_lookup(call->name);
+
+            if (builtin == NULL || builtin->ret_type == MT_VOID || !is_scalar_type(ast->base->type))
+                return false;
+
+            for (size_t i = 0; i < vec_size(call->args); i++)
+            {
+                ast_t* arg = vec_get(call->args, i);
+                if (is_array_type(arg->base->type) || is_container_type(arg->base->type) || !invariant(licm, arg))
+                    return false;
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Only expressions with an operation are worth a slot of their own
+static bool_t worth_hoisting(ast_t* ast)
+{
+    switch (ast->base->kind)
+    {
+        case AST_UNARY:
+            return ((ast_unary_t*) ast)->op != TK_PLUS;
+        case AST_BINARY:
+        case AST_BUILTIN_CALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void hoist(licm_t* licm, ast_t** slot);
+
+static void hoist_list(licm_t* licm, vector_t* nodes)
+{
+    for (size_t i = 0; i < vec_size(nodes); i++)
+    {
+        ast_t* node = vec_get(nodes, i);
+        hoist(licm, &node);
+        vec_set(nodes, i, node);
+    }
+}
+
+// Invariant assigns a nested loop hoisted are moved out of this loop too
+static void hoist_nested(licm_t* licm, vector_t* hoisted)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < vec_size(hoisted); i++)
+    {
+        ast_assign_t* assign = vec_get(hoisted, i);
+
+        if (invariant(licm, assign->expr))
+        {
+            vec_append(licm->hoisted, assign);
+            continue;
+        }
+
+        hoist(licm, &assign->expr);
+        vec_set(hoisted, kept++, assign);
+    }
+
+    vec_resize(hoisted, kept);
+}
+
+static void hoist(licm_t* licm, ast_t** slot)
+{
+    ast_t* ast = *slot;
+
+    if (ast == NULL)
+        return;
+
+    if (worth_hoisting(ast) && invariant(licm, ast))
+    {
+        symbol_t* temp = context_add_temp(licm->context, ast->base->type);
+        vec_append(licm->hoisted, ast_new_assign(ast->base->type, temp, ast, NULL, true));
+        *slot = (ast_t*) ast_new_variable(ast->base->type, temp, NULL);
+        return;
+    }
+
+    switch (ast->base->kind)
+    {
+        case AST_UNARY:
+            hoist(licm, &((ast_unary_t*) ast)->expr);
+            break;
+        case AST_BINARY:
+            hoist(licm, &((ast_binary_t*) ast)->lhs_expr);
+            hoist(licm, &((ast_binary_t*) ast)->rhs_expr);
+            break;
+        case AST_BLOCK:
+            hoist_list(licm, ((ast_block_t*) ast)->nodes);
+            break;
+        case AST_IF_COND:
+        {
+            ast_if_cond_t* if_cond = (ast_if_cond_t*) ast;
+            hoist(licm, &if_cond->condition);
+            hoist(licm, &if_cond->if_then);
+            hoist(licm, &if_cond->if_else);
+            break;
+        }
+        case AST_ASSIGN:
+        {
+            ast_assign_t* assign = (ast_assign_t*) ast;
+            ast_variable_t* update = ast_element_update(assign);
+
+            // The element load keeps sharing the index
+            if (update != NULL)
+            {
+                hoist(licm, &assign->index_expr);
+                update->index_expr = assign->index_expr;
+            }
+            hoist(licm, &assign->expr);
+            hoist(licm, &assign->index_expr);
+            break;
+        }
+        case AST_VARIABLE:
+            hoist(licm, &((ast_variable_t*) ast)->index_expr);
+            break;
+        case AST_FUNC_CALL:
+            hoist_list(licm, ((ast_func_call_t*) ast)->args);
+            break;
+        case AST_BUILTIN_CALL:
+            hoist_list(licm, ((ast_builtin_call_t*) ast)->args);
+            break;
+        case AST_FUNC_RETURN:
+            hoist(licm, &((ast_func_return_t*) ast)->expr);
+            break;
+        case AST_FOR_LOOP:
+        {
+            ast_for_loop_t* loop = (ast_for_loop_t*) ast;
+            hoist(licm, &loop->init);
+            hoist_nested(licm, loop->hoisted);
+            hoist(licm, &loop->condition);
+            hoist(licm, &loop->post);
+            hoist(licm, &loop->body);
+            break;
+        }
+        case AST_FOR_IN:
+        {
+            ast_for_in_t* loop = (ast_for_in_t*) ast;
+            hoist(licm, &loop->from);
+            hoist(licm, &loop->to);
+            hoist_nested(licm, loop->hoisted);
+            hoist(licm, &loop->body);
+            break;
+        }
+        case AST_ARRAY_SCALAR:
+            hoist_list(licm, ((ast_array_scalar_t*) ast)->elmnts);
+            break;
+        default:
+            break;
+    }
+}
+
+void licm_hoist(ast_t* loop, context_t* context)
+{
+    licm_t licm = { vec_new(0), vec_new(0), context };
+
+    if (loop->base->kind == AST_FOR_LOOP)
+    {
+        ast_for_loop_t* for_loop = (ast_for_loop_t*) loop;
+
+        ast_walk(for_loop->condition, collect_visit, licm.assigned);
+        ast_walk(for_loop->post, collect_visit, licm.assigned);
+        ast_walk(for_loop->body, collect_visit, licm.assigned);
+
+        hoist(&licm, &for_loop->condition);
+        hoist(&licm, &for_loop->post);
+        hoist(&licm, &for_loop->body);
+
+        for_loop->hoisted = licm.hoisted;
+    }
+    else if (loop->base->kind == AST_FOR_IN)
+    {
+        ast_for_in_t* for_in = (ast_for_in_t*) loop;
+
+        vec_append(licm.assigned, for_in->symbol);
+        ast_walk(for_in->body, collect_visit, licm.assigned);
+
+        hoist(&licm, &for_in->body);
+
+        for_in->hoisted = licm.hoisted;
+    }
+
+    vec_free(licm.assigned);
+}
@@ -0,0 +1,18 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include "ast.h"
+#include "context.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void licm_hoist(ast_t* loop, context_t* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LICM_H */
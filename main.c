@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "profile.h"
 #include "vm.h"
 #include <stdint.h>
 #include <stdio.h>
@@ -9,17 +10,24 @@
 
 void print_help_compiler()
 {
-    fprintf(stderr, "Usage: lime --c [--stdin] [--dasm <file>] [--exec|--gen <file>] [<file.lm>]\n");
+    fprintf(stderr, "Usage: lime --c [--stdin] [-O<level>] [--dasm <file>] [--exec|--gen <file>] [--tier] [--tier-stats]\n"
+        "                [--profile-out <file>] [--profile-use <file>] [<file.lm>]\n");
     fprintf(stderr, "  --stdin    Read code from stdin instead of a file\n");
+    fprintf(stderr, "  -O         Optimization level 0-2, default 2\n");
     fprintf(stderr, "  --dasm     Write disassembly to file\n");
     fprintf(stderr, "  --exec     Compile and execute\n");
     fprintf(stderr, "  --gen      Generate bytecode to file\n");
+    fprintf(stderr, "  --tier     Reoptimize hot functions while executing\n");
+    fprintf(stderr, "  --tier-stats  Same as --tier, prints call and loop counts at exit\n");
+    fprintf(stderr, "  --profile-out  Write branch and call counts to file when executing\n");
+    fprintf(stderr, "  --profile-use  Lay out the code by the counts in file\n");
 }
 
 void print_help_executor()
 {
-    fprintf(stderr, "Usage: lime --x [file.lmx]\n");
+    fprintf(stderr, "Usage: lime --x [--tier] [--tier-stats] [--profile-out <file>] [file.lmx]\n");
     fprintf(stderr, "  Loads and executes bytecode file\n");
+    fprintf(stderr, "  --profile-out  Write branch and call counts to file\n");
 }
 
 void print_help()
@@ -34,18 +42,26 @@ int main_compiler(int argc, char *argv[])
     int use_stdin = 0;
     int exec_flag = 0;
     int gen_flag = 0;
+    int tier_flag = 0;
+    int tier_stats = 0;
     char* dasm_filename = NULL;
     char* output_filename = NULL;
+    char* profile_out = NULL;
+    profile_t* profile = NULL;
 
     static struct option long_options[] = {
         {"stdin", no_argument, 0, 's'},
         {"dasm", required_argument, 0, 'd'},
         {"exec", no_argument, 0, 'e'},
         {"gen", required_argument, 0, 'g'},
+        {"tier", no_argument, 0, 't'},
+        {"tier-stats", no_argument, 0, 'T'},
+        {"profile-out", required_argument, 0, 'p'},
+        {"profile-use", required_argument, 0, 'P'},
         {0, 0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, "O:", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -62,6 +78,31 @@ int main_compiler(int argc, char *argv[])
             gen_flag = 1;
             output_filename = optarg;
             break;
+        case 'T':
+            tier_stats = 1;
+            // fall through
+        case 't':
+            tier_flag = 1;
+            break;
+        case 'p':
+            profile_out = optarg;
+            break;
+        case 'P':
+            if (profile != NULL)
+                profile_free(profile);
+            profile = profile_load(optarg);
+            if (profile == NULL)
+                return 1;
+            parser_set_profile(profile);
+            break;
+        case 'O':
+            if (strlen(optarg) != 1 || optarg[0] < '0' || optarg[0] > '2')
+            {
+                fprintf(stderr, "Error: Optimization level must be 0, 1 or 2\n");
+                return 1;
+            }
+            parser_set_opt_level(optarg[0] - '0');
+            break;
         default:
             print_help_compiler();
             return 1;
@@ -98,6 +139,9 @@ int main_compiler(int argc, char *argv[])
     parser_parse();
     parser_free();
 
+    if (profile != NULL)
+        profile_free(profile);
+
     if (dasm_filename)
     {
         vm_dasm(dasm_filename);
@@ -115,6 +159,10 @@ int main_compiler(int argc, char *argv[])
 
     if (exec_flag)
     {
+        if (profile_out)
+            vm_profile(profile_out);
+        if (tier_flag)
+            vm_tier(tier_stats);
         vm_exec();
     }
 
@@ -123,7 +171,37 @@ int main_compiler(int argc, char *argv[])
 
 int main_executor(int argc, char *argv[])
 {
+    int opt;
+    int tier_flag = 0;
+    int tier_stats = 0;
     char* bytecode_file = NULL;
+    char* profile_out = NULL;
+
+    static struct option long_options[] = {
+        {"tier", no_argument, 0, 't'},
+        {"tier-stats", no_argument, 0, 'T'},
+        {"profile-out", required_argument, 0, 'p'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'T':
+            tier_stats = 1;
+            // fall through
+        case 't':
+            tier_flag = 1;
+            break;
+        case 'p':
+            profile_out = optarg;
+            break;
+        default:
+            print_help_executor();
+            return 1;
+        }
+    }
 
     if (optind < argc)
     {
@@ -137,6 +215,10 @@ int main_executor(int argc, char *argv[])
 
     vm_init();
     vm_load(bytecode_file);
+    if (profile_out)
+        vm_profile(profile_out);
+    if (tier_flag)
+        vm_tier(tier_stats);
     vm_exec();
 
     return 0;
@@ -0,0 +1,202 @@
+#include "map.h"
+#include "types.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Open addressing with Robin Hood hashing. An entry probing for a place
+// takes over the one it meets that is closer to its home slot, so probe
+// lengths stay short and even, and a lookup stops as soon as it meets an
+// entry closer to home than the key would be. Removal shifts the entries
+// after the removed one back a slot, there are no tombstones.
+//
+// Keys are normalized to their type first: integers narrower than 64 bits
+// are extended from their low bits, -0.0 is 0.0 and strings compare by
+// their characters.
+
+#define MAP_MIN_CAPACITY 8
+
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static value_t normalize(map_t* map, value_t key)
+{
+    key = value_extend(map->key_type, key);
+    if (map->key_type == MT_REAL && key.as_real == 0)
+        key.as_real = 0;
+    return key;
+}
+
+static uint32_t hash(map_t* map, value_t key)
+{
+    if (map->key_type != MT_STR)
+        return mix(key.as_uint64);
+
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const uint8_t* c = map->data + key.as_uint16; *c; c++)
+        h = (h ^ *c) * 0x100000001b3ULL;
+    return mix(h);
+}
+
+static bool_t equal(map_t* map, value_t a, value_t b)
+{
+    if (a.as_uint64 == b.as_uint64)
+        return true;
+    return map->key_type == MT_STR &&
+        strcmp((const char*) map->data + a.as_uint16, (const char*) map->data + b.as_uint16) == 0;
+}
+
+map_t* map_new(type_t key_type, const uint8_t* data)
+{
+    map_t* map = malloc(sizeof (map_t));
+    map->entries = NULL;
+    map->capacity = 0;
+    map->count = 0;
+    map->key_type = key_type;
+    map->data = data;
+    return map;
+}
+
+void map_free(map_t* map)
+{
+    free(map->entries);
+    free(map);
+}
+
+void map_clear(map_t* map)
+{
+    if (map->capacity > 0)
+        memset(map->entries, 0, sizeof (map_entry_t) * map->capacity);
+    map->count = 0;
+}
+
+static map_entry_t* lookup(map_t* map, value_t key, uint32_t h)
+{
+    size_t mask = map->capacity - 1;
+
+    if (map->capacity == 0)
+        return NULL;
+
+    for (size_t i = h & mask, dist = 1;; i = (i + 1) & mask, dist++)
+    {
+        map_entry_t* entry = &map->entries[i];
+
+        // Empty, or the key would have taken this entry over
+        if (entry->dist < dist)
+            return NULL;
+        if (entry->hash == h && equal(map, entry->key, key))
+            return entry;
+    }
+}
+
+// Places a key that is not in the map, returns where it went
+static map_entry_t* place(map_t* map, map_entry_t entry)
+{
+    size_t mask = map->capacity - 1;
+    map_entry_t* placed = NULL;
+
+    entry.dist = 1;
+    for (size_t i = entry.hash & mask;; i = (i + 1) & mask, entry.dist++)
+    {
+        map_entry_t* slot = &map->entries[i];
+
+        if (slot->dist == 0)
+        {
+            *slot = entry;
+            return placed != NULL ? placed : slot;
+        }
+
+        if (slot->dist < entry.dist)
+        {
+            map_entry_t richer = *slot;
+            *slot = entry;
+            entry = richer;
+            if (placed == NULL)
+                placed = slot;
+        }
+    }
+}
+
+static void grow(map_t* map)
+{
+    map_entry_t* old = map->entries;
+    size_t old_capacity = map->capacity;
+
+    map->capacity = old_capacity > 0 ? old_capacity * 2 : MAP_MIN_CAPACITY;
+    map->entries = calloc(map->capacity, sizeof (map_entry_t));
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old[i].dist != 0)
+            place(map, old[i]);
+    }
+
+    free(old);
+}
+
+value_t* map_find(map_t* map, value_t key)
+{
+    key = normalize(map, key);
+    map_entry_t* entry = lookup(map, key, hash(map, key));
+    return entry != NULL ? &entry->value : NULL;
+}
+
+// The value of the key, a new key starts out as 0
+value_t* map_insert(map_t* map, value_t key)
+{
+    key = normalize(map, key);
+    uint32_t h = hash(map, key);
+    map_entry_t* entry = lookup(map, key, h);
+
+    if (entry != NULL)
+        return &entry->value;
+
+    // At most 7/8 full
+    if ((map->count + 1) * 8 > map->capacity * 7)
+        grow(map);
+
+    map->count++;
+    return &place(map, (map_entry_t) { .key = key, .value = { .as_uint64 = 0 }, .hash = h })->value;
+}
+
+bool_t map_remove(map_t* map, value_t key)
+{
+    key = normalize(map, key);
+    map_entry_t* entry = lookup(map, key, hash(map, key));
+
+    if (entry == NULL)
+        return false;
+
+    size_t mask = map->capacity - 1;
+    size_t i = entry - map->entries;
+
+    // Shift the entries displaced past it back, up to one at home
+    for (size_t next = (i + 1) & mask; map->entries[next].dist > 1; i = next, next = (next + 1) & mask)
+    {
+        map->entries[i] = map->entries[next];
+        map->entries[i].dist--;
+    }
+
+    map->entries[i].dist = 0;
+    map->count--;
+    return true;
+}
+
+// First entry in use at pos or after it, -1 past the last one
+int64_t map_next(map_t* map, int64_t pos)
+{
+    for (size_t i = pos < 0 ? 0 : pos; i < map->capacity; i++)
+    {
+        if (map->entries[i].dist != 0)
+            return i;
+    }
+    return -1;
+}
@@ -0,0 +1,40 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+    value_t key;
+    value_t value;
+    uint32_t hash;
+    uint32_t dist;      // probe length plus one, 0 for an empty entry
+} map_entry_t;
+
+typedef struct
+{
+    map_entry_t* entries;
+    size_t capacity;    // a power of two, or 0 before the first insert
+    size_t count;
+    type_t key_type;
+    const uint8_t* data;    // strings are offsets into it
+} map_t;
+
+map_t* map_new(type_t key_type, const uint8_t* data);
+void map_free(map_t* map);
+void map_clear(map_t* map);
+value_t* map_find(map_t* map, value_t key);
+value_t* map_insert(map_t* map, value_t key);
+bool_t map_remove(map_t* map, value_t key);
+int64_t map_next(map_t* map, int64_t pos);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAP_H */
@@ -6,6 +6,14 @@
 #include "context.h"
 #include "builtins.h"
 #include "ast.h"
+#include "fold.h"
+#include "strength.h"
+#include "dce.h"
+#include "ir.h"
+#include "licm.h"
+#include "unroll.h"
+#include "peephole.h"
+#include "layout.h"
 #include "vector.h"
 #include "vm.h"
 #include <stddef.h>
@@ -15,11 +23,22 @@
 #include <stdlib.h>
 
 static token_t look;
+static token_t ahead;
+static bool_t has_ahead;
 static context_t* context;
+static uint8_t opt_level = 2;
+static profile_t* profile = NULL;
+static bool_t statement_start;      // the next factor starts an expression statement
+static bool_t compound_allowed;     // the variable being parsed may take x += e, x++ or x--
 
 ast_t* factor();
 ast_t* expression();
 ast_t* ident();
+ast_t* assign_value(bool_t new_variable, symbol_t* s, ast_t* index_expr, ast_t* expr);
+ast_t* columns_assign(symbol_t* s, symbol_t* src, bool_t new_variable);
+ast_t* compound_assign(symbol_t* s, type_t var_type, ast_t* index_expr);
+ast_t* compound_expr(ast_t* lhs, type_t var_type);
+ast_t* zero_value(type_t type);
 ast_t* func_call(const char* id);
 ast_t* array_scalar();
 void statements(ast_block_t* block, token_type_t finish);
@@ -42,6 +61,8 @@ const bin_op_prec_t BIN_OP_PREC[] = {
     {TK_MOD, 90},
     {TK_PLUS, 80},
     {TK_MINUS, 80},
+    {TK_SHL, 75},
+    {TK_SHR, 75},
     {TK_LT, 70},
     {TK_LTE, 70},
     {TK_GT, 70},
@@ -107,10 +128,27 @@ bool_t is_logical(token_type_t token_type)
 
 void match(token_type_t token_type)
 {
-    if (look.type == token_type)
-        look = lexer_next();
-    else
+    if (look.type != token_type)
         panic("Not expected token");
+
+    if (has_ahead)
+    {
+        look = ahead;
+        has_ahead = false;
+    }
+    else
+        look = lexer_next();
+}
+
+// The token after look
+token_t peek_ahead()
+{
+    if (!has_ahead)
+    {
+        ahead = lexer_next();
+        has_ahead = true;
+    }
+    return ahead;
 }
 
 char* peek_ident()
@@ -121,24 +159,44 @@ char* peek_ident()
     return look.value.as_str;
 }
 
-type_t peek_data_type()
+// A name the program declares, the names of the data types are reserved
+char* peek_new_ident()
 {
-    for (int i = 0; i < sizeof (BUILTIN_DATATYPES) / sizeof (BUILTIN_DATATYPES[0]); i++)
-    {
-        if (strcmp(BUILTIN_DATATYPES[i].name, look.value.as_str) == 0)
-            return BUILTIN_DATATYPES[i].type;
-    }
+    char* id = peek_ident();
+
+    if (builtin_datatype_lookup(id) != NULL)
+        panic("A data type name can not be declared.");
+
+    return id;
+}
 
+type_t peek_data_type()
+{
     if (look.type != TK_IDENT)
         panic("A data type is expected");
 
-    panic("Uknown data type.");
+    const builtin_datatype_t* datatype = builtin_datatype_lookup(look.value.as_str);
+
+    if (datatype == NULL)
+        panic("Uknown data type.");
+
+    return datatype->type;
+}
+
+// soa[S*n], an array of structs laid out by columns
+bool_t peek_soa()
+{
+    return peek_data_type() == MT_ARRAY && builtin_datatype_lookup(look.value.as_str)->token == TK_SOA_T;
 }
 
 type_t data_type()
 {
     type_t t = peek_data_type();
 
+    // They are declared with their element types, only by a var
+    if (is_container_type(t) || peek_soa())
+        panic("A map, heap, deque or soa array can only be declared by a var.");
+
     if (t != MT_UNKNOWN)
     {
         match(look.type);
@@ -154,6 +212,10 @@ type_t infer_binary_expr_type(token_type_t op, type_t lhs_type, type_t rhs_type)
 {
     type_t infered_type = MT_UNKNOWN;
 
+    // A shift keeps the type of the shifted value
+    if (op == TK_SHL || op == TK_SHR)
+        return is_integer_type(lhs_type) && is_integer_type(rhs_type) ? lhs_type : MT_UNKNOWN;
+
     if ((is_integer_type(lhs_type) && is_integer_type(rhs_type)) ||
         (is_integer_type(lhs_type) && rhs_type == MT_REAL) ||
         (is_integer_type(rhs_type) && lhs_type == MT_REAL) ||
@@ -223,7 +285,10 @@ ast_t* binary_expr(int16_t min_prec, ast_t* lhs)
             panic("Type unknown or mismatch for binary expression!");
         }
 
-        lhs = (ast_t*) ast_new_binary(mixed_type, op, lhs, rhs);
+        lhs = fold((ast_t*) ast_new_binary(mixed_type, op, lhs, rhs));
+
+        if (opt_level > 0)
+            lhs = strength_reduce(lhs);
     }
 
     return lhs;
@@ -243,7 +308,7 @@ ast_t* unary_expr()
         panic("Type unknown or mismatch for unary expression!");
     }
 
-    return (ast_t*) ast_new_unary(type, unary, expr);
+    return fold((ast_t*) ast_new_unary(type, unary, expr));
 }
 
 ast_t* expression()
@@ -251,13 +316,27 @@ ast_t* expression()
     return binary_expr(0, factor());
 }
 
+// An expression standing as a statement, the only place a compound
+// assignment may start as they leave no value
+ast_t* expr_statement()
+{
+    statement_start = true;
+    return expression();
+}
+
 ast_t* factor()
 {
     ast_t* node = NULL;
+    bool_t at_statement = statement_start;
+
+    statement_start = false;
 
     if (look.type == TK_IDENT)
     {
+        bool_t outer = compound_allowed;
+        compound_allowed = at_statement;
         node = ident();
+        compound_allowed = outer;
     } 
     else if (look.type == TK_L_PAREN)
     {
@@ -358,84 +437,948 @@ ast_t* factor()
     }
     else
     {
-        panic("Unknown factor!");
+        panic("Unknown factor!");
+    }
+
+    return node;
+}
+
+ast_t* assign(bool_t new_variable, const char* id, ast_t* index_expr)
+{
+    symbol_t* s = context_get(context, id, false);
+
+    if (s == NULL)
+    {
+        panic("Identifier is not defined.");
+    }
+
+    if (s->immutable)
+        panic("Cannot assign to an immutable variable.");
+
+    match(TK_ASSIGN);
+
+    return assign_value(new_variable, s, index_expr, expression());
+}
+
+ast_t* assign_value(bool_t new_variable, symbol_t* s, ast_t* index_expr, ast_t* expr)
+{
+    type_t expr_type = expr->base->type;
+
+    if (expr_type == MT_UNKNOWN)
+    {
+        panic("No type to assign.");
+    }
+
+    if (is_container_type(expr_type))
+        panic("A map, heap or deque can not be copied.");
+
+    type_t var_type = s->type;
+
+    if (index_expr)
+    {
+        var_type = s->extra.array.elmnt_type;
+    }
+
+    if (var_type == MT_UNKNOWN)
+    {
+        var_type = expr_type;
+    }
+    else if (var_type != expr_type)
+    {
+        if (can_implicitly_cast_integer(expr_type, var_type))
+        {
+
+        }
+        else
+        {
+            panic("Assignment type mismatch.");
+        }
+    }
+
+    symbol_t* src = ast_array_symbol(expr);
+
+    if (src != NULL && !new_variable)
+    {
+        // Whole array assignment copies into the existing elements
+        if (s->extra.array.elmnt_type != src->extra.array.elmnt_type || s->extra.array.len != src->extra.array.len ||
+            s->extra.array.strct != src->extra.array.strct ||
+            (s->extra.array.columns == NULL) != (src->extra.array.columns == NULL))
+            panic("Array assignment type mismatch.");
+
+        if (src->extra.array.columns != NULL)
+            return columns_assign(s, src, false);
+    }
+    else if (src != NULL && src->extra.array.columns != NULL)
+    {
+        context_add_columns(context, s, src->extra.array.strct, src->extra.array.len);
+        return columns_assign(s, src, true);
+    }
+    else if (expr_type == MT_ARRAY)
+    {
+        if (src != NULL)
+        {
+            s->extra.array.elmnt_type = src->extra.array.elmnt_type;
+            s->extra.array.len = src->extra.array.len;
+            s->extra.array.strct = src->extra.array.strct;
+        }
+        else if (expr->base->kind == AST_ARRAY_SCALAR)
+        {
+            s->extra.array.elmnt_type = ((ast_array_scalar_t*)expr)->elmnt_type;
+            s->extra.array.len = vec_size(((ast_array_scalar_t*)expr)->elmnts);
+        }
+        else
+        {
+            panic("Array can only be assigned from an array variable or literal.");
+        }
+
+        size_t slots = array_slots(s->extra.array.elmnt_type, s->extra.array.len);
+        if (slots > UINT16_MAX)
+        {
+            panic("Array is too large.");
+        }
+
+        context_alloc_stack_addr(context, slots);
+    }
+
+    if (!index_expr)
+        s->type = var_type;
+
+    return (ast_t*) ast_new_assign(MT_UNKNOWN, s, expr, index_expr, new_variable);
+}
+
+// x += e, x -= e, x *= e, x++ and x-- are x = x <op> e, with the variable
+// and the index shared so the element is located only once
+ast_t* compound_assign(symbol_t* s, type_t var_type, ast_t* index_expr)
+{
+    if (s->immutable)
+        panic("Cannot assign to an immutable variable.");
+
+    ast_t* lhs = (ast_t*) ast_new_variable(var_type, s, index_expr);
+
+    return (ast_t*) ast_new_assign(MT_UNKNOWN, s, compound_expr(lhs, var_type), index_expr, false);
+}
+
+// lhs <op> e for the compound assignment operator ahead
+ast_t* compound_expr(ast_t* lhs, type_t var_type)
+{
+    token_type_t tok = look.type;
+    token_type_t op = tok == TK_MUL_ASSIGN ? TK_MUL : (tok == TK_PLUS_ASSIGN || tok == TK_INC) ? TK_PLUS : TK_MINUS;
+
+    if (!compound_allowed)
+        panic("x += e, x -= e, x *= e, x++ and x-- are statements, not expressions.");
+
+    if (!is_integer_type(var_type) && var_type != MT_REAL)
+        panic("Compound assignment needs a numeric variable.");
+
+    match(tok);
+    compound_allowed = false;
+
+    ast_t* rhs;
+
+    if (tok == TK_INC || tok == TK_DEC)
+    {
+        value_t one = { .as_int64 = 1 };
+        rhs = (ast_t*) ast_new_constant(MT_INT8, one);
+
+        if (is_binary(look.type))
+            panic("x++ and x-- are statements, not expressions.");
+    }
+    else
+        rhs = expression();
+
+    type_t type = infer_binary_expr_type(op, var_type, rhs->base->type);
+
+    if (type == MT_UNKNOWN)
+        panic("Type unknown or mismatch for binary expression!");
+
+    if (type != var_type && !can_implicitly_cast_integer(type, var_type))
+        panic("Assignment type mismatch.");
+
+    ast_t* expr = (ast_t*) ast_new_binary(type, op, lhs, rhs);
+
+    if (opt_level > 0)
+        expr = strength_reduce(expr);
+
+    return expr;
+}
+
+// Value structs declared so far, see struct_decl
+static vector_t* structs = NULL;
+
+// Where the fields of a struct value are, the field variables of a struct
+// or an element of an array of structs
+typedef struct
+{
+    struct_t* def;
+    symbol_t** fields;      // NULL for an element
+    symbol_t* array;
+    ast_t* index_expr;      // of the element
+} struct_ref_t;
+
+typedef struct
+{
+    struct_ref_t* target;
+    bool_t array;           // reading any element counts
+    bool_t found;
+} struct_reads_t;
+
+struct_t* struct_lookup(const char* id)
+{
+    for (size_t i = 0; i < vec_size(structs); i++)
+    {
+        struct_t* def = vec_get(structs, i);
+        if (strcmp(def->id, id) == 0)
+            return def;
+    }
+    return NULL;
+}
+
+bool_t is_struct_array(symbol_t* s)
+{
+    return is_array_type(s->type) && s->extra.array.strct != NULL;
+}
+
+// struct name { var field: type ... }, the fields are numbers or booleans
+ast_t* struct_decl()
+{
+    if (!context_is_global(context))
+        panic("Structs can only be declared at the top level.");
+
+    match(TK_STRUCT);
+
+    const char* id = peek_new_ident();
+    match(TK_IDENT);
+
+    if (struct_lookup(id) != NULL || context_get(context, id, false) != NULL)
+        panic("Identifier is already defined.");
+
+    struct_t* def = malloc(sizeof (struct_t));
+    def->id = id;
+    def->fields = vec_new(0);
+
+    match(TK_L_BRACE);
+
+    while (look.type != TK_R_BRACE)
+    {
+        if (look.type == TK_SEMICOLON)
+        {
+            match(TK_SEMICOLON);
+            continue;
+        }
+
+        match(TK_VAR);
+
+        field_t* field = malloc(sizeof (field_t));
+        field->id = peek_ident();
+        match(TK_IDENT);
+        match(TK_COLON);
+        field->type = data_type();
+
+        if (!is_integer_type(field->type) && !is_real_type(field->type) && !is_bool_type(field->type))
+            panic("Struct fields must be numbers or booleans.");
+
+        for (size_t i = 0; i < vec_size(def->fields); i++)
+        {
+            if (strcmp(((field_t*) vec_get(def->fields, i))->id, field->id) == 0)
+                panic("Struct field is already defined.");
+        }
+
+        vec_append(def->fields, field);
+    }
+    match(TK_R_BRACE);
+
+    if (vec_size(def->fields) == 0)
+        panic("Struct has no fields.");
+
+    if (structs == NULL)
+        structs = vec_new(0);
+    vec_append(structs, def);
+
+    return NULL;
+}
+
+// .field after a struct, its position in the struct
+size_t struct_field(struct_t* def)
+{
+    if (look.type != TK_PERIOD)
+        panic("A struct can only be assigned or have its fields used.");
+
+    match(TK_PERIOD);
+
+    const char* id = peek_ident();
+
+    for (size_t i = 0; i < vec_size(def->fields); i++)
+    {
+        if (strcmp(((field_t*) vec_get(def->fields, i))->id, id) == 0)
+        {
+            match(TK_IDENT);
+            return i;
+        }
+    }
+
+    panic("Unknown struct field.");
+
+    return 0;
+}
+
+type_t field_type(struct_t* def, size_t field)
+{
+    return ((field_t*) vec_get(def->fields, field))->type;
+}
+
+ast_t* index_op(token_type_t op, ast_t* lhs, int64_t n)
+{
+    value_t value = { .as_int64 = n };
+    ast_t* rhs = (ast_t*) ast_new_constant(MT_INT64, value);
+    ast_t* expr = fold((ast_t*) ast_new_binary(infer_binary_expr_type(op, lhs->base->type, MT_INT64), op, lhs, rhs));
+
+    return opt_level > 0 ? strength_reduce(expr) : expr;
+}
+
+// Element of a field of ps[i]: the structs lie one after the other in
+// the array, a slot for each field
+ast_t* field_index(struct_t* def, ast_t* index_expr, size_t field)
+{
+    ast_t* index = index_expr;
+
+    if (vec_size(def->fields) > 1)
+        index = index_op(TK_MUL, index, vec_size(def->fields));
+    if (field > 0)
+        index = index_op(TK_PLUS, index, field);
+
+    return index;
+}
+
+ast_t* element_index()
+{
+    match(TK_L_BRACKET);
+    ast_t* index_expr = expression();
+    match(TK_R_BRACKET);
+
+    if (!is_integer_type(index_expr->base->type))
+        panic("Array index must be an integer.");
+
+    return index_expr;
+}
+
+struct_ref_t struct_ref(symbol_t* s)
+{
+    struct_ref_t ref = { s->extra.strct.def, s->extra.strct.fields, NULL, NULL };
+    return ref;
+}
+
+// ps[i] as a struct. Every field uses the index, one that is neither a
+// constant nor a variable is kept in a hidden slot first.
+struct_ref_t element_ref(symbol_t* s, ast_t* index_expr, vector_t* nodes)
+{
+    struct_ref_t ref = { s->extra.array.strct, NULL, s, index_expr };
+    bool_t simple = index_expr->base->kind == AST_CONSTANT ||
+        (index_expr->base->kind == AST_VARIABLE && ((ast_variable_t*) index_expr)->index_expr == NULL);
+
+    if (!simple && vec_size(ref.def->fields) > 1)
+    {
+        symbol_t* temp = context_add_temp(context, index_expr->base->type);
+        vec_append(nodes, ast_new_assign(MT_UNKNOWN, temp, index_expr, NULL, true));
+        ref.index_expr = (ast_t*) ast_new_variable(temp->type, temp, NULL);
+    }
+
+    return ref;
+}
+
+ast_t* field_value(struct_ref_t* ref, size_t field)
+{
+    type_t type = field_type(ref->def, field);
+
+    if (ref->fields != NULL)
+        return (ast_t*) ast_new_variable(type, ref->fields[field], NULL);
+
+    if (ref->array->extra.array.columns != NULL)
+        return (ast_t*) ast_new_variable(type, ref->array->extra.array.columns[field], ref->index_expr);
+
+    return (ast_t*) ast_new_variable(type, ref->array, field_index(ref->def, ref->index_expr, field));
+}
+
+ast_t* field_assign(struct_ref_t* ref, size_t field, ast_t* expr, bool_t new_variable)
+{
+    type_t type = field_type(ref->def, field);
+
+    if (expr->base->type != type && !can_implicitly_cast_integer(expr->base->type, type))
+        panic("Assignment type mismatch.");
+
+    if (ref->fields != NULL)
+        return (ast_t*) ast_new_assign(MT_UNKNOWN, ref->fields[field], expr, NULL, new_variable);
+
+    if (ref->array->extra.array.columns != NULL)
+        return (ast_t*) ast_new_assign(MT_UNKNOWN, ref->array->extra.array.columns[field], expr, ref->index_expr,
+            new_variable);
+
+    return (ast_t*) ast_new_assign(MT_UNKNOWN, ref->array, expr, field_index(ref->def, ref->index_expr, field),
+        new_variable);
+}
+
+static bool_t struct_reads_visit(ast_t* ast, void* arg)
+{
+    struct_reads_t* reads = arg;
+    struct_ref_t* target = reads->target;
+
+    if (ast->base->kind != AST_VARIABLE)
+        return true;
+
+    symbol_t* s = ((ast_variable_t*) ast)->symbol;
+
+    for (size_t i = 0; i < vec_size(target->def->fields); i++)
+    {
+        if (target->fields != NULL && s == target->fields[i])
+            reads->found = true;
+        if (reads->array && target->array != NULL && target->array->extra.array.columns != NULL &&
+            s == target->array->extra.array.columns[i])
+            reads->found = true;
+    }
+
+    if (reads->array && s == target->array)
+        reads->found = true;
+
+    return !reads->found;
+}
+
+// Field values that read the target are kept in hidden slots before the
+// first field is written, so p = point(p.y, p.x) swaps. A copy of another
+// element of the same array never overlaps the target.
+void struct_values_apart(vector_t* values, struct_ref_t* target, bool_t copy, vector_t* nodes)
+{
+    struct_reads_t reads = { target, !copy, false };
+
+    for (size_t i = 0; i < vec_size(values); i++)
+        ast_walk(vec_get(values, i), struct_reads_visit, &reads);
+
+    for (size_t i = 0; reads.found && i < vec_size(values); i++)
+    {
+        ast_t* value = vec_get(values, i);
+        symbol_t* temp = context_add_temp(context, value->base->type);
+        vec_append(nodes, ast_new_assign(MT_UNKNOWN, temp, value, NULL, true));
+        vec_set(values, i, ast_new_variable(temp->type, temp, NULL));
+    }
+}
+
+ast_t* struct_member(symbol_t* s);
+ast_t* element_member(symbol_t* s, ast_t* index_expr);
+
+// The field values of point(a, b), of a struct variable or of an element
+// of an array of structs. Anything else starting with a struct, like
+// p.x + 1 or a whole array of structs, is parsed as an expression into
+// other instead.
+vector_t* struct_value(struct_t** def, struct_ref_t* target, vector_t* nodes, ast_t** other)
+{
+    const char* id = peek_ident();
+    match(TK_IDENT);
+
+    struct_t* value_def = struct_lookup(id);
+    vector_t* values = vec_new(0);
+
+    if (value_def != NULL)
+    {
+        match(TK_L_PAREN);
+        while (look.type != TK_R_PAREN)
+        {
+            vec_append(values, expression());
+            if (look.type == TK_R_PAREN)
+                break;
+            match(TK_COMMA);
+        }
+        match(TK_R_PAREN);
+
+        if (vec_size(values) != vec_size(value_def->fields))
+            panic("Struct field count mismatch.");
+
+        if (target != NULL)
+            struct_values_apart(values, target, false, nodes);
+    }
+    else
+    {
+        symbol_t* s = context_get(context, id, false);
+
+        if (s == NULL)
+            panic("Identifier is not defined.");
+
+        if (s->type != MT_STRUCT && !is_struct_array(s))
+            panic("A struct value is expected.");
+
+        ast_t* index_expr = NULL;
+        if (is_struct_array(s) && look.type == TK_L_BRACKET)
+            index_expr = element_index();
+
+        if (look.type == TK_PERIOD || (s->type != MT_STRUCT && index_expr == NULL))
+        {
+            ast_t* lhs = s->type == MT_STRUCT ? struct_member(s) :
+                index_expr != NULL ? element_member(s, index_expr) : (ast_t*) ast_new_variable(s->type, s, NULL);
+            *other = binary_expr(0, lhs);
+            vec_free(values);
+            return NULL;
+        }
+
+        struct_ref_t ref = s->type == MT_STRUCT ? struct_ref(s) : element_ref(s, index_expr, nodes);
+        value_def = ref.def;
+
+        for (size_t i = 0; i < vec_size(value_def->fields); i++)
+            vec_append(values, field_value(&ref, i));
+
+        if (target != NULL)
+            struct_values_apart(values, target, true, nodes);
+    }
+
+    if (*def != NULL && *def != value_def)
+        panic("Struct type mismatch.");
+
+    *def = value_def;
+    return values;
+}
+
+// A struct assignment is a block with an assignment for every field. As
+// an expression it leaves the last field, like any other assignment.
+ast_block_t* struct_block()
+{
+    return ast_new_block(MT_UNKNOWN, context_new(context, MB_NORMAL));
+}
+
+void struct_assign(struct_ref_t* target, vector_t* nodes, vector_t* values, bool_t new_variable)
+{
+    size_t count = vec_size(values);
+
+    for (size_t i = 0; i < count; i++)
+        vec_append(nodes, field_assign(target, i, vec_get(values, i), new_variable || i + 1 < count));
+}
+
+// p = <struct> or ps[i] = <struct>
+ast_t* struct_reassign(symbol_t* s, ast_t* index_expr)
+{
+    if (s->immutable)
+        panic("Cannot assign to an immutable variable.");
+
+    ast_block_t* block = struct_block();
+    struct_ref_t target = index_expr == NULL ? struct_ref(s) : element_ref(s, index_expr, block->nodes);
+    struct_t* def = target.def;
+    ast_t* other = NULL;
+
+    match(TK_ASSIGN);
+
+    vector_t* values = struct_value(&def, &target, block->nodes, &other);
+
+    if (other != NULL)
+        panic("A struct value is expected.");
+
+    struct_assign(&target, block->nodes, values, false);
+    block->base->type = field_type(def, vec_size(def->fields) - 1);
+
+    return (ast_t*) block;
+}
+
+// p.x, a variable of its own
+ast_t* struct_member(symbol_t* s)
+{
+    symbol_t* field = s->extra.strct.fields[struct_field(s->extra.strct.def)];
+
+    if (look.type == TK_ASSIGN)
+        return assign(false, field->id, NULL);
+
+    if (look.type == TK_PLUS_ASSIGN || look.type == TK_MINUS_ASSIGN || look.type == TK_MUL_ASSIGN ||
+        look.type == TK_INC || look.type == TK_DEC)
+        return compound_assign(field, field->type, NULL);
+
+    return (ast_t*) ast_new_variable(field->type, field, NULL);
+}
+
+// ps[i].x, an element at a fixed offset from the struct
+ast_t* element_member(symbol_t* s, ast_t* index_expr)
+{
+    struct_ref_t ref = { s->extra.array.strct, NULL, s, index_expr };
+    size_t field = struct_field(ref.def);
+    type_t type = field_type(ref.def, field);
+
+    if (look.type == TK_ASSIGN)
+    {
+        if (s->immutable)
+            panic("Cannot assign to an immutable variable.");
+
+        match(TK_ASSIGN);
+        return field_assign(&ref, field, expression(), false);
+    }
+
+    if ((look.type == TK_PLUS_ASSIGN || look.type == TK_MINUS_ASSIGN || look.type == TK_MUL_ASSIGN ||
+        look.type == TK_INC || look.type == TK_DEC) && s->extra.array.columns != NULL)
+    {
+        if (s->immutable)
+            panic("Cannot assign to an immutable variable.");
+
+        return compound_assign(s->extra.array.columns[field], type, index_expr);
+    }
+
+    if (look.type == TK_PLUS_ASSIGN || look.type == TK_MINUS_ASSIGN || look.type == TK_MUL_ASSIGN ||
+        look.type == TK_INC || look.type == TK_DEC)
+        return compound_assign(s, type, field_index(ref.def, index_expr, field));
+
+    return field_value(&ref, field);
+}
+
+// Whether a declaration goes on with a struct type or a struct value
+bool_t struct_declared()
+{
+    if (look.type != TK_COLON && look.type != TK_ASSIGN)
+        return false;
+
+    token_t next = peek_ahead();
+
+    if (next.type != TK_IDENT)
+        return false;
+
+    if (struct_lookup(next.value.as_str) != NULL)
+        return true;
+
+    symbol_t* s = context_get(context, next.value.as_str, false);
+    return look.type == TK_ASSIGN && s != NULL && (s->type == MT_STRUCT || is_struct_array(s));
+}
+
+ast_t* immutable_value(symbol_t* s, ast_assign_t* assign_ast);
+
+// var p: point, var p = point(1, 2), var p = q or var p = ps[i]. A value
+// that turns out not to be a struct, like p.x, declares a plain variable.
+ast_t* struct_var(const char* id, bool_t immutable)
+{
+    ast_block_t* block = struct_block();
+    struct_t* def = NULL;
+    vector_t* values = NULL;
+
+    if (look.type == TK_COLON)
+    {
+        match(TK_COLON);
+        def = struct_lookup(peek_ident());
+        match(TK_IDENT);
+    }
+
+    if (look.type == TK_ASSIGN)
+    {
+        ast_t* other = NULL;
+
+        match(TK_ASSIGN);
+        values = struct_value(&def, NULL, block->nodes, &other);
+
+        if (other != NULL)
+        {
+            if (def != NULL)
+                panic("Assignment type mismatch.");
+
+            symbol_t* s = context_add(context, id, MT_UNKNOWN);
+            ast_t* assign_ast = assign_value(true, s, NULL, other);
+
+            return immutable ? immutable_value(s, (ast_assign_t*) assign_ast) : assign_ast;
+        }
+    }
+    else if (immutable)
+        panic("An immutable variable needs a value.");
+
+    symbol_t* s = context_add_struct(context, id, def);
+    struct_ref_t target = struct_ref(s);
+
+    if (values == NULL)
+    {
+        values = vec_new(0);
+        for (size_t i = 0; i < vec_size(def->fields); i++)
+        {
+            value_t zero = { .as_int64 = 0 };
+            vec_append(values, ast_new_constant(field_type(def, i), zero));
+        }
+    }
+
+    struct_assign(&target, block->nodes, values, true);
+
+    s->immutable = immutable;
+    for (size_t i = 0; i < vec_size(def->fields); i++)
+        s->extra.strct.fields[i]->immutable = immutable;
+
+    return (ast_t*) block;
+}
+
+// Every column of an soa array zeroed, or copied from those of src
+ast_t* columns_assign(symbol_t* s, symbol_t* src, bool_t new_variable)
+{
+    ast_block_t* block = struct_block();
+    size_t count = vec_size(s->extra.array.strct->fields);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        symbol_t* column = s->extra.array.columns[i];
+        ast_t* expr = src != NULL ? (ast_t*) ast_new_variable(MT_ARRAY, src->extra.array.columns[i], NULL) : NULL;
+
+        vec_append(block->nodes, ast_new_assign(MT_UNKNOWN, column, expr, NULL, new_variable || i + 1 < count));
     }
 
-    return node;
+    if (!new_variable)
+        block->base->type = MT_ARRAY;
+
+    return (ast_t*) block;
 }
 
-ast_t* assign(bool_t new_variable, const char* id, ast_t* index_expr)
+// array[T*n], n zeroed elements of type T. The elements of an array of
+// structs are their fields, a full slot each. soa[point*n] lays the
+// structs out by columns instead, an array for every field, so a field
+// is packed to its size and the elements of one field are adjacent.
+ast_t* sized_array(symbol_t* s, bool_t soa)
 {
-    symbol_t* s = context_get(context, id, false);
+    if (soa)
+        match(TK_IDENT);
 
-    if (s == NULL)
-    {
-        panic("Identifier is not defined.");
-    }
+    match(TK_L_BRACKET);
 
-    match(TK_ASSIGN);
+    struct_t* def = look.type == TK_IDENT ? struct_lookup(look.value.as_str) : NULL;
+    type_t elmnt_type = MT_INT64;
 
-    ast_t* expr = expression();
-    type_t expr_type = expr->base->type;
+    if (def != NULL)
+        match(TK_IDENT);
+    else if (soa)
+        panic("An soa array needs a struct element type.");
+    else
+        elmnt_type = data_type();
 
-    if (expr_type == MT_UNKNOWN)
+    if (!is_integer_type(elmnt_type) && !is_real_type(elmnt_type) && !is_bool_type(elmnt_type))
+        panic("Array elements must be numbers or booleans.");
+
+    match(TK_MUL);
+
+    ast_t* len_expr = expression();
+    match(TK_R_BRACKET);
+
+    if (len_expr->base->kind != AST_CONSTANT || !is_integer_type(len_expr->base->type) ||
+        ((ast_constant_t*) len_expr)->value.as_int64 <= 0)
+        panic("Array length must be a positive integer constant.");
+
+    int64_t len = ((ast_constant_t*) len_expr)->value.as_int64;
+    size_t count = def != NULL ? vec_size(def->fields) : 1;
+    size_t slots = array_slots(elmnt_type, len * count);
+
+    if (soa)
     {
-        panic("No type to assign.");
+        slots = count - 1;
+        for (size_t i = 0; i < count; i++)
+            slots += array_slots(field_type(def, i), len);
     }
 
-    type_t var_type = s->type;
+    if (len > UINT16_MAX || slots > UINT16_MAX)
+        panic("Array is too large.");
 
-    if (index_expr)
+    if (look.type == TK_ASSIGN)
+        panic("A sized array starts out zeroed, it takes no value.");
+
+    if (soa)
     {
-        var_type = s->extra.array.elmnt_type;
+        context_add_columns(context, s, def, len);
+        return columns_assign(s, NULL, true);
     }
 
-    if (var_type == MT_UNKNOWN)
+    s->type = MT_ARRAY;
+    s->extra.array.elmnt_type = elmnt_type;
+    s->extra.array.len = len * count;
+    s->extra.array.strct = def;
+    context_alloc_stack_addr(context, slots);
+
+    return (ast_t*) ast_new_assign(MT_UNKNOWN, s, NULL, NULL, true);
+}
+
+// map[K, V], an empty map from keys of type K to values of type V. The
+// table lives in the VM and the variable refers to it, so a map is never
+// copied.
+ast_t* map_decl(symbol_t* s)
+{
+    match(TK_IDENT);
+    match(TK_L_BRACKET);
+    type_t key_type = data_type();
+    match(TK_COMMA);
+    type_t value_type = data_type();
+    match(TK_R_BRACKET);
+
+    if (!is_integer_type(key_type) && !is_real_type(key_type) && !is_bool_type(key_type) && !is_str_type(key_type))
+        panic("Map keys must be numbers, booleans or strings.");
+
+    if (!is_integer_type(value_type) && !is_real_type(value_type) && !is_bool_type(value_type) &&
+        !is_str_type(value_type))
+        panic("Map values must be numbers, booleans or strings.");
+
+    if (look.type == TK_ASSIGN)
+        panic("A map starts out empty, it takes no value.");
+
+    s->type = MT_MAP;
+    s->extra.map.key_type = key_type;
+    s->extra.map.value_type = value_type;
+
+    return (ast_t*) ast_new_assign(MT_UNKNOWN, s, NULL, NULL, true);
+}
+
+// Keys and elements are converted to the types of the container like in
+// an assignment
+void container_arg(ast_t* arg, type_t type, const char* msg)
+{
+    type_t arg_type = arg->base->type;
+
+    if (arg_type != type && !can_implicitly_cast_integer(arg_type, type))
+        panic(msg);
+}
+
+// A map is passed to builtins by reference, ahead of its key and value.
+// Returns the return type of the call.
+type_t map_builtin_args(const builtin_func_t* builtin, symbol_t* map, vector_t* args)
+{
+    type_t ret_type = builtin_map_ret_type(builtin, map->extra.map.value_type);
+
+    if (ret_type == MT_UNKNOWN)
+        panic("Builtin function does not accept a map.");
+
+    if (vec_size(args) > 1)
+        container_arg(vec_get(args, 1), map->extra.map.key_type, "Map key type mismatch.");
+
+    if (vec_size(args) > 2)
+        container_arg(vec_get(args, 2), map->extra.map.value_type, "Map value type mismatch.");
+
+    return ret_type;
+}
+
+// heap[T] or deque[T], an empty heap or deque of elements of type T. A
+// heap pops its least element first.
+ast_t* queue_decl(symbol_t* s, type_t type)
+{
+    match(TK_IDENT);
+    match(TK_L_BRACKET);
+    type_t elmnt_type = data_type();
+    match(TK_R_BRACKET);
+
+    if (!is_integer_type(elmnt_type) && !is_real_type(elmnt_type) && !is_bool_type(elmnt_type) &&
+        (type == MT_HEAP || !is_str_type(elmnt_type)))
+        panic(type == MT_HEAP ? "Heap elements must be numbers or booleans." :
+            "Deque elements must be numbers, booleans or strings.");
+
+    if (look.type == TK_ASSIGN)
+        panic("A heap or a deque starts out empty, it takes no value.");
+
+    s->type = type;
+    s->extra.queue.elmnt_type = elmnt_type;
+
+    return (ast_t*) ast_new_assign(MT_UNKNOWN, s, NULL, NULL, true);
+}
+
+// A heap or a deque is passed to builtins by reference, ahead of the
+// element. Returns the return type of the call.
+type_t queue_builtin_args(const builtin_func_t* builtin, symbol_t* queue, vector_t* args)
+{
+    type_t ret_type = builtin_queue_ret_type(builtin, queue->extra.queue.elmnt_type);
+
+    if (ret_type == MT_UNKNOWN || !is_builtin_type_acceptable(queue->type, builtin->acceptable_types))
+        panic(queue->type == MT_HEAP ? "Builtin function does not accept a heap." :
+            "Builtin function does not accept a deque.");
+
+    if (vec_size(args) > 1)
+        container_arg(vec_get(args, 1), queue->extra.queue.elmnt_type, "Value type does not match the element type.");
+
+    return ret_type;
+}
+
+// The map builtin of the name on s, the key and a value if any
+ast_t* map_call(const char* name, symbol_t* s, ast_t* key, ast_t* value)
+{
+    vector_t* args = vec_new(0);
+
+    vec_append(args, ast_new_variable(MT_MAP, s, NULL));
+    vec_append(args, key);
+    if (value != NULL)
+        vec_append(args, value);
+
+    return (ast_t*) ast_new_builtin_call(map_builtin_args(builtin_lookup(name), s, args), name, args);
+}
+
+// m[k] += e and the like are set(m, k, get_or(m, k, 0) <op> e). The key
+// is used twice, one that is neither a constant nor a variable is kept in
+// a hidden slot first.
+ast_t* map_update(symbol_t* s, ast_t* key)
+{
+    type_t value_type = s->extra.map.value_type;
+    ast_block_t* block = struct_block();
+    bool_t simple = key->base->kind == AST_CONSTANT ||
+        (key->base->kind == AST_VARIABLE && ((ast_variable_t*) key)->index_expr == NULL);
+
+    if (!simple)
     {
-        var_type = expr_type;
+        symbol_t* temp = context_add_temp(context, key->base->type);
+        vec_append(block->nodes, ast_new_assign(MT_UNKNOWN, temp, key, NULL, true));
+        key = (ast_t*) ast_new_variable(temp->type, temp, NULL);
     }
-    else if (var_type != expr_type)
-    {
-        if (can_implicitly_cast_integer(expr_type, var_type))
-        {
 
-        }
-        else
-        {
-            panic("Assignment type mismatch.");
-        }
-    }
+    ast_t* zero = (ast_t*) ast_new_constant(value_type, (value_t) { .as_int64 = 0 });
+    ast_t* expr = compound_expr(map_call("get_or", s, key, zero), value_type);
+
+    vec_append(block->nodes, map_call("set", s, key, expr));
+    block->base->type = value_type;
+
+    return (ast_t*) block;
+}
 
-    if (expr_type == MT_ARRAY)
+// m[k] is the value of the key, a missing key stops the program. m[k] = v
+// sets it and the compound assignments count a missing key as 0.
+ast_t* map_member(symbol_t* s)
+{
+    if (look.type == TK_ASSIGN)
+        panic("A map can not be assigned, only its keys.");
+
+    if (look.type != TK_L_BRACKET)
+        return (ast_t*) ast_new_variable(MT_MAP, s, NULL);
+
+    match(TK_L_BRACKET);
+    ast_t* key = expression();
+    match(TK_R_BRACKET);
+
+    if (look.type == TK_ASSIGN)
     {
-        s->extra.array.elmnt_type = ((ast_array_scalar_t*)expr)->elmnt_type;
-        s->extra.array.len = vec_size(((ast_array_scalar_t*)expr)->elmnts);
-        context_alloc_stack_addr(context, s->extra.array.len);
+        match(TK_ASSIGN);
+        return map_call("set", s, key, expression());
     }
 
-    if (!index_expr)
-        s->type = var_type;
+    if (look.type == TK_PLUS_ASSIGN || look.type == TK_MINUS_ASSIGN || look.type == TK_MUL_ASSIGN ||
+        look.type == TK_INC || look.type == TK_DEC)
+        return map_update(s, key);
 
-    return (ast_t*) ast_new_assign(MT_UNKNOWN, s, expr, index_expr, new_variable);
+    return map_call("get", s, key, NULL);
 }
 
 ast_t* var()
 {
     match(TK_VAR);
 
-    const char* id = peek_ident();
+    const char* id = peek_new_ident();
 
     match(TK_IDENT);
 
-    if (context_get(context, id, true) != NULL)
+    if (context_get(context, id, true) != NULL || struct_lookup(id) != NULL)
         panic("Identifier is already defined.");
 
+    if (struct_declared())
+        return struct_var(id, false);
+
     symbol_t* s = context_add(context, id, MT_UNKNOWN);
 
     if (look.type == TK_COLON)
     {
         match(TK_COLON);
+
+        type_t type = peek_data_type();
+
+        if (type == MT_MAP)
+            return map_decl(s);
+
+        if (type == MT_HEAP || type == MT_DEQUE)
+            return queue_decl(s, type);
+
+        if (peek_soa())
+            return sized_array(s, true);
+
         s->type = data_type();
+
+        if (s->type == MT_ARRAY && look.type == TK_L_BRACKET)
+            return sized_array(s, false);
     }
 
     if (look.type == TK_ASSIGN)
@@ -444,7 +1387,69 @@ ast_t* var()
     if (s->type == MT_UNKNOWN)
         panic("No type declared for the variable.");
 
-    return NULL;
+    // An array gets its elements and header when it is assigned
+    if (s->type == MT_ARRAY)
+        return NULL;
+
+    // The slot may be one a block that ended used, it starts out zeroed
+    // like a fresh one
+    return (ast_t*) ast_new_assign(MT_UNKNOWN, s, zero_value(s->type), NULL, true);
+}
+
+// The zero of a scalar type, the empty string is the one at offset 0
+ast_t* zero_value(type_t type)
+{
+    if (is_str_type(type))
+        return (ast_t*) ast_new_single_opcode(type, ICONST_0);
+
+    value_t zero = { .as_int64 = 0 };
+    return (ast_t*) ast_new_constant(type, zero);
+}
+
+ast_t* let()
+{
+    match(TK_LET);
+
+    const char* id = peek_new_ident();
+
+    match(TK_IDENT);
+
+    if (context_get(context, id, true) != NULL || struct_lookup(id) != NULL)
+        panic("Identifier is already defined.");
+
+    if (struct_declared())
+        return struct_var(id, true);
+
+    symbol_t* s = context_add(context, id, MT_UNKNOWN);
+
+    if (look.type == TK_COLON)
+    {
+        match(TK_COLON);
+        s->type = data_type();
+    }
+
+    if (look.type != TK_ASSIGN)
+        panic("An immutable variable needs a value.");
+
+    return immutable_value(s, (ast_assign_t*) assign(true, id, NULL));
+}
+
+// The rest of a let once its value is assigned
+ast_t* immutable_value(symbol_t* s, ast_assign_t* assign_ast)
+{
+    s->immutable = true;
+
+    if (assign_ast->base->kind == AST_ASSIGN && assign_ast->expr->base->kind == AST_CONSTANT && !is_array_type(s->type))
+    {
+        s->constant = true;
+        s->value = ((ast_constant_t*) assign_ast->expr)->value;
+
+        // Every use is replaced by the value
+        if (!is_str_type(s->type))
+            return NULL;
+    }
+
+    return (ast_t*) assign_ast;
 }
 
 ast_t* ident()
@@ -460,6 +1465,21 @@ ast_t* ident()
     if (s == NULL)
         panic("Identifier is not defined.");
 
+    if (s->type == MT_STRUCT)
+        return look.type == TK_ASSIGN ? struct_reassign(s, NULL) : struct_member(s);
+
+    if (s->type == MT_MAP)
+        return map_member(s);
+
+    if ((s->type == MT_HEAP || s->type == MT_DEQUE) && look.type == TK_ASSIGN)
+        panic("A heap or a deque can not be assigned.");
+
+    if (is_struct_array(s) && look.type == TK_L_BRACKET)
+    {
+        ast_t* index_expr = element_index();
+        return look.type == TK_ASSIGN ? struct_reassign(s, index_expr) : element_member(s, index_expr);
+    }
+
     type_t var_type = s->type;
 
     ast_t* index_expr = NULL;
@@ -474,7 +1494,16 @@ ast_t* ident()
     if (look.type == TK_ASSIGN)
         return assign(false, id, index_expr);
 
-    return (ast_t*) ast_new_variable(var_type, context_get(context, id, false), index_expr);
+    if (look.type == TK_PLUS_ASSIGN || look.type == TK_MINUS_ASSIGN || look.type == TK_MUL_ASSIGN ||
+        look.type == TK_INC || look.type == TK_DEC)
+        return compound_assign(s, var_type, index_expr);
+
+    // Strings are left to the data section, emitting them at every use
+    // would copy them each time
+    if (s->constant && !is_str_type(s->type))
+        return (ast_t*) ast_new_constant(s->type, s->value);
+
+    return (ast_t*) ast_new_variable(var_type, s, index_expr);
 }
 
 ast_t* block(block_t type, vector_t* params)
@@ -500,6 +1529,11 @@ ast_t* block(block_t type, vector_t* params)
 
     match(TK_R_BRACE);
 
+    // A loop body keeps its slots until the whole loop statement ends,
+    // the loop may still take hidden slots after parsing it
+    if (type != MB_LOOP)
+        context_close(new_context);
+
     context = new_context->parent;
 
     return (ast_t*) blck;
@@ -527,10 +1561,10 @@ ast_t* func_decl()
 {
     match(TK_FUNC);
 
-    const char* id = peek_ident();
+    const char* id = peek_new_ident();
     match(TK_IDENT);
 
-    if (context_get(context, id, false) != NULL)
+    if (context_get(context, id, false) != NULL || struct_lookup(id) != NULL)
         panic("Identifier is already defined.");
 
     symbol_t* s = context_add(context, id, MT_FUNC);
@@ -542,7 +1576,7 @@ ast_t* func_decl()
     while (look.type != TK_R_PAREN)
     {
         func_param_t* param = malloc(sizeof(func_param_t));
-        param->id = peek_ident();
+        param->id = peek_new_ident();
         match(TK_IDENT);
         match(TK_COLON);
         param->type = data_type();
@@ -559,6 +1593,7 @@ ast_t* func_decl()
     type_t ret_type = data_type();
 
     s->type = MT_FUNC;
+    s->extra.func.entry = jump_new();
     s->extra.func.ret_type = ret_type;
     
     s->extra.func.param_types = vec_new(0);
@@ -582,6 +1617,73 @@ ast_t* func_ret()
     return (ast_t*) ast_new_func_return(MT_UNKNOWN, expression());
 }
 
+// Arrays are passed to builtins by reference, so they have to be named
+// variables. Returns the return type of the call.
+type_t array_builtin_args(const builtin_func_t* builtin, symbol_t* array, vector_t* args)
+{
+    type_t elmnt_type = array->extra.array.elmnt_type;
+
+    for (size_t i = 0; i < vec_size(args); i++)
+    {
+        ast_t* arg = vec_get(args, i);
+
+        if (is_array_type(arg->base->type) && ast_array_symbol(arg) == NULL)
+            panic("Array argument must be an array variable.");
+
+        // Its elements are fields, only its length makes sense
+        if (ast_array_symbol(arg) != NULL && ast_array_symbol(arg)->extra.array.strct != NULL &&
+            builtin->opcode != ALEN)
+            panic("Builtin function does not accept an array of structs.");
+    }
+
+    type_t ret_type = builtin_array_ret_type(builtin, elmnt_type);
+
+    if (ret_type == MT_UNKNOWN)
+        panic("Builtin function does not accept this array element type.");
+
+    if (array->immutable && (builtin->opcode == ASORT || builtin->opcode == ASORTD || builtin->opcode == ACOPY ||
+        builtin->opcode == AFILL || builtin->opcode == ASLICE_COPY))
+        panic("Cannot modify an immutable array.");
+
+    if (builtin->opcode == ADOT || builtin->opcode == ACOPY || builtin->opcode == AEQ ||
+        builtin->opcode == ASLICE_COPY)
+    {
+        size_t other_index = builtin->opcode == ASLICE_COPY ? 2 : 1;
+        symbol_t* other = ast_array_symbol(vec_get(args, other_index));
+
+        if (other == NULL || other->extra.array.elmnt_type != elmnt_type)
+            panic("Both arrays must have the same element type.");
+
+        if ((builtin->opcode == ADOT || builtin->opcode == ACOPY) && other->extra.array.len != array->extra.array.len)
+            panic("Both arrays must have the same length.");
+    }
+    else if (builtin->opcode == ACOUNT)
+    {
+        type_t value_type = ((ast_t*) vec_get(args, 1))->base->type;
+
+        if (is_real_type(value_type) != is_real_type(elmnt_type))
+            panic("Value type does not match the array element type.");
+    }
+    else if (builtin->opcode == AFILL)
+    {
+        type_t value_type = ((ast_t*) vec_get(args, 1))->base->type;
+
+        if (value_type != elmnt_type && !can_implicitly_cast_integer(value_type, elmnt_type))
+            panic("Value type does not match the array element type.");
+    }
+
+    if (builtin->opcode == ASLICE_COPY)
+    {
+        for (size_t i = 1; i < vec_size(args); i++)
+        {
+            if (i != 2 && !is_integer_type(((ast_t*) vec_get(args, i))->base->type))
+                panic("Array slice positions must be integers.");
+        }
+    }
+
+    return ret_type;
+}
+
 ast_t* builting_func_call(const builtin_func_t* builtin)
 {
     match(TK_L_PAREN);
@@ -612,20 +1714,55 @@ ast_t* builting_func_call(const builtin_func_t* builtin)
         panic("Builtin function argument count mismatch.");
     }
 
-    return (ast_t*) ast_new_builtin_call(builtin->ret_type, builtin->name, args);
+    type_t ret_type = builtin->ret_type;
+
+    symbol_t* array = vec_size(args) > 0 ? ast_array_symbol(vec_first(args)) : NULL;
+
+    if (array != NULL)
+    {
+        ret_type = array_builtin_args(builtin, array, args);
+    }
+
+    ast_t* first = vec_size(args) > 0 ? vec_first(args) : NULL;
+
+    if (first != NULL && first->base->type == MT_MAP && first->base->kind == AST_VARIABLE)
+        return (ast_t*) ast_new_builtin_call(map_builtin_args(builtin, ((ast_variable_t*) first)->symbol, args),
+            builtin->name, args);
+
+    if (first != NULL && (first->base->type == MT_HEAP || first->base->type == MT_DEQUE) &&
+        first->base->kind == AST_VARIABLE)
+        return (ast_t*) ast_new_builtin_call(queue_builtin_args(builtin, ((ast_variable_t*) first)->symbol, args),
+            builtin->name, args);
+
+    if (builtin_map_ret_type(builtin, MT_INT64) != MT_UNKNOWN)
+        panic("The first argument must be a map.");
+
+    if (builtin_queue_ret_type(builtin, MT_INT64) != MT_UNKNOWN)
+        panic("The first argument must be a heap or a deque.");
+
+    ast_t* call = fold((ast_t*) ast_new_builtin_call(ret_type, builtin->name, args));
+
+    // The length of an array of structs counts the structs, an soa array
+    // has the length of its first column
+    if (array != NULL && array->extra.array.strct != NULL && array->extra.array.columns == NULL &&
+        vec_size(array->extra.array.strct->fields) > 1)
+        return index_op(TK_DIV, call, vec_size(array->extra.array.strct->fields));
+
+    return call;
 }
 
 ast_t* func_call(const char* id)
 {
+    symbol_t* s = context_get(context, id, false);
+
+    // A function declared by the user shadows the builtin of the same name
     const builtin_func_t* builtin = builtin_lookup(id);
 
-    if (builtin != NULL)
+    if (builtin != NULL && (s == NULL || s->type != MT_FUNC))
     {
         return builting_func_call(builtin);
     }
 
-    symbol_t* s = context_get(context, id, false);
-
     if (s == NULL)
         panic("Identifier is not defined.");
 
@@ -676,6 +1813,86 @@ ast_t* func_call(const char* id)
     return (ast_t*) ast_new_func_call(s->extra.func.ret_type, s, args);
 }
 
+// for i in from..to [step n] { }, for x in array { } or for k in map { }
+ast_t* for_in_loop()
+{
+    const char* id = peek_new_ident();
+
+    match(TK_IDENT);
+    match(TK_IN);
+
+    ast_t* from = expression();
+    ast_t* to = NULL;
+    symbol_t* array = NULL;
+    symbol_t* map = NULL;
+    int16_t step = 1;
+    type_t var_type;
+
+    if (look.type == TK_DOTDOT)
+    {
+        match(TK_DOTDOT);
+        to = expression();
+
+        if (!is_integer_type(from->base->type) || !is_integer_type(to->base->type))
+            panic("Range bounds must be integers.");
+
+        var_type = mix_integer_types(from->base->type, to->base->type);
+
+        if (look.type == TK_STEP)
+        {
+            match(TK_STEP);
+
+            ast_t* step_expr = expression();
+            int64_t value;
+
+            if (step_expr->base->kind == AST_CONSTANT && is_integer_type(step_expr->base->type))
+                value = ((ast_constant_t*) step_expr)->value.as_int64;
+            else if (step_expr->base->kind == AST_UNARY && ((ast_unary_t*) step_expr)->op == TK_MINUS &&
+                ((ast_unary_t*) step_expr)->expr->base->kind == AST_CONSTANT &&
+                is_integer_type(step_expr->base->type))
+                value = -((ast_constant_t*) ((ast_unary_t*) step_expr)->expr)->value.as_int64;
+            else
+                panic("Loop step must be an integer constant.");
+
+            if (value == 0 || value < INT16_MIN || value > INT16_MAX)
+                panic("Loop step is out of range.");
+
+            step = value;
+        }
+    }
+    else if (from->base->type == MT_MAP)
+    {
+        map = ((ast_variable_t*) from)->symbol;
+        var_type = map->extra.map.key_type;
+    }
+    else
+    {
+        array = ast_array_symbol(from);
+
+        if (array == NULL)
+            panic("Only ranges, array and map variables can be iterated.");
+
+        if (array->extra.array.strct != NULL)
+            panic("An array of structs can not be iterated.");
+
+        var_type = array->extra.array.elmnt_type;
+    }
+
+    if (context_get(context, id, true) != NULL)
+        panic("Identifier is already defined.");
+
+    symbol_t* s = context_add(context, id, var_type);
+    uint16_t index_addr = array != NULL || map != NULL ? context_alloc_stack_addr(context, 1) : s->addr_on_stack;
+    uint16_t limit_addr = context_alloc_stack_addr(context, 1);
+
+    ast_t* for_in = (ast_t*) ast_new_for_in(MT_UNKNOWN, s, from, to, step, array, map, index_addr, limit_addr, block(MB_LOOP, NULL));
+    if (opt_level > 0)
+        licm_hoist(for_in, context);
+    unroll_plan(for_in, context, opt_level);
+
+    return for_in;
+}
+
 ast_t* for_loop()
 {
     context_t* new_context = context_new(context, MB_NORMAL);
@@ -684,6 +1901,14 @@ ast_t* for_loop()
 
     match(TK_FOR);
 
+    if (look.type == TK_IDENT && peek_ahead().type == TK_IN)
+    {
+        ast_t* for_in = for_in_loop();
+        context_close(new_context);
+        context = new_context->parent;
+        return for_in;
+    }
+
     ast_t* init = NULL;
     ast_t* condition = NULL;
     ast_t* post = NULL;
@@ -693,7 +1918,7 @@ ast_t* for_loop()
         switch (look.type) {
             case TK_VAR: init = var(); break;
             case TK_SEMICOLON: init = NULL; break;
-            default: init = expression(); break;
+            default: init = expr_statement(); break;
         }
 
         match(TK_SEMICOLON);
@@ -707,12 +1932,16 @@ ast_t* for_loop()
         
         switch (look.type) {
             case TK_L_BRACE: post = NULL; break;
-            default: post = expression(); break;
+            default: post = expr_statement(); break;
         }
     }
 
     ast_block_t* for_block = (ast_block_t*) ast_new_for_loop(MT_UNKNOWN, init, condition, post, block(MB_LOOP, NULL));
+    if (opt_level > 0)
+        licm_hoist((ast_t*) for_block, context);
+    unroll_plan((ast_t*) for_block, context, opt_level);
 
+    context_close(new_context);
     context = new_context->parent;
 
     return (ast_t*) for_block;
@@ -801,6 +2030,8 @@ ast_t* statement(bool_t* free_expr)
         return semicolon();
     case TK_VAR:
         return var();
+    case TK_LET:
+        return let();
     case TK_IF:
         return if_cond();
     case TK_FOR:
@@ -811,13 +2042,15 @@ ast_t* statement(bool_t* free_expr)
         return continue_loop();
     case TK_FUNC:
         return func_decl();
+    case TK_STRUCT:
+        return struct_decl();
     case TK_RETURN:
         return func_ret();
     case TK_L_BRACE:
         return block(MB_NORMAL, NULL);
     default:
         if(free_expr) *free_expr = true;
-        return expression();
+        return expr_statement();
     }
 
     return NULL;
@@ -841,6 +2074,7 @@ void parser_init()
     look.type = TK_BAD;
     look.col = 0;
     look.row = 0;
+    has_ahead = false;
     look = lexer_next();
     context = global_context;
 }
@@ -867,8 +2101,48 @@ void parser_parse()
     ast_block_t* block = ast_new_block(MT_UNKNOWN, global_context);
 
     statements(block, TK_FIN);
+    context_close(global_context);
+
+    dce_prune((ast_t*) block);
 
     eval((ast_t*) block);
 
     EMIT(HALT);
+
+    // Only functions reachable from the main body are emitted, packed
+    // together after it
+    vector_t* funcs = dce_reachable_funcs((ast_t*) block);
+
+    for (size_t i = 0; i < vec_size(funcs); i++)
+        ast_emit_func(vec_get(funcs, i));
+
+    for (size_t i = 0; i < vec_size(funcs); i++)
+    {
+        jump_t* entry = ((ast_func_decl_t*) vec_get(funcs, i))->symbol->extra.func.entry;
+        JUMP_FIX(entry);
+    }
+
+    vec_free(funcs);
+
+    if (opt_level > 0)
+    {
+        ir_optimize();
+        peephole_optimize();
+    }
+
+    if (profile != NULL)
+        layout_optimize(profile);
+}
+
+// 0 turns the optimizer off, 1 runs it and fully unrolls loops with a small
+// known trip count, 2 also partially unrolls loops with straight-line bodies
+void parser_set_opt_level(uint8_t level)
+{
+    opt_level = level;
+}
+
+// Branch and call counts of a run of this very code, to lay it out by
+void parser_set_profile(profile_t* prof)
+{
+    profile = prof;
 }
@@ -2,6 +2,7 @@
 #define PARSER_H
 
 #include "types.h"
+#include "profile.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -12,6 +13,8 @@ void parser_load_file(const char* filename);
 void parser_load_stdin();
 void parser_free();
 void parser_parse();
+void parser_set_opt_level(uint8_t level);
+void parser_set_profile(profile_t* profile);
 
 #ifdef __cplusplus
 }
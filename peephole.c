@@ -0,0 +1,350 @@
+#include "peephole.h"
+#include "types.h"
+#include "vm.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The emitted code is decoded into instructions, rewritten in place by a
+// few local patterns until nothing changes, and laid out again. Branches
+// refer to instructions by index while rewriting, so removing code never
+// breaks them: a branch to a removed instruction lands on the next live
+// one, exactly where the old address led once the code is compacted.
+
+typedef struct
+{
+    uint8_t op;
+    uint8_t size;       // operand bytes
+    uint8_t args[16];
+    size_t target;      // branch target as an instruction index
+    bool_t label;       // a live branch lands here
+    bool_t dead;
+    size_t addr;
+} insn_t;
+
+static insn_t* insns;
+static size_t count;    // insns[count] is the end of the code
+
+static bool_t is_branch(uint8_t op)
+{
+    return op == JMP || op == JEZ || op == JNZ || op == CALL || op == FORI || op == FORNEXT;
+}
+
+// Pushes one value without any other effect
+static bool_t is_pure_push(uint8_t op)
+{
+    switch (op)
+    {
+        case DUP:
+        case ALLC:
+        case XLOAD:
+        case XCONST:
+        case AREF:
+        case ICONST_0:
+        case ICONST_1:
+        case I8CONST:
+        case I16CONST:
+        case I32CONST:
+        case I64CONST:
+        case RCONST:
+        case RCONST_0:
+        case RCONST_1:
+        case RCONST_PI:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static uint16_t operand(insn_t* insn)
+{
+    return insn->args[0] | (insn->args[1] << 8);
+}
+
+static bool_t int_constant(insn_t* insn, int64_t* value)
+{
+    switch (insn->op)
+    {
+        case ICONST_0: *value = 0; return true;
+        case ICONST_1: *value = 1; return true;
+        case I8CONST: *value = (int8_t) insn->args[0]; return true;
+        case I16CONST: *value = (int16_t) (insn->args[0] | (insn->args[1] << 8)); return true;
+        case I32CONST:
+            *value = (int32_t) (insn->args[0] | (insn->args[1] << 8) | (insn->args[2] << 16) | ((uint32_t) insn->args[3] << 24));
+            return true;
+        default:
+            return false;
+    }
+}
+
+static size_t next_live(size_t i)
+{
+    while (i < count && insns[i].dead)
+        i++;
+    return i;
+}
+
+static void decode()
+{
+    uint8_t* code = vm_code_ptr();
+    size_t size = vm_code_addr();
+
+    insns = malloc(sizeof (insn_t) * (size + 1));
+    count = 0;
+
+    // Instruction index of every address, to resolve the branch targets
+    size_t* index = malloc(sizeof (size_t) * (size + 1));
+
+    for (size_t ip = 0; ip < size; count++)
+    {
+        insn_t* insn = &insns[count];
+        insn->op = code[ip];
+        insn->size = OPCODES[insn->op].arg_size;
+        insn->dead = false;
+        insn->addr = ip;
+        memcpy(insn->args, code + ip + 1, insn->size);
+        index[ip] = count;
+        ip += 1 + insn->size;
+    }
+
+    insns[count].op = HALT;
+    insns[count].size = 0;
+    insns[count].dead = false;
+    index[size] = count;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (is_branch(insns[i].op))
+            insns[i].target = index[operand(&insns[i])];
+    }
+
+    free(index);
+}
+
+static void mark_labels()
+{
+    for (size_t i = 0; i <= count; i++)
+        insns[i].label = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!insns[i].dead && is_branch(insns[i].op))
+        {
+            insns[i].target = next_live(insns[i].target);
+            insns[insns[i].target].label = true;
+        }
+    }
+}
+
+static void set_op(insn_t* insn, uint8_t op)
+{
+    insn->op = op;
+    insn->size = OPCODES[op].arg_size;
+}
+
+// Branches to a removed instruction fall through to the next live one
+static void kill(insn_t* insn)
+{
+    insn->dead = true;
+    if (insn->label)
+        insns[next_live(insn - insns)].label = true;
+}
+
+// Final target of a chain of jumps, or the target itself if the chain
+// is too long or loops
+static size_t thread(size_t target)
+{
+    size_t t = target;
+
+    for (int hops = 0; hops < 16; hops++)
+    {
+        if (insns[t].op != JMP || t == count)
+            return t;
+        t = next_live(insns[t].target);
+    }
+
+    return target;
+}
+
+static bool_t rewrite(size_t i)
+{
+    insn_t* a = &insns[i];
+    size_t j = next_live(i + 1);
+    insn_t* b = &insns[j];
+    bool_t last = j == count;
+
+    // Code after an unconditional transfer is unreachable until a label
+    if (a->op == JMP || a->op == RET || a->op == HALT)
+    {
+        bool_t changed = false;
+        for (; j < count && !insns[j].label; j = next_live(j + 1))
+        {
+            kill(&insns[j]);
+            changed = true;
+        }
+        if (changed)
+            return true;
+    }
+
+    if (is_branch(a->op) && a->op != CALL)
+    {
+        a->target = next_live(a->target);
+
+        // Jumps to jumps go straight to the final target
+        size_t final = thread(a->target);
+        if (final != a->target)
+        {
+            a->target = final;
+            insns[final].label = true;
+            return true;
+        }
+
+        insn_t* t = &insns[a->target];
+
+        if (a->op == JMP && (t->op == RET || t->op == HALT) && a->target != count)
+        {
+            set_op(a, t->op);
+            return true;
+        }
+
+        if (a->target == j && (a->op == JMP || a->op == JEZ || a->op == JNZ))
+        {
+            // A conditional branch to the next instruction still pops
+            if (a->op == JMP)
+                kill(a);
+            else
+                set_op(a, DROP);
+            return true;
+        }
+    }
+
+    if (last || b->label)
+        return false;
+
+    // XLOAD s; c; IADD|ISUB; XSTORE s, or c; XLOAD s; IADD; XSTORE s
+    // update the slot in place
+    size_t k = next_live(j + 1);
+    size_t l = next_live(k + 1);
+    insn_t* c = &insns[k];
+    insn_t* d = &insns[l];
+    int64_t addend;
+
+    if (l < count && !c->label && !d->label && d->op == XSTORE && (c->op == IADD || c->op == ISUB) &&
+        ((a->op == XLOAD && operand(a) == operand(d) && int_constant(b, &addend)) ||
+        (c->op == IADD && b->op == XLOAD && operand(b) == operand(d) && int_constant(a, &addend))))
+    {
+        if (c->op == ISUB)
+            addend = -addend;
+
+        if (addend >= INT32_MIN && addend <= INT32_MAX)
+        {
+            uint8_t args[6] = {d->args[0], d->args[1], addend & 0xFF, (addend >> 8) & 0xFF,
+                (addend >> 16) & 0xFF, (addend >> 24) & 0xFF};
+            set_op(a, addend == 1 ? XINC : addend == -1 ? XDEC : XADDI);
+            memcpy(a->args, args, a->size);
+            kill(b);
+            kill(c);
+            kill(d);
+            return true;
+        }
+    }
+
+    // print and assignments leave a slot only for the statement to drop it
+    if (is_pure_push(a->op) && b->op == DROP)
+    {
+        kill(a);
+        kill(b);
+        return true;
+    }
+
+    if (a->op == XSTORE && b->op == XLOAD && operand(a) == operand(b))
+    {
+        uint8_t args[2] = {a->args[0], a->args[1]};
+        set_op(a, DUP);
+        set_op(b, XSTORE);
+        memcpy(b->args, args, 2);
+        return true;
+    }
+
+    // Branch over a jump: JEZ L; JMP M; L: becomes JNZ M
+    if ((a->op == JEZ || a->op == JNZ) && b->op == JMP && next_live(a->target) == next_live(j + 1))
+    {
+        set_op(a, a->op == JEZ ? JNZ : JEZ);
+        a->target = b->target;
+        insns[a->target].label = true;
+        kill(b);
+        return true;
+    }
+
+    // Branches on constant conditions
+    if ((a->op == ICONST_0 || a->op == ICONST_1) && (b->op == JEZ || b->op == JNZ))
+    {
+        bool_t taken = (a->op == ICONST_0) == (b->op == JEZ);
+        kill(a);
+        if (taken)
+            set_op(b, JMP);
+        else
+            kill(b);
+        return true;
+    }
+
+    return false;
+}
+
+static void layout()
+{
+    size_t addr = 0;
+
+    for (size_t i = 0; i <= count; i++)
+    {
+        insns[i].addr = addr;
+        if (!insns[i].dead && i < count)
+            addr += 1 + insns[i].size;
+    }
+
+    uint8_t* code = malloc(addr + 1);
+    size_t ip = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        insn_t* insn = &insns[i];
+
+        if (insn->dead)
+            continue;
+
+        if (is_branch(insn->op))
+        {
+            uint16_t target = insns[next_live(insn->target)].addr;
+            insn->args[0] = target & 0xFF;
+            insn->args[1] = (target >> 8) & 0xFF;
+        }
+
+        code[ip] = insn->op;
+        memcpy(code + ip + 1, insn->args, insn->size);
+        ip += 1 + insn->size;
+    }
+
+    vm_code_replace(code, ip);
+    free(code);
+}
+
+void peephole_optimize()
+{
+    decode();
+
+    bool_t changed = true;
+    while (changed)
+    {
+        changed = false;
+        mark_labels();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!insns[i].dead && rewrite(i))
+                changed = true;
+        }
+    }
+
+    layout();
+    free(insns);
+}
@@ -0,0 +1,15 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void peephole_optimize();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PEEPHOLE_H */
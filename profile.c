@@ -0,0 +1,117 @@
+#include "profile.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The file is text, one counter per line after the header:
+//
+//   lime-profile <code size> <checksum>
+//   branch <addr> <taken> <not taken>
+//   call <addr> <calls>
+//
+// Counters are kept for every address a 16 bit operand can reach, code
+// appended while running (see tier.c) is counted but not saved.
+
+#define PROFILE_ADDRS (UINT16_MAX + 1)
+
+// FNV-1a
+uint32_t profile_checksum(uint8_t* code, size_t size)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= code[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+profile_t* profile_new(uint8_t* code, size_t size)
+{
+    profile_t* profile = malloc(sizeof (profile_t));
+    profile->size = size;
+    profile->checksum = profile_checksum(code, size);
+    profile->taken = calloc(PROFILE_ADDRS, sizeof (uint64_t));
+    profile->not_taken = calloc(PROFILE_ADDRS, sizeof (uint64_t));
+    profile->calls = calloc(PROFILE_ADDRS, sizeof (uint64_t));
+    return profile;
+}
+
+void profile_free(profile_t* profile)
+{
+    free(profile->taken);
+    free(profile->not_taken);
+    free(profile->calls);
+    free(profile);
+}
+
+void profile_save(profile_t* profile, const char* name)
+{
+    FILE* file = fopen(name, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Cannot open file '%s' for writing\n", name);
+        return;
+    }
+
+    fprintf(file, "lime-profile %zu %08" PRIx32 "\n", profile->size, profile->checksum);
+
+    for (size_t addr = 0; addr < profile->size && addr < PROFILE_ADDRS; addr++)
+    {
+        if (profile->taken[addr] != 0 || profile->not_taken[addr] != 0)
+            fprintf(file, "branch %zu %" PRIu64 " %" PRIu64 "\n", addr, profile->taken[addr], profile->not_taken[addr]);
+        if (profile->calls[addr] != 0)
+            fprintf(file, "call %zu %" PRIu64 "\n", addr, profile->calls[addr]);
+    }
+
+    fclose(file);
+}
+
+profile_t* profile_load(const char* name)
+{
+    FILE* file = fopen(name, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: Cannot open file '%s' for reading\n", name);
+        return NULL;
+    }
+
+    size_t size;
+    uint32_t checksum;
+    if (fscanf(file, "lime-profile %zu %" SCNx32, &size, &checksum) != 2)
+    {
+        fprintf(stderr, "Error: Invalid profile file '%s'\n", name);
+        fclose(file);
+        return NULL;
+    }
+
+    profile_t* profile = malloc(sizeof (profile_t));
+    profile->size = size;
+    profile->checksum = checksum;
+    profile->taken = calloc(PROFILE_ADDRS, sizeof (uint64_t));
+    profile->not_taken = calloc(PROFILE_ADDRS, sizeof (uint64_t));
+    profile->calls = calloc(PROFILE_ADDRS, sizeof (uint64_t));
+
+    char kind[8];
+    size_t addr;
+    uint64_t a, b;
+
+    while (fscanf(file, "%7s %zu %" SCNu64, kind, &addr, &a) == 3 && addr < PROFILE_ADDRS)
+    {
+        if (strcmp(kind, "branch") == 0 && fscanf(file, "%" SCNu64, &b) == 1)
+        {
+            profile->taken[addr] = a;
+            profile->not_taken[addr] = b;
+        }
+        else if (strcmp(kind, "call") == 0)
+            profile->calls[addr] = a;
+        else
+            break;
+    }
+
+    fclose(file);
+    return profile;
+}
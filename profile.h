@@ -0,0 +1,35 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Execution counts by code address, of the code with the given size and
+// checksum: taken and not taken for every JEZ and JNZ, calls for every
+// function entry
+typedef struct
+{
+    size_t size;
+    uint32_t checksum;
+    uint64_t* taken;
+    uint64_t* not_taken;
+    uint64_t* calls;
+} profile_t;
+
+uint32_t profile_checksum(uint8_t* code, size_t size);
+profile_t* profile_new(uint8_t* code, size_t size);
+void profile_free(profile_t* profile);
+void profile_save(profile_t* profile, const char* name);
+profile_t* profile_load(const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROFILE_H */
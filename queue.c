@@ -0,0 +1,167 @@
+#include "queue.h"
+#include "types.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// Both containers keep their elements in one growing block of slots. The
+// heap orders its elements by their type, integers narrower than 64 bits
+// are extended from their low bits when pushed. Popping an empty
+// container is left to the caller to rule out.
+
+#define QUEUE_MIN_CAPACITY 8
+
+static bool_t less(type_t type, value_t a, value_t b)
+{
+    if (is_real_type(type))
+        return a.as_real < b.as_real;
+    if (is_unsigned_integer_type(type))
+        return a.as_uint64 < b.as_uint64;
+    return a.as_int64 < b.as_int64;
+}
+
+heap_t* heap_new(type_t type)
+{
+    heap_t* heap = malloc(sizeof (heap_t));
+    heap->elmnts = NULL;
+    heap->len = 0;
+    heap->capacity = 0;
+    heap->type = type;
+    return heap;
+}
+
+void heap_free(heap_t* heap)
+{
+    free(heap->elmnts);
+    free(heap);
+}
+
+void heap_clear(heap_t* heap, type_t type)
+{
+    heap->len = 0;
+    heap->type = type;
+}
+
+void heap_push(heap_t* heap, value_t value)
+{
+    if (heap->len == heap->capacity)
+    {
+        heap->capacity = heap->capacity > 0 ? heap->capacity * 2 : QUEUE_MIN_CAPACITY;
+        heap->elmnts = realloc(heap->elmnts, sizeof (value_t) * heap->capacity);
+    }
+
+    value = value_extend(heap->type, value);
+
+    size_t i = heap->len++;
+    for (; i > 0 && less(heap->type, value, heap->elmnts[(i - 1) / 2]); i = (i - 1) / 2)
+        heap->elmnts[i] = heap->elmnts[(i - 1) / 2];
+    heap->elmnts[i] = value;
+}
+
+// The least element, the last one sifts down from the root in its place
+value_t heap_pop(heap_t* heap)
+{
+    value_t* a = heap->elmnts;
+    value_t top = a[0];
+    value_t last = a[--heap->len];
+    size_t n = heap->len;
+    size_t i = 0;
+    size_t child;
+
+    while ((child = 2 * i + 1) < n)
+    {
+        if (child + 1 < n && less(heap->type, a[child + 1], a[child]))
+            child++;
+        if (!less(heap->type, a[child], last))
+            break;
+        a[i] = a[child];
+        i = child;
+    }
+
+    if (n > 0)
+        a[i] = last;
+    return top;
+}
+
+deque_t* deque_new()
+{
+    deque_t* deque = malloc(sizeof (deque_t));
+    deque->elmnts = NULL;
+    deque->head = 0;
+    deque->len = 0;
+    deque->capacity = 0;
+    return deque;
+}
+
+void deque_free(deque_t* deque)
+{
+    free(deque->elmnts);
+    free(deque);
+}
+
+void deque_clear(deque_t* deque)
+{
+    deque->head = 0;
+    deque->len = 0;
+}
+
+static value_t* deque_at(deque_t* deque, size_t i)
+{
+    return &deque->elmnts[(deque->head + i) & (deque->capacity - 1)];
+}
+
+// Doubles the buffer, the elements move to its start in order
+static void deque_grow(deque_t* deque)
+{
+    size_t capacity = deque->capacity > 0 ? deque->capacity * 2 : QUEUE_MIN_CAPACITY;
+    value_t* elmnts = malloc(sizeof (value_t) * capacity);
+
+    for (size_t i = 0; i < deque->len; i++)
+        elmnts[i] = *deque_at(deque, i);
+
+    free(deque->elmnts);
+    deque->elmnts = elmnts;
+    deque->capacity = capacity;
+    deque->head = 0;
+}
+
+void deque_push_back(deque_t* deque, value_t value)
+{
+    if (deque->len == deque->capacity)
+        deque_grow(deque);
+
+    *deque_at(deque, deque->len++) = value;
+}
+
+void deque_push_front(deque_t* deque, value_t value)
+{
+    if (deque->len == deque->capacity)
+        deque_grow(deque);
+
+    deque->head = (deque->head - 1) & (deque->capacity - 1);
+    deque->len++;
+    deque->elmnts[deque->head] = value;
+}
+
+value_t deque_pop_back(deque_t* deque)
+{
+    return *deque_at(deque, --deque->len);
+}
+
+value_t deque_pop_front(deque_t* deque)
+{
+    value_t value = deque->elmnts[deque->head];
+
+    deque->head = (deque->head + 1) & (deque->capacity - 1);
+    deque->len--;
+    return value;
+}
+
+value_t deque_front(deque_t* deque)
+{
+    return deque->elmnts[deque->head];
+}
+
+value_t deque_back(deque_t* deque)
+{
+    return *deque_at(deque, deque->len - 1);
+}
@@ -0,0 +1,49 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// A binary min heap, the least element at elmnts[0]
+typedef struct
+{
+    value_t* elmnts;
+    size_t len;
+    size_t capacity;
+    type_t type;
+} heap_t;
+
+// A ring buffer, its elements start at elmnts[head] and wrap around
+typedef struct
+{
+    value_t* elmnts;
+    size_t head;
+    size_t len;
+    size_t capacity;    // a power of two, or 0 before the first push
+} deque_t;
+
+heap_t* heap_new(type_t type);
+void heap_free(heap_t* heap);
+void heap_clear(heap_t* heap, type_t type);
+void heap_push(heap_t* heap, value_t value);
+value_t heap_pop(heap_t* heap);
+
+deque_t* deque_new();
+void deque_free(deque_t* deque);
+void deque_clear(deque_t* deque);
+void deque_push_back(deque_t* deque, value_t value);
+void deque_push_front(deque_t* deque, value_t value);
+value_t deque_pop_back(deque_t* deque);
+value_t deque_pop_front(deque_t* deque);
+value_t deque_front(deque_t* deque);
+value_t deque_back(deque_t* deque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUEUE_H */
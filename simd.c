@@ -0,0 +1,840 @@
+#include "simd.h"
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+// Kernels for the element types worth vectorizing, everything else goes
+// through the generic scalar loops at the bottom of this file
+typedef struct
+{
+    const char* name;
+    int64_t (*sum_i32)(const int32_t* p, size_t len);
+    uint64_t (*sum_i64)(const uint64_t* p, size_t len);
+    uint64_t (*sum_u8)(const uint8_t* p, size_t len);
+    real_t (*sum_real)(const real_t* p, size_t len);
+    int32_t (*min_i32)(const int32_t* p, size_t len);
+    int32_t (*max_i32)(const int32_t* p, size_t len);
+    real_t (*min_real)(const real_t* p, size_t len);
+    real_t (*max_real)(const real_t* p, size_t len);
+    int64_t (*dot_i32)(const int32_t* a, const int32_t* b, size_t len);
+    real_t (*dot_real)(const real_t* a, const real_t* b, size_t len);
+    size_t (*count_u8)(const uint8_t* p, size_t len, uint8_t v);
+    size_t (*count_i32)(const int32_t* p, size_t len, int32_t v);
+    size_t (*count_real)(const real_t* p, size_t len, real_t v);
+} simd_kernels_t;
+
+// Scalar
+
+static int64_t scalar_sum_i32(const int32_t* p, size_t len)
+{
+    int64_t s = 0;
+    for (size_t i = 0; i < len; i++)
+        s += p[i];
+    return s;
+}
+
+static uint64_t scalar_sum_i64(const uint64_t* p, size_t len)
+{
+    uint64_t s = 0;
+    for (size_t i = 0; i < len; i++)
+        s += p[i];
+    return s;
+}
+
+static uint64_t scalar_sum_u8(const uint8_t* p, size_t len)
+{
+    uint64_t s = 0;
+    for (size_t i = 0; i < len; i++)
+        s += p[i];
+    return s;
+}
+
+static real_t scalar_sum_real(const real_t* p, size_t len)
+{
+    real_t s = 0.0;
+    for (size_t i = 0; i < len; i++)
+        s += p[i];
+    return s;
+}
+
+static int32_t scalar_min_i32(const int32_t* p, size_t len)
+{
+    int32_t m = p[0];
+    for (size_t i = 1; i < len; i++)
+        m = p[i] < m ? p[i] : m;
+    return m;
+}
+
+static int32_t scalar_max_i32(const int32_t* p, size_t len)
+{
+    int32_t m = p[0];
+    for (size_t i = 1; i < len; i++)
+        m = p[i] > m ? p[i] : m;
+    return m;
+}
+
+// NaN elements never win a comparison, so they are skipped. An array of
+// NaNs only yields +inf for min and -inf for max.
+static real_t scalar_min_real(const real_t* p, size_t len)
+{
+    real_t m = INFINITY;
+    for (size_t i = 0; i < len; i++)
+        m = p[i] < m ? p[i] : m;
+    return m;
+}
+
+static real_t scalar_max_real(const real_t* p, size_t len)
+{
+    real_t m = -INFINITY;
+    for (size_t i = 0; i < len; i++)
+        m = p[i] > m ? p[i] : m;
+    return m;
+}
+
+static int64_t scalar_dot_i32(const int32_t* a, const int32_t* b, size_t len)
+{
+    int64_t s = 0;
+    for (size_t i = 0; i < len; i++)
+        s += (int64_t) a[i] * b[i];
+    return s;
+}
+
+static real_t scalar_dot_real(const real_t* a, const real_t* b, size_t len)
+{
+    real_t s = 0.0;
+    for (size_t i = 0; i < len; i++)
+        s += a[i] * b[i];
+    return s;
+}
+
+static size_t scalar_count_u8(const uint8_t* p, size_t len, uint8_t v)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+        n += p[i] == v;
+    return n;
+}
+
+static size_t scalar_count_i32(const int32_t* p, size_t len, int32_t v)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+        n += p[i] == v;
+    return n;
+}
+
+static size_t scalar_count_real(const real_t* p, size_t len, real_t v)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+        n += p[i] == v;
+    return n;
+}
+
+static const simd_kernels_t SCALAR_KERNELS = {
+    "scalar",
+    scalar_sum_i32,
+    scalar_sum_i64,
+    scalar_sum_u8,
+    scalar_sum_real,
+    scalar_min_i32,
+    scalar_max_i32,
+    scalar_min_real,
+    scalar_max_real,
+    scalar_dot_i32,
+    scalar_dot_real,
+    scalar_count_u8,
+    scalar_count_i32,
+    scalar_count_real,
+};
+
+#ifdef SIMD_X86
+
+// SSE2
+
+__attribute__((target("sse2")))
+static int64_t sse2_sum_i32(const int32_t* p, size_t len)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+        __m128i sign = _mm_srai_epi32(v, 31);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+    }
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, acc);
+    return lanes[0] + lanes[1] + scalar_sum_i32(p + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse2_sum_i64(const uint64_t* p, size_t len)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 2 <= len; i += 2)
+        acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i*) (p + i)));
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, acc);
+    return lanes[0] + lanes[1] + scalar_sum_i64(p + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse2_sum_u8(const uint8_t* p, size_t len)
+{
+    __m128i acc = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*) (p + i)), zero));
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, acc);
+    return lanes[0] + lanes[1] + scalar_sum_u8(p + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static real_t sse2_sum_real(const real_t* p, size_t len)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(p + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(p + i + 2));
+    }
+
+    real_t lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + scalar_sum_real(p + i, len - i);
+}
+
+// SSE2 has no pminsd/pmaxsd, select through a compare mask instead
+__attribute__((target("sse2")))
+static int32_t sse2_min_i32(const int32_t* p, size_t len)
+{
+    if (len < 4)
+        return scalar_min_i32(p, len);
+
+    __m128i m = _mm_loadu_si128((const __m128i*) p);
+    size_t i = 4;
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+        __m128i lt = _mm_cmplt_epi32(v, m);
+        m = _mm_or_si128(_mm_and_si128(lt, v), _mm_andnot_si128(lt, m));
+    }
+
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i*) lanes, m);
+    int32_t r = scalar_min_i32(lanes, 4);
+    for (; i < len; i++)
+        r = p[i] < r ? p[i] : r;
+    return r;
+}
+
+__attribute__((target("sse2")))
+static int32_t sse2_max_i32(const int32_t* p, size_t len)
+{
+    if (len < 4)
+        return scalar_max_i32(p, len);
+
+    __m128i m = _mm_loadu_si128((const __m128i*) p);
+    size_t i = 4;
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+        __m128i gt = _mm_cmpgt_epi32(v, m);
+        m = _mm_or_si128(_mm_and_si128(gt, v), _mm_andnot_si128(gt, m));
+    }
+
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i*) lanes, m);
+    int32_t r = scalar_max_i32(lanes, 4);
+    for (; i < len; i++)
+        r = p[i] > r ? p[i] : r;
+    return r;
+}
+
+// minpd/maxpd return the second operand when the first is NaN, which gives
+// the same NaN skipping as the scalar loops
+__attribute__((target("sse2")))
+static real_t sse2_min_real(const real_t* p, size_t len)
+{
+    __m128d m = _mm_set1_pd(INFINITY);
+    size_t i = 0;
+
+    for (; i + 2 <= len; i += 2)
+        m = _mm_min_pd(_mm_loadu_pd(p + i), m);
+
+    real_t lanes[3];
+    _mm_storeu_pd(lanes, m);
+    lanes[2] = scalar_min_real(p + i, len - i);
+    return scalar_min_real(lanes, 3);
+}
+
+__attribute__((target("sse2")))
+static real_t sse2_max_real(const real_t* p, size_t len)
+{
+    __m128d m = _mm_set1_pd(-INFINITY);
+    size_t i = 0;
+
+    for (; i + 2 <= len; i += 2)
+        m = _mm_max_pd(_mm_loadu_pd(p + i), m);
+
+    real_t lanes[3];
+    _mm_storeu_pd(lanes, m);
+    lanes[2] = scalar_max_real(p + i, len - i);
+    return scalar_max_real(lanes, 3);
+}
+
+__attribute__((target("sse2")))
+static real_t sse2_dot_real(const real_t* a, const real_t* b, size_t len)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+
+    real_t lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + scalar_dot_real(a + i, b + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_count_u8(const uint8_t* p, size_t len, uint8_t v)
+{
+    __m128i x = _mm_set1_epi8((char) v);
+    size_t n = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + i)), x);
+        n += __builtin_popcount(_mm_movemask_epi8(eq));
+    }
+
+    return n + scalar_count_u8(p + i, len - i, v);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_count_i32(const int32_t* p, size_t len, int32_t v)
+{
+    __m128i x = _mm_set1_epi32(v);
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+
+    // Equal lanes are -1, subtracting the mask counts them
+    for (; i + 4 <= len; i += 4)
+        acc = _mm_sub_epi32(acc, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (p + i)), x));
+
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*) lanes, acc);
+    return (size_t) lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalar_count_i32(p + i, len - i, v);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_count_real(const real_t* p, size_t len, real_t v)
+{
+    __m128d x = _mm_set1_pd(v);
+    size_t n = 0;
+    size_t i = 0;
+
+    for (; i + 2 <= len; i += 2)
+        n += __builtin_popcount(_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(p + i), x)));
+
+    return n + scalar_count_real(p + i, len - i, v);
+}
+
+static const simd_kernels_t SSE2_KERNELS = {
+    "sse2",
+    sse2_sum_i32,
+    sse2_sum_i64,
+    sse2_sum_u8,
+    sse2_sum_real,
+    sse2_min_i32,
+    sse2_max_i32,
+    sse2_min_real,
+    sse2_max_real,
+    scalar_dot_i32, // pmuldq needs SSE4.1
+    sse2_dot_real,
+    sse2_count_u8,
+    sse2_count_i32,
+    sse2_count_real,
+};
+
+// AVX2
+
+__attribute__((target("avx2")))
+static int64_t avx2_sum_i32(const int32_t* p, size_t len)
+{
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        acc0 = _mm256_add_epi64(acc0, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) (p + i))));
+        acc1 = _mm256_add_epi64(acc1, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) (p + i + 4))));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalar_sum_i32(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2_sum_i64(const uint64_t* p, size_t len)
+{
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256((const __m256i*) (p + i)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256((const __m256i*) (p + i + 4)));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalar_sum_i64(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2_sum_u8(const uint8_t* p, size_t len)
+{
+    __m256i acc = _mm256_setzero_si256();
+    __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*) (p + i)), zero));
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalar_sum_u8(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static real_t avx2_sum_real(const real_t* p, size_t len)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(p + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(p + i + 4));
+    }
+
+    real_t lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalar_sum_real(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int32_t avx2_min_i32(const int32_t* p, size_t len)
+{
+    if (len < 8)
+        return scalar_min_i32(p, len);
+
+    __m256i m = _mm256_loadu_si256((const __m256i*) p);
+    size_t i = 8;
+
+    for (; i + 8 <= len; i += 8)
+        m = _mm256_min_epi32(m, _mm256_loadu_si256((const __m256i*) (p + i)));
+
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i*) lanes, m);
+    int32_t r = scalar_min_i32(lanes, 8);
+    for (; i < len; i++)
+        r = p[i] < r ? p[i] : r;
+    return r;
+}
+
+__attribute__((target("avx2")))
+static int32_t avx2_max_i32(const int32_t* p, size_t len)
+{
+    if (len < 8)
+        return scalar_max_i32(p, len);
+
+    __m256i m = _mm256_loadu_si256((const __m256i*) p);
+    size_t i = 8;
+
+    for (; i + 8 <= len; i += 8)
+        m = _mm256_max_epi32(m, _mm256_loadu_si256((const __m256i*) (p + i)));
+
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i*) lanes, m);
+    int32_t r = scalar_max_i32(lanes, 8);
+    for (; i < len; i++)
+        r = p[i] > r ? p[i] : r;
+    return r;
+}
+
+__attribute__((target("avx2")))
+static real_t avx2_min_real(const real_t* p, size_t len)
+{
+    __m256d m = _mm256_set1_pd(INFINITY);
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4)
+        m = _mm256_min_pd(_mm256_loadu_pd(p + i), m);
+
+    real_t lanes[5];
+    _mm256_storeu_pd(lanes, m);
+    lanes[4] = scalar_min_real(p + i, len - i);
+    return scalar_min_real(lanes, 5);
+}
+
+__attribute__((target("avx2")))
+static real_t avx2_max_real(const real_t* p, size_t len)
+{
+    __m256d m = _mm256_set1_pd(-INFINITY);
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4)
+        m = _mm256_max_pd(_mm256_loadu_pd(p + i), m);
+
+    real_t lanes[5];
+    _mm256_storeu_pd(lanes, m);
+    lanes[4] = scalar_max_real(p + i, len - i);
+    return scalar_max_real(lanes, 5);
+}
+
+__attribute__((target("avx2")))
+static int64_t avx2_dot_i32(const int32_t* a, const int32_t* b, size_t len)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+
+    // vpmuldq multiplies the sign extended low halves of each 64 bit lane
+    for (; i + 4 <= len; i += 4)
+    {
+        __m256i va = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) (a + i)));
+        __m256i vb = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) (b + i)));
+        acc = _mm256_add_epi64(acc, _mm256_mul_epi32(va, vb));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalar_dot_i32(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static real_t avx2_dot_real(const real_t* a, const real_t* b, size_t len)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+
+    real_t lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalar_dot_real(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_count_u8(const uint8_t* p, size_t len, uint8_t v)
+{
+    __m256i x = _mm256_set1_epi8((char) v);
+    size_t n = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (p + i)), x);
+        n += __builtin_popcount((uint32_t) _mm256_movemask_epi8(eq));
+    }
+
+    return n + scalar_count_u8(p + i, len - i, v);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_count_i32(const int32_t* p, size_t len, int32_t v)
+{
+    __m256i x = _mm256_set1_epi32(v);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8)
+        acc = _mm256_sub_epi32(acc, _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*) (p + i)), x));
+
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i*) lanes, acc);
+
+    size_t n = 0;
+    for (size_t l = 0; l < 8; l++)
+        n += lanes[l];
+
+    return n + scalar_count_i32(p + i, len - i, v);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_count_real(const real_t* p, size_t len, real_t v)
+{
+    __m256d x = _mm256_set1_pd(v);
+    size_t n = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4)
+        n += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(p + i), x, _CMP_EQ_OQ)));
+
+    return n + scalar_count_real(p + i, len - i, v);
+}
+
+static const simd_kernels_t AVX2_KERNELS = {
+    "avx2",
+    avx2_sum_i32,
+    avx2_sum_i64,
+    avx2_sum_u8,
+    avx2_sum_real,
+    avx2_min_i32,
+    avx2_max_i32,
+    avx2_min_real,
+    avx2_max_real,
+    avx2_dot_i32,
+    avx2_dot_real,
+    avx2_count_u8,
+    avx2_count_i32,
+    avx2_count_real,
+};
+
+#endif /* SIMD_X86 */
+
+static const simd_kernels_t* kernels = &SCALAR_KERNELS;
+
+// Picks the widest kernel set the CPU supports. LIME_SIMD=scalar|sse2 in
+// the environment caps the level, which is handy to compare the paths.
+void simd_init()
+{
+    kernels = &SCALAR_KERNELS;
+
+#ifdef SIMD_X86
+    const char* cap = getenv("LIME_SIMD");
+
+    if (cap != NULL && strcmp(cap, "scalar") == 0)
+        return;
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && (cap == NULL || strcmp(cap, "sse2") != 0))
+        kernels = &AVX2_KERNELS;
+    else if (__builtin_cpu_supports("sse2"))
+        kernels = &SSE2_KERNELS;
+#endif
+}
+
+const char* simd_level()
+{
+    return kernels->name;
+}
+
+// Generic scalar paths, T is the packed C type of the element
+
+#define SIMD_INT_SWITCH(type, X) \
+    switch (type) \
+    { \
+        case MT_INT8: X(int8_t); break; \
+        case MT_UINT8: \
+        case MT_BOOL: X(uint8_t); break; \
+        case MT_INT16: X(int16_t); break; \
+        case MT_UINT16: X(uint16_t); break; \
+        case MT_INT32: X(int32_t); break; \
+        case MT_UINT32: X(uint32_t); break; \
+        case MT_INT64: X(int64_t); break; \
+        case MT_UINT64: X(uint64_t); break; \
+        default: break; \
+    }
+
+#define SIMD_SUM(T) \
+    for (size_t i = 0; i < len; i++) \
+        result.as_uint64 += (uint64_t) (int64_t) ((const T*) elmnts)[i];
+
+#define SIMD_MIN(T) \
+    { \
+        const T* p = elmnts; \
+        T m = p[0]; \
+        for (size_t i = 1; i < len; i++) \
+            m = p[i] < m ? p[i] : m; \
+        result.as_int64 = (int64_t) m; \
+    }
+
+#define SIMD_MAX(T) \
+    { \
+        const T* p = elmnts; \
+        T m = p[0]; \
+        for (size_t i = 1; i < len; i++) \
+            m = p[i] > m ? p[i] : m; \
+        result.as_int64 = (int64_t) m; \
+    }
+
+#define SIMD_DOT(T) \
+    for (size_t i = 0; i < len; i++) \
+        result.as_uint64 += (uint64_t) (int64_t) ((const T*) a)[i] * (uint64_t) (int64_t) ((const T*) b)[i];
+
+#define SIMD_COUNT_EQ(T) \
+    if ((int64_t) (T) value.as_int64 == value.as_int64) \
+    { \
+        for (size_t i = 0; i < len; i++) \
+            count += ((const T*) elmnts)[i] == (T) value.as_int64; \
+    }
+
+#define SIMD_FIND(T) \
+    for (size_t i = 0; i < len; i++) \
+    { \
+        if (((const T*) elmnts)[i] == (T) value.as_int64) \
+            return i; \
+    }
+
+value_t simd_sum(const void* elmnts, size_t len, type_t type)
+{
+    value_t result;
+    result.as_uint64 = 0;
+
+    switch (type)
+    {
+        case MT_REAL: result.as_real = kernels->sum_real(elmnts, len); break;
+        case MT_INT32: result.as_int64 = kernels->sum_i32(elmnts, len); break;
+        case MT_INT64:
+        case MT_UINT64: result.as_uint64 = kernels->sum_i64(elmnts, len); break;
+        case MT_UINT8:
+        case MT_BOOL: result.as_uint64 = kernels->sum_u8(elmnts, len); break;
+        default: SIMD_INT_SWITCH(type, SIMD_SUM);
+    }
+
+    return result;
+}
+
+value_t simd_min(const void* elmnts, size_t len, type_t type)
+{
+    value_t result;
+    result.as_uint64 = 0;
+
+    switch (type)
+    {
+        case MT_REAL: result.as_real = kernels->min_real(elmnts, len); break;
+        case MT_INT32: result.as_int64 = kernels->min_i32(elmnts, len); break;
+        default: SIMD_INT_SWITCH(type, SIMD_MIN);
+    }
+
+    return result;
+}
+
+value_t simd_max(const void* elmnts, size_t len, type_t type)
+{
+    value_t result;
+    result.as_uint64 = 0;
+
+    switch (type)
+    {
+        case MT_REAL: result.as_real = kernels->max_real(elmnts, len); break;
+        case MT_INT32: result.as_int64 = kernels->max_i32(elmnts, len); break;
+        default: SIMD_INT_SWITCH(type, SIMD_MAX);
+    }
+
+    return result;
+}
+
+value_t simd_dot(const void* a, const void* b, size_t len, type_t type)
+{
+    value_t result;
+    result.as_uint64 = 0;
+
+    switch (type)
+    {
+        case MT_REAL: result.as_real = kernels->dot_real(a, b, len); break;
+        case MT_INT32: result.as_int64 = kernels->dot_i32(a, b, len); break;
+        default: SIMD_INT_SWITCH(type, SIMD_DOT);
+    }
+
+    return result;
+}
+
+int64_t simd_count_eq(const void* elmnts, size_t len, type_t type, value_t value)
+{
+    size_t count = 0;
+
+    switch (type)
+    {
+        case MT_REAL:
+            return kernels->count_real(elmnts, len, value.as_real);
+        case MT_INT32:
+            if (value.as_int64 != (int32_t) value.as_int64)
+                return 0;
+            return kernels->count_i32(elmnts, len, (int32_t) value.as_int64);
+        case MT_INT8:
+            if (value.as_int64 != (int8_t) value.as_int64)
+                return 0;
+            return kernels->count_u8(elmnts, len, (uint8_t) value.as_int64);
+        case MT_UINT8:
+        case MT_BOOL:
+            if (value.as_int64 != (uint8_t) value.as_int64)
+                return 0;
+            return kernels->count_u8(elmnts, len, (uint8_t) value.as_int64);
+        default:
+            SIMD_INT_SWITCH(type, SIMD_COUNT_EQ);
+    }
+
+    return count;
+}
+
+// Index of the first element equal to the extreme value. The reduction
+// runs vectorized, the search is a single predictable pass.
+static int64_t simd_find(const void* elmnts, size_t len, type_t type, value_t value)
+{
+    if (is_real_type(type))
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            if (((const real_t*) elmnts)[i] == value.as_real)
+                return i;
+        }
+        return 0;
+    }
+
+    SIMD_INT_SWITCH(type, SIMD_FIND);
+
+    return 0;
+}
+
+int64_t simd_argmin(const void* elmnts, size_t len, type_t type)
+{
+    return simd_find(elmnts, len, type, simd_min(elmnts, len, type));
+}
+
+int64_t simd_argmax(const void* elmnts, size_t len, type_t type)
+{
+    return simd_find(elmnts, len, type, simd_max(elmnts, len, type));
+}
@@ -0,0 +1,25 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void simd_init();
+const char* simd_level();
+value_t simd_sum(const void* elmnts, size_t len, type_t type);
+value_t simd_min(const void* elmnts, size_t len, type_t type);
+value_t simd_max(const void* elmnts, size_t len, type_t type);
+value_t simd_dot(const void* a, const void* b, size_t len, type_t type);
+int64_t simd_count_eq(const void* elmnts, size_t len, type_t type, value_t value);
+int64_t simd_argmin(const void* elmnts, size_t len, type_t type);
+int64_t simd_argmax(const void* elmnts, size_t len, type_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMD_H */
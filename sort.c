@@ -0,0 +1,289 @@
+#include "sort.h"
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every numeric element type is sorted as unsigned keys: signed integers
+// get their sign bit flipped, reals are mapped to keys that follow the
+// IEEE 754 total order and descending order inverts all key bits. The
+// mappings are bijective so they are undone in place after sorting.
+
+#define SORT_INSERTION_MAX 24
+#define SORT_RADIX_MIN 256
+
+// Introsort: median of three quicksort with Hoare partitioning, falling
+// back to heapsort when the recursion gets too deep and finishing small
+// ranges with insertion sort
+#define SORT_DEFINE_INTROSORT(NAME, T, LESS) \
+    static void NAME##_insertion(T* a, size_t n, const void* ctx) \
+    { \
+        for (size_t i = 1; i < n; i++) \
+        { \
+            T x = a[i]; \
+            size_t j = i; \
+            for (; j > 0 && LESS(ctx, x, a[j - 1]); j--) \
+                a[j] = a[j - 1]; \
+            a[j] = x; \
+        } \
+    } \
+    \
+    static void NAME##_sift_down(T* a, size_t root, size_t n, const void* ctx) \
+    { \
+        T x = a[root]; \
+        size_t child; \
+        while ((child = 2 * root + 1) < n) \
+        { \
+            if (child + 1 < n && LESS(ctx, a[child], a[child + 1])) \
+                child++; \
+            if (!LESS(ctx, x, a[child])) \
+                break; \
+            a[root] = a[child]; \
+            root = child; \
+        } \
+        a[root] = x; \
+    } \
+    \
+    static void NAME##_heapsort(T* a, size_t n, const void* ctx) \
+    { \
+        for (size_t i = n / 2; i > 0; i--) \
+            NAME##_sift_down(a, i - 1, n, ctx); \
+        for (size_t i = n - 1; i > 0; i--) \
+        { \
+            T x = a[0]; \
+            a[0] = a[i]; \
+            a[i] = x; \
+            NAME##_sift_down(a, 0, i, ctx); \
+        } \
+    } \
+    \
+    static void NAME##_introsort(T* a, size_t n, int depth, const void* ctx) \
+    { \
+        while (n > SORT_INSERTION_MAX) \
+        { \
+            if (depth-- == 0) \
+            { \
+                NAME##_heapsort(a, n, ctx); \
+                return; \
+            } \
+            \
+            size_t mid = n / 2; \
+            T x; \
+            if (LESS(ctx, a[mid], a[0])) { x = a[mid]; a[mid] = a[0]; a[0] = x; } \
+            if (LESS(ctx, a[n - 1], a[mid])) { x = a[mid]; a[mid] = a[n - 1]; a[n - 1] = x; } \
+            if (LESS(ctx, a[mid], a[0])) { x = a[mid]; a[mid] = a[0]; a[0] = x; } \
+            \
+            T pivot = a[mid]; \
+            ptrdiff_t i = -1; \
+            ptrdiff_t j = n; \
+            while (true) \
+            { \
+                do i++; while (LESS(ctx, a[i], pivot)); \
+                do j--; while (LESS(ctx, pivot, a[j])); \
+                if (i >= j) \
+                    break; \
+                x = a[i]; \
+                a[i] = a[j]; \
+                a[j] = x; \
+            } \
+            \
+            size_t left = j + 1; \
+            if (left < n - left) \
+            { \
+                NAME##_introsort(a, left, depth, ctx); \
+                a += left; \
+                n -= left; \
+            } \
+            else \
+            { \
+                NAME##_introsort(a + left, n - left, depth, ctx); \
+                n = left; \
+            } \
+        } \
+        NAME##_insertion(a, n, ctx); \
+    } \
+    \
+    static void NAME##_sort(T* a, size_t n, const void* ctx) \
+    { \
+        int depth = 0; \
+        for (size_t m = n; m > 1; m >>= 1) \
+            depth += 2; \
+        NAME##_introsort(a, n, depth, ctx); \
+    }
+
+// LSD radix sort, one byte per pass. Passes where every key shares the
+// same digit are skipped, which keeps narrow value ranges cheap.
+#define SORT_DEFINE_RADIX(NAME, T) \
+    static void NAME##_radix(T* a, size_t n) \
+    { \
+        size_t counts[sizeof (T)][256]; \
+        memset(counts, 0, sizeof (counts)); \
+        \
+        for (size_t i = 0; i < n; i++) \
+        { \
+            for (size_t d = 0; d < sizeof (T); d++) \
+                counts[d][(a[i] >> (8 * d)) & 0xFF]++; \
+        } \
+        \
+        T* tmp = malloc(sizeof (T) * n); \
+        T* src = a; \
+        T* dst = tmp; \
+        \
+        for (size_t d = 0; d < sizeof (T); d++) \
+        { \
+            size_t* count = counts[d]; \
+            if (count[(src[0] >> (8 * d)) & 0xFF] == n) \
+                continue; \
+            \
+            size_t offset = 0; \
+            for (size_t b = 0; b < 256; b++) \
+            { \
+                size_t c = count[b]; \
+                count[b] = offset; \
+                offset += c; \
+            } \
+            \
+            for (size_t i = 0; i < n; i++) \
+                dst[count[(src[i] >> (8 * d)) & 0xFF]++] = src[i]; \
+            \
+            T* swap = src; \
+            src = dst; \
+            dst = swap; \
+        } \
+        \
+        if (src != a) \
+            memcpy(a, src, sizeof (T) * n); \
+        \
+        free(tmp); \
+    }
+
+#define SORT_LESS(ctx, a, b) ((a) < (b))
+
+SORT_DEFINE_INTROSORT(sort_u8, uint8_t, SORT_LESS)
+SORT_DEFINE_INTROSORT(sort_u16, uint16_t, SORT_LESS)
+SORT_DEFINE_INTROSORT(sort_u32, uint32_t, SORT_LESS)
+SORT_DEFINE_INTROSORT(sort_u64, uint64_t, SORT_LESS)
+SORT_DEFINE_RADIX(sort_u16, uint16_t)
+SORT_DEFINE_RADIX(sort_u32, uint32_t)
+SORT_DEFINE_RADIX(sort_u64, uint64_t)
+
+// Strings are offsets into the data section, compared by their UTF-8 bytes
+#define SORT_STR_LESS(ctx, a, b) (strcmp((const char*) (ctx) + (a).as_uint16, (const char*) (ctx) + (b).as_uint16) < 0)
+#define SORT_STR_GREATER(ctx, a, b) SORT_STR_LESS(ctx, b, a)
+
+SORT_DEFINE_INTROSORT(sort_str_asc, value_t, SORT_STR_LESS)
+SORT_DEFINE_INTROSORT(sort_str_desc, value_t, SORT_STR_GREATER)
+
+// A single byte key has only 256 values, counting them is enough
+static void sort_u8_counting(uint8_t* a, size_t n)
+{
+    size_t count[256] = {0};
+
+    for (size_t i = 0; i < n; i++)
+        count[a[i]]++;
+
+    for (size_t b = 0; b < 256; b++)
+    {
+        memset(a, b, count[b]);
+        a += count[b];
+    }
+}
+
+#define SORT_DEFINE_KEYS(NAME, T, SORT_LARGE) \
+    static void NAME##_keys(T* a, size_t n, T flip) \
+    { \
+        if (flip != 0) \
+        { \
+            for (size_t i = 0; i < n; i++) \
+                a[i] ^= flip; \
+        } \
+        \
+        if (n < SORT_RADIX_MIN) \
+            NAME##_sort(a, n, NULL); \
+        else \
+            SORT_LARGE(a, n); \
+        \
+        if (flip != 0) \
+        { \
+            for (size_t i = 0; i < n; i++) \
+                a[i] ^= flip; \
+        } \
+    }
+
+SORT_DEFINE_KEYS(sort_u8, uint8_t, sort_u8_counting)
+SORT_DEFINE_KEYS(sort_u16, uint16_t, sort_u16_radix)
+SORT_DEFINE_KEYS(sort_u32, uint32_t, sort_u32_radix)
+SORT_DEFINE_KEYS(sort_u64, uint64_t, sort_u64_radix)
+
+#define SORT_SIGN(T) ((T) 1 << (sizeof (T) * 8 - 1))
+
+// Negative reals have all bits inverted, positive ones only the sign bit
+static inline uint64_t sort_real_key(uint64_t bits)
+{
+    return (bits & SORT_SIGN(uint64_t)) ? ~bits : bits | SORT_SIGN(uint64_t);
+}
+
+static inline uint64_t sort_real_bits(uint64_t key)
+{
+    return (key & SORT_SIGN(uint64_t)) ? key & ~SORT_SIGN(uint64_t) : ~key;
+}
+
+static void sort_real(uint64_t* a, size_t n, bool_t desc)
+{
+    uint64_t flip = desc ? ~(uint64_t) 0 : 0;
+
+    for (size_t i = 0; i < n; i++)
+        a[i] = sort_real_key(a[i]);
+
+    sort_u64_keys(a, n, flip);
+
+    for (size_t i = 0; i < n; i++)
+        a[i] = sort_real_bits(a[i]);
+}
+
+void sort_array(void* elmnts, size_t len, type_t type, bool_t desc, const uint8_t* data)
+{
+    if (len < 2)
+        return;
+
+    switch (type)
+    {
+        case MT_INT8:
+            sort_u8_keys(elmnts, len, desc ? (uint8_t) ~SORT_SIGN(uint8_t) : SORT_SIGN(uint8_t));
+            break;
+        case MT_UINT8:
+        case MT_BOOL:
+            sort_u8_keys(elmnts, len, desc ? (uint8_t) ~0 : 0);
+            break;
+        case MT_INT16:
+            sort_u16_keys(elmnts, len, desc ? (uint16_t) ~SORT_SIGN(uint16_t) : SORT_SIGN(uint16_t));
+            break;
+        case MT_UINT16:
+            sort_u16_keys(elmnts, len, desc ? (uint16_t) ~0 : 0);
+            break;
+        case MT_INT32:
+            sort_u32_keys(elmnts, len, desc ? ~SORT_SIGN(uint32_t) : SORT_SIGN(uint32_t));
+            break;
+        case MT_UINT32:
+            sort_u32_keys(elmnts, len, desc ? ~(uint32_t) 0 : 0);
+            break;
+        case MT_INT64:
+            sort_u64_keys(elmnts, len, desc ? ~SORT_SIGN(uint64_t) : SORT_SIGN(uint64_t));
+            break;
+        case MT_UINT64:
+            sort_u64_keys(elmnts, len, desc ? ~(uint64_t) 0 : 0);
+            break;
+        case MT_REAL:
+            sort_real(elmnts, len, desc);
+            break;
+        case MT_STR:
+            if (desc)
+                sort_str_desc_sort(elmnts, len, data);
+            else
+                sort_str_asc_sort(elmnts, len, data);
+            break;
+        default:
+            break;
+    }
+}
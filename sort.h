@@ -0,0 +1,17 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void sort_array(void* elmnts, size_t len, type_t type, bool_t desc, const uint8_t* data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SORT_H */
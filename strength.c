@@ -0,0 +1,197 @@
+#include "strength.h"
+#include "ast.h"
+#include "builtins.h"
+#include "types.h"
+#include "vm.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// Strength reduction of integer multiplication, division and modulo by a
+// constant:
+//
+//   x * 2^k  ->  x << k
+//   x / 2^k  ->  x >> k              x can not be negative
+//   x % 2^k  ->  x & (2^k - 1)       x can not be negative
+//   x / c    ->  IDIVM               high half of x * magic(c), shifted
+//   x % c    ->  IMODM               x - (x / c) * c
+//
+// The VM divides every integer as a signed 64 bit value, so the rewrites
+// give exactly what IDIV and IMOD would. Arithmetic does not narrow its
+// result to the expression type either: an unsigned type alone does not
+// keep a value from being negative, a zero extending load or cast does.
+
+static bool_t constant_int(ast_t* ast, int64_t* value)
+{
+    if (ast->base->kind != AST_CONSTANT || !is_integer_type(ast->base->type))
+        return false;
+
+    *value = ((ast_constant_t*) ast)->value.as_int64;
+    return true;
+}
+
+// k when value is 2^k with k > 0, otherwise 0
+static uint8_t power_of_two(int64_t value)
+{
+    uint8_t k = 0;
+
+    if (value < 2 || (value & (value - 1)) != 0)
+        return 0;
+
+    while ((value >> k) != 1)
+        k++;
+    return k;
+}
+
+static bool_t non_negative(ast_t* ast)
+{
+    int64_t value;
+
+    switch (ast->base->kind)
+    {
+        case AST_CONSTANT:
+            return constant_int(ast, &value) && value >= 0;
+        case AST_VARIABLE:
+        {
+            // Packed unsigned elements are zero extended by their load,
+            // the fields of an array of structs are full slots
+            ast_variable_t* var = (ast_variable_t*) ast;
+            type_t elmnt_type = var->symbol->extra.array.elmnt_type;
+
+            return var->index_expr != NULL && is_unsigned_integer_type(elmnt_type) &&
+                type_size(elmnt_type) < sizeof (value_t);
+        }
+        case AST_BUILTIN_CALL:
+        {
+            const builtin_func_t* builtin = builtin_lookup(((ast_builtin_call_t*) ast)->name);
+
+            if (builtin == NULL)
+                return false;
+
+            switch (builtin->opcode)
+            {
+                case IU8CAST:
+                case IU16CAST:
+                case IU32CAST:
+                case ALEN:
+                case SLEN:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        case AST_BINARY:
+        {
+            ast_binary_t* binary = (ast_binary_t*) ast;
+
+            switch (binary->op)
+            {
+                case TK_AND_BIT:
+                    return non_negative(binary->lhs_expr) || non_negative(binary->rhs_expr);
+                case TK_MOD:
+                    return non_negative(binary->lhs_expr);
+                case TK_DIV:
+                    return non_negative(binary->lhs_expr) && constant_int(binary->rhs_expr, &value) && value > 0;
+                case TK_SHR:
+                    if (non_negative(binary->lhs_expr))
+                        return true;
+                    return is_unsigned_integer_type(ast->base->type) && constant_int(binary->rhs_expr, &value) &&
+                        (value & 63) != 0;
+                default:
+                    return false;
+            }
+        }
+        default:
+            return false;
+    }
+}
+
+static ast_t* reduced(ast_binary_t* ast, token_type_t op, ast_t* lhs, int64_t rhs)
+{
+    value_t value = { .as_int64 = rhs };
+    ast_t* constant = (ast_t*) ast_new_constant(MT_INT64, value);
+    return (ast_t*) ast_new_binary(ast->base->type, op, lhs, constant);
+}
+
+// Signed magic number of a divisor 2 <= |d| < 2^63 (Hacker's Delight, 10-1)
+static magic_t* magic_of(int64_t divisor)
+{
+    const uint64_t two63 = (uint64_t) 1 << 63;
+    uint64_t ad = divisor < 0 ? 0 - (uint64_t) divisor : (uint64_t) divisor;
+    uint64_t t = two63 + ((uint64_t) divisor >> 63);
+    uint64_t anc = t - 1 - t % ad;
+    uint64_t q1 = two63 / anc;
+    uint64_t r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad;
+    uint64_t r2 = two63 - q2 * ad;
+    uint64_t delta;
+    uint8_t p = 63;
+
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    }
+    while (q1 < delta || (q1 == delta && r1 == 0));
+
+    magic_t* magic = malloc(sizeof (magic_t));
+    magic->magic = divisor < 0 ? (int64_t) (0 - (q2 + 1)) : (int64_t) (q2 + 1);
+    magic->shift = p - 64;
+    return magic;
+}
+
+ast_t* strength_reduce(ast_t* ast)
+{
+    if (ast->base->kind != AST_BINARY || !is_integer_type(ast->base->type))
+        return ast;
+
+    ast_binary_t* binary = (ast_binary_t*) ast;
+    ast_t* lhs = binary->lhs_expr;
+    ast_t* rhs = binary->rhs_expr;
+    int64_t value;
+    uint8_t k;
+
+    if (!is_integer_type(lhs->base->type) || !is_integer_type(rhs->base->type))
+        return ast;
+
+    switch (binary->op)
+    {
+        case TK_MUL:
+            if (constant_int(rhs, &value) && (k = power_of_two(value)) > 0)
+                return reduced(binary, TK_SHL, lhs, k);
+            if (constant_int(lhs, &value) && (k = power_of_two(value)) > 0)
+                return reduced(binary, TK_SHL, rhs, k);
+            return ast;
+        case TK_DIV:
+        case TK_MOD:
+            if (!constant_int(rhs, &value))
+                return ast;
+
+            if ((k = power_of_two(value)) > 0 && non_negative(lhs))
+            {
+                if (binary->op == TK_DIV)
+                    return reduced(binary, TK_SHR, lhs, k);
+                return reduced(binary, TK_AND_BIT, lhs, value - 1);
+            }
+
+            // The divisor travels as a 32 bit operand of IDIVM and IMODM
+            if ((value >= 2 || value <= -2) && value >= INT32_MIN && value <= INT32_MAX)
+                binary->magic = magic_of(value);
+            return ast;
+        default:
+            return ast;
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef STRENGTH_H
+#define STRENGTH_H
+
+#include "ast.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+ast_t* strength_reduce(ast_t* ast);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STRENGTH_H */
@@ -0,0 +1,538 @@
+#include "tier.h"
+#include "ir.h"
+#include "peephole.h"
+#include "vm.h"
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tiered execution. The code starts out as it was loaded, the VM counts
+// the calls of every function and the loop back edges taken in it. Once
+// a function crosses TIER_CALLS or TIER_LOOPS, its next call copies it
+// out, runs the IR and peephole passes over the copy alone and appends
+// the result to the code. Every later CALL of the function enters the new
+// body, while frames still running the old body finish in it.
+//
+// A function runs from its PROC up to the next PROC. Calls it makes go
+// to stubs in the copy, `PROC args k; ICONST_0; RET` for the k-th callee,
+// and back to the callee once the passes are done.
+//
+// A call to a function of at most TIER_INLINE_SIZE bytes that touches
+// only the stack and its own slots takes in the body of the callee
+// instead. Its slots follow the ones of the caller, the arguments are
+// stored there and the locals zeroed the way CALL would, and every RET
+// jumps past the body with the value on the stack. Calls the inlined body
+// makes stay calls, to the stubs or to the new body itself when it calls
+// the caller, so a recursive function unrolls one level. The passes then
+// see both bodies as one.
+//
+// Last, the new body gets the superinstructions the VM has for the stack
+// code: a compare with the JEZ or JNZ behind it, and XLOAD with the IADD,
+// ISUB or IMUL behind it. Quickening makes the former at run time too,
+// the latter only exist in new bodies.
+
+#define STUB_SIZE 7
+
+typedef struct
+{
+    uint16_t entry;
+    uint16_t end;
+    uint64_t calls;
+    uint64_t loops;
+    uint64_t tiered_at;     // calls when the new body was made
+    uint16_t new_entry;
+    uint16_t new_size;
+    size_t inlined;         // calls that took in the body of the callee
+    size_t fused;           // superinstructions in the new body
+    bool_t hot;
+    bool_t tiered;
+    bool_t failed;
+} tier_func_t;
+
+static tier_func_t* funcs;
+static size_t n_funcs;
+static int32_t* func_of;    // function of every code address, or -1
+static bool_t report;
+
+static uint16_t read16(uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static void write16(uint8_t* p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+static bool_t is_branch(uint8_t op)
+{
+    return op == JMP || op == JEZ || op == JNZ || op == CALL || op == FORI || op == FORNEXT;
+}
+
+void tier_init(bool_t stats)
+{
+    uint8_t* code = vm_code_ptr();
+    size_t size = vm_code_addr();
+    bool_t* called = calloc(size + 1, sizeof (bool_t));
+
+    report = stats;
+    funcs = malloc(sizeof (tier_func_t) * (size / 5 + 1));
+    n_funcs = 0;
+    func_of = malloc(sizeof (int32_t) * (UINT16_MAX + 1));
+    for (size_t a = 0; a <= UINT16_MAX; a++)
+        func_of[a] = -1;
+
+    for (size_t ip = 0; ip < size; ip += 1 + OPCODES[code[ip]].arg_size)
+    {
+        if (code[ip] == CALL && read16(code + ip + 1) < size)
+            called[read16(code + ip + 1)] = true;
+    }
+
+    // The main body has a PROC of its own, nothing calls it
+    tier_func_t* open = NULL;
+    for (size_t ip = 0; ip <= size && size <= UINT16_MAX; ip += 1 + OPCODES[code[ip]].arg_size)
+    {
+        if (ip < size && code[ip] != PROC)
+            continue;
+
+        if (open != NULL)
+        {
+            open->end = ip;
+            for (size_t a = open->entry; a < ip; a++)
+                func_of[a] = open - funcs;
+        }
+
+        open = NULL;
+        if (ip < size && called[ip])
+        {
+            open = &funcs[n_funcs++];
+            memset(open, 0, sizeof (tier_func_t));
+            open->entry = ip;
+        }
+
+        if (ip == size)
+            break;
+    }
+
+    free(called);
+}
+
+void tier_free()
+{
+    free(funcs);
+    free(func_of);
+}
+
+// Ops an inlined body may use, they touch the stack and the slots of the
+// callee, or call on
+static bool_t is_inline_op(uint8_t op)
+{
+    return (op >= IINC && op <= RTOI) || op == NOP || op == DUP || op == DROP || op == SWAP ||
+        op == JMP || op == JEZ || op == JNZ || op == RET || op == XLOAD || op == XSTORE ||
+        op == XCONST || op == SPRINT || op == ISHRU || op == IDIVM || op == IMODM ||
+        op == XINC || op == XDEC || op == XADDI || op == CALL;
+}
+
+static bool_t is_slot_op(uint8_t op)
+{
+    return op == XLOAD || op == XSTORE || op == XINC || op == XDEC || op == XADDI;
+}
+
+// The function a call goes to when its body can be inlined, or NULL
+static tier_func_t* inlinable(uint16_t target)
+{
+    uint8_t* code = vm_code_ptr();
+    int32_t f = func_of[target];
+
+    if (f < 0 || funcs[f].entry != target || funcs[f].end - target > TIER_INLINE_SIZE)
+        return NULL;
+
+    tier_func_t* callee = &funcs[f];
+    size_t len = callee->end - callee->entry;
+    uint8_t src[TIER_INLINE_SIZE];
+    uint8_t last = NOP;
+
+    memcpy(src, code + callee->entry, len);
+    vm_code_dequicken(src, len);
+
+    for (size_t ip = 5; ip < len; ip += 1 + OPCODES[src[ip]].arg_size)
+    {
+        if (!is_inline_op(src[ip]))
+            return NULL;
+
+        if (src[ip] == CALL && code[read16(src + ip + 1)] != PROC)
+            return NULL;
+
+        if (is_branch(src[ip]) && src[ip] != CALL &&
+            (read16(src + ip + 1) < callee->entry + 5 || read16(src + ip + 1) >= callee->end))
+            return NULL;
+
+        last = src[ip];
+    }
+
+    // It can not run off its end
+    return last == RET ? callee : NULL;
+}
+
+// The copy of a function being made, its stubs follow the body
+typedef struct
+{
+    tier_func_t* func;
+    uint8_t* body;
+    size_t len;
+    uint16_t* callees;
+    size_t n_callees;
+} copy_t;
+
+// Where a call from the copy goes, its own start or the stub of the callee
+static uint16_t call_target(copy_t* copy, uint16_t target)
+{
+    if (target == copy->func->entry)
+        return 0;
+
+    size_t k = 0;
+    while (k < copy->n_callees && copy->callees[k] != target)
+        k++;
+    if (k == copy->n_callees)
+        copy->callees[copy->n_callees++] = target;
+
+    return copy->len + k * STUB_SIZE;
+}
+
+// Writes the body of the callee for a call at pos in the copy, its slots
+// start past base. Returns its size, with copy NULL it only measures it.
+static size_t inline_body(tier_func_t* callee, uint16_t base, copy_t* copy, size_t pos)
+{
+    uint8_t* code = vm_code_ptr();
+    size_t len = callee->end - callee->entry;
+    uint16_t args = read16(code + callee->entry + 1);
+    uint16_t vars = read16(code + callee->entry + 3);
+    uint8_t src[TIER_INLINE_SIZE];
+    uint16_t at[TIER_INLINE_SIZE];
+    size_t size = args * 3 + vars * 4;
+
+    memcpy(src, code + callee->entry, len);
+    vm_code_dequicken(src, len);
+
+    // A RET grows into a JMP
+    for (size_t ip = 5; ip < len; ip += 1 + OPCODES[src[ip]].arg_size)
+    {
+        at[ip] = size;
+        size += src[ip] == RET ? 3 : 1 + OPCODES[src[ip]].arg_size;
+    }
+
+    if (copy == NULL)
+        return size;
+
+    uint8_t* out = copy->body + pos;
+
+    // The arguments are on the stack, the last one on top
+    for (uint16_t i = args; i > 0; i--, out += 3)
+    {
+        out[0] = XSTORE;
+        write16(out + 1, base + i);
+    }
+
+    for (uint16_t i = 1; i <= vars; i++, out += 4)
+    {
+        out[0] = ICONST_0;
+        out[1] = XSTORE;
+        write16(out + 2, base + args + i);
+    }
+
+    for (size_t ip = 5; ip < len; ip += 1 + OPCODES[src[ip]].arg_size)
+    {
+        size_t op_size = 1 + OPCODES[src[ip]].arg_size;
+
+        out = copy->body + pos + at[ip];
+
+        if (src[ip] == RET)
+        {
+            out[0] = JMP;
+            write16(out + 1, pos + size);
+            continue;
+        }
+
+        memcpy(out, src + ip, op_size);
+        if (is_slot_op(src[ip]))
+            write16(out + 1, base + read16(src + ip + 1));
+        else if (src[ip] == CALL)
+            write16(out + 1, call_target(copy, read16(src + ip + 1)));
+        else if (is_branch(src[ip]))
+            write16(out + 1, pos + at[read16(src + ip + 1) - callee->entry]);
+    }
+
+    return size;
+}
+
+// The body of the function alone with stubs for its callees, or NULL.
+// Calls to small functions take in their bodies, one level deep.
+static uint8_t* extract(tier_func_t* func, uint16_t* callees, size_t* n_callees, size_t* size)
+{
+    uint8_t* code = vm_code_ptr();
+    size_t len = func->end - func->entry;
+    uint8_t* src = malloc(len);
+    uint16_t* at = malloc(sizeof (uint16_t) * len);
+    uint16_t base = read16(code + func->entry + 1) + read16(code + func->entry + 3);
+    size_t extra = 0;
+    size_t new_len = 0;
+
+    memcpy(src, code + func->entry, len);
+    vm_code_dequicken(src, len);
+
+    for (size_t ip = 0; ip < len; ip += 1 + OPCODES[src[ip]].arg_size)
+    {
+        tier_func_t* callee = src[ip] == CALL ? inlinable(read16(src + ip + 1)) : NULL;
+
+        at[ip] = new_len;
+        if (callee == NULL)
+        {
+            new_len += 1 + OPCODES[src[ip]].arg_size;
+            continue;
+        }
+
+        // Inlined bodies never overlap, the calls they make get frames of
+        // their own, so every one uses the same slots
+        size_t slots = read16(code + callee->entry + 1) + read16(code + callee->entry + 3);
+        if (slots > extra)
+            extra = slots;
+        new_len += inline_body(callee, base, NULL, 0);
+    }
+
+    // A stub for every function at most
+    if (new_len + STUB_SIZE * n_funcs > UINT16_MAX || base + extra > UINT16_MAX)
+    {
+        free(at);
+        free(src);
+        return NULL;
+    }
+
+    copy_t copy = { func, malloc(new_len + STUB_SIZE * n_funcs), new_len, callees, 0 };
+    uint8_t* body = copy.body;
+    func->inlined = 0;
+
+    for (size_t ip = 0; ip < len; ip += 1 + OPCODES[src[ip]].arg_size)
+    {
+        uint8_t* out = body + at[ip];
+        tier_func_t* callee = src[ip] == CALL ? inlinable(read16(src + ip + 1)) : NULL;
+
+        if (callee != NULL)
+        {
+            inline_body(callee, base, &copy, at[ip]);
+            func->inlined++;
+            continue;
+        }
+
+        memcpy(out, src + ip, 1 + OPCODES[src[ip]].arg_size);
+        if (!is_branch(src[ip]))
+            continue;
+
+        uint16_t target = read16(src + ip + 1);
+
+        if (target >= func->entry && target < func->end)
+        {
+            write16(out + 1, at[target - func->entry]);
+            continue;
+        }
+
+        if (src[ip] != CALL || code[target] != PROC)
+        {
+            free(body);
+            free(at);
+            free(src);
+            return NULL;
+        }
+
+        write16(out + 1, call_target(&copy, target));
+    }
+
+    write16(body + 3, read16(body + 3) + extra);
+
+    for (size_t k = 0; k < copy.n_callees; k++)
+    {
+        uint8_t* stub = body + new_len + k * STUB_SIZE;
+        stub[0] = PROC;
+        memcpy(stub + 1, code + callees[k] + 1, 2);
+        write16(stub + 3, k);
+        stub[5] = ICONST_0;
+        stub[6] = RET;
+    }
+
+    *n_callees = copy.n_callees;
+    *size = new_len + copy.n_callees * STUB_SIZE;
+    free(at);
+    free(src);
+    return body;
+}
+
+// Moves the optimized body to its address and its calls from the stubs
+// in the optimized code back to the callees
+static bool_t relocate(uint8_t* body, size_t len, uint8_t* out, size_t out_size, uint16_t new_entry,
+    uint16_t* callees, size_t n_callees)
+{
+    for (size_t ip = 0; ip < len; ip += 1 + OPCODES[body[ip]].arg_size)
+    {
+        if (!is_branch(body[ip]))
+            continue;
+
+        uint16_t target = read16(body + ip + 1);
+
+        if (target < len)
+            write16(body + ip + 1, new_entry + target);
+        else if (body[ip] == CALL && target < out_size && out[target] == PROC && read16(out + target + 3) < n_callees)
+            write16(body + ip + 1, callees[read16(out + target + 3)]);
+        else
+            return false;
+    }
+
+    return true;
+}
+
+// Fuses what the passes left in the new body into superinstructions, a
+// compare with the branch behind it and a load with the op that uses it.
+// The second op stays in place, so no address moves. Returns the count.
+static size_t fuse(uint8_t* body, size_t len)
+{
+    size_t fused = 0;
+
+    for (size_t ip = 0; ip < len; ip += 1 + OPCODES[body[ip]].arg_size)
+    {
+        size_t next = ip + 1 + OPCODES[body[ip]].arg_size;
+
+        if (next >= len)
+            break;
+
+        if (body[next] == JEZ || body[next] == JNZ)
+        {
+            if (body[ip] >= IGT && body[ip] <= INQ)
+                body[ip] = IGTJ + (body[ip] - IGT);
+            else if (body[ip] >= RGT && body[ip] <= RNQ)
+                body[ip] = RGTJ + (body[ip] - RGT);
+            else
+                continue;
+            fused++;
+        }
+        else if (body[ip] == XLOAD && (body[next] == IADD || body[next] == ISUB || body[next] == IMUL))
+        {
+            body[ip] = body[next] == IADD ? IADDX : body[next] == ISUB ? ISUBX : IMULX;
+            fused++;
+        }
+    }
+
+    return fused;
+}
+
+static bool_t tier_up(tier_func_t* func)
+{
+    size_t size = vm_code_addr();
+    uint16_t* callees = malloc(sizeof (uint16_t) * (n_funcs + 1));
+    size_t n_callees;
+    size_t body_size;
+    uint8_t* body = extract(func, callees, &n_callees, &body_size);
+
+    if (body == NULL)
+    {
+        free(callees);
+        return false;
+    }
+
+    // The passes work on the code of the VM, the program waits aside
+    uint8_t* saved = malloc(size);
+    memcpy(saved, vm_code_ptr(), size);
+
+    vm_code_replace(body, body_size);
+    ir_optimize();
+    peephole_optimize();
+
+    uint8_t* out = vm_code_ptr();
+    size_t out_size = vm_code_addr();
+    size_t new_len = 0;
+
+    do
+        new_len += 1 + OPCODES[out[new_len]].arg_size;
+    while (new_len < out_size && out[new_len] != PROC);
+
+    uint8_t* fresh = malloc(new_len);
+    memcpy(fresh, out, new_len);
+    bool_t ok = size + new_len <= UINT16_MAX && relocate(fresh, new_len, out, out_size, size, callees, n_callees);
+
+    vm_code_replace(saved, size);
+
+    if (ok)
+    {
+        func->fused = fuse(fresh, new_len);
+        vm_code_emit(fresh, new_len);
+
+        for (size_t a = size; a < size + new_len; a++)
+            func_of[a] = func - funcs;
+
+        func->new_entry = size;
+        func->new_size = new_len;
+        func->tiered_at = func->calls;
+        func->tiered = true;
+    }
+
+    free(fresh);
+    free(saved);
+    free(body);
+    free(callees);
+    return ok;
+}
+
+uint32_t tier_call(uint32_t entry)
+{
+    int32_t f = func_of[entry];
+
+    if (f < 0)
+        return entry;
+
+    tier_func_t* func = &funcs[f];
+    func->calls++;
+
+    if (func->tiered)
+        return func->new_entry;
+
+    if (func->failed || entry != func->entry || (func->calls < TIER_CALLS && !func->hot))
+        return entry;
+
+    if (!tier_up(func))
+    {
+        func->failed = true;
+        return entry;
+    }
+
+    return func->new_entry;
+}
+
+void tier_loop(uint32_t target)
+{
+    int32_t f = func_of[target];
+
+    if (f >= 0 && ++funcs[f].loops >= TIER_LOOPS)
+        funcs[f].hot = true;
+}
+
+void tier_report()
+{
+    if (!report)
+        return;
+
+    fprintf(stderr, "tier: %zu functions, thresholds %d calls, %d back edges\n", n_funcs, TIER_CALLS, TIER_LOOPS);
+
+    for (size_t f = 0; f < n_funcs; f++)
+    {
+        tier_func_t* func = &funcs[f];
+
+        fprintf(stderr, "tier: %04x  %" PRIu64 " calls  %" PRIu64 " back edges", func->entry, func->calls, func->loops);
+        if (func->tiered)
+            fprintf(stderr, "  reoptimized at call %" PRIu64 " to %04x, %u -> %u bytes, %zu calls inlined, %zu ops fused",
+                func->tiered_at, func->new_entry, func->end - func->entry, func->new_size, func->inlined,
+                func->fused);
+        else if (func->failed)
+            fprintf(stderr, "  not reoptimized");
+        fprintf(stderr, "\n");
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include "types.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// A function is reoptimized at its next call once it was called this
+// many times, or took this many loop back edges over all its calls
+#ifndef TIER_CALLS
+#define TIER_CALLS 1000
+#endif
+
+#ifndef TIER_LOOPS
+#define TIER_LOOPS 10000
+#endif
+
+// Calls to functions at most this many bytes long take in their body
+// when the caller is reoptimized
+#ifndef TIER_INLINE_SIZE
+#define TIER_INLINE_SIZE 64
+#endif
+
+void tier_init(bool_t stats);
+void tier_free();
+uint32_t tier_call(uint32_t entry);
+void tier_loop(uint32_t target);
+void tier_report();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIER_H */
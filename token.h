@@ -24,6 +24,7 @@ typedef enum
     TK_FOR,
     TK_IN,
     TK_DOTDOT,
+    TK_STEP,
     TK_BREAK,
     TK_CONTINUE,
     TK_RETURN,
@@ -38,6 +39,11 @@ typedef enum
     TK_PERIOD,
     TK_BACKSLASH,
     TK_ASSIGN,
+    TK_PLUS_ASSIGN,
+    TK_MINUS_ASSIGN,
+    TK_MUL_ASSIGN,
+    TK_INC,
+    TK_DEC,
     TK_PLUS,
     TK_MINUS,
     TK_DIV,
@@ -46,6 +52,8 @@ typedef enum
     TK_OR_BIT,
     TK_AND_BIT,
     TK_XOR_BIT,
+    TK_SHL,
+    TK_SHR,
     TK_OR,
     TK_AND,
     TK_NOT,
@@ -87,6 +95,10 @@ typedef enum
     TK_UINT32_T,
     TK_UINT64_T,
     TK_ARRAY_T,
+    TK_SOA_T,
+    TK_MAP_T,
+    TK_HEAP_T,
+    TK_DEQUE_T,
     TK_IDENT,
     TK_LAST_TOKEN,
 } token_type_t;
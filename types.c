@@ -49,6 +49,31 @@ bool_t is_unsigned_integer_type(type_t type)
     return type == MT_UINT8 || type == MT_UINT16 || type == MT_UINT32 || type == MT_UINT64;
 }
 
+// Maps, heaps and deques are kept by the VM, a variable refers to one
+bool_t is_container_type(type_t type)
+{
+    return type == MT_MAP || type == MT_HEAP || type == MT_DEQUE;
+}
+
+// A slot holding a value of the type with the bits the type does not use
+// cleared, narrow integers extended from their low bits
+value_t value_extend(type_t type, value_t value)
+{
+    switch (type)
+    {
+        case MT_INT8: value.as_int64 = value.as_int8; break;
+        case MT_INT16: value.as_int64 = value.as_int16; break;
+        case MT_INT32: value.as_int64 = value.as_int32; break;
+        case MT_UINT8: value.as_uint64 = value.as_uint8; break;
+        case MT_UINT16: value.as_uint64 = value.as_uint16; break;
+        case MT_UINT32: value.as_uint64 = value.as_uint32; break;
+        case MT_BOOL: value.as_uint64 = value.as_uint64 != 0; break;
+        case MT_STR: value.as_uint64 = value.as_uint16; break;
+        default: break;
+    }
+    return value;
+}
+
 size_t type_size(type_t type)
 {
     switch (type)
@@ -76,6 +101,24 @@ size_t type_size(type_t type)
     }
 }
 
+// Integer and bool elements are packed by their natural size, everything
+// else (real, str) keeps a full value slot per element
+size_t array_elmnt_size(type_t elmnt_type)
+{
+    if (is_integer_type(elmnt_type) || is_bool_type(elmnt_type))
+        return type_size(elmnt_type);
+
+    return sizeof (value_t);
+}
+
+// Number of stack slots needed to hold the packed elements of an array,
+// the header slot is not included
+size_t array_slots(type_t elmnt_type, size_t len)
+{
+    size_t bytes = array_elmnt_size(elmnt_type) * len;
+    return (bytes + sizeof (value_t) - 1) / sizeof (value_t);
+}
+
 // Helper function to check if an integer type can be implicitly cast to another
 // Allows casting from smaller integer types to larger ones
 bool_t can_implicitly_cast_integer(type_t from, type_t to)
@@ -31,6 +31,10 @@ typedef enum
     MT_REAL,
     MT_FUNC,
     MT_ARRAY,
+    MT_STRUCT,
+    MT_MAP,
+    MT_HEAP,
+    MT_DEQUE,
 } type_t;
 
 typedef union
@@ -66,7 +70,11 @@ bool_t is_real_type(type_t type);
 bool_t is_bool_type(type_t type);
 bool_t is_array_type(type_t type);
 bool_t is_unsigned_integer_type(type_t type);
+bool_t is_container_type(type_t type);
+value_t value_extend(type_t type, value_t value);
 size_t type_size(type_t type);
+size_t array_elmnt_size(type_t elmnt_type);
+size_t array_slots(type_t elmnt_type, size_t len);
 bool_t can_implicitly_cast_integer(type_t from, type_t to);
 bool_t need_explicit_cast_integer(type_t from, type_t to);
 type_t mix_integer_types(type_t t1, type_t t2);
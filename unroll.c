@@ -0,0 +1,252 @@
+#include "unroll.h"
+#include "ast.h"
+#include "context.h"
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Unrolling of counted loops: `for i in from..to [step n]`, `for x in array`
+// and `for i = a; i < b; i = i + n`. From level 1 on a loop running a small,
+// known number of times becomes one copy of its body per iteration, with
+// the counter set to a constant before each. At level 2 a loop whose body is
+// straight-line code runs 8 or 4 copies per iteration while all of them are
+// in range and leaves the remaining iterations to the loop itself.
+//
+// Copies are emitted from the same body, so it can not hold loops, breaks
+// or continues of its own.
+
+#define UNROLL_FULL_TRIPS 16
+#define UNROLL_FULL_SIZE 256    // nodes in all copies together
+#define UNROLL_BY_8_SIZE 16
+#define UNROLL_BY_4_SIZE 64
+
+typedef struct
+{
+    size_t size;
+    bool_t copyable;
+    bool_t straight;
+} body_t;
+
+static bool_t body_visit(ast_t* ast, void* arg)
+{
+    body_t* body = arg;
+
+    body->size++;
+
+    switch (ast->base->kind)
+    {
+        case AST_FOR_LOOP:
+        case AST_FOR_IN:
+        case AST_BREAK_LOOP:
+        case AST_CONTINUE_LOOP:
+        case AST_FUNC_DECL:
+            body->copyable = false;
+            return false;
+        case AST_IF_COND:
+        case AST_FUNC_RETURN:
+            body->straight = false;
+            return true;
+        default:
+            return true;
+    }
+}
+
+static bool_t constant_int(ast_t* ast, int64_t* value)
+{
+    if (ast == NULL || ast->base->kind != AST_CONSTANT || !is_integer_type(ast->base->type))
+        return false;
+
+    *value = ((ast_constant_t*) ast)->value.as_int64;
+    return true;
+}
+
+static symbol_t* scalar_symbol(ast_t* ast)
+{
+    if (ast == NULL || ast->base->kind != AST_VARIABLE)
+        return NULL;
+
+    ast_variable_t* var = (ast_variable_t*) ast;
+    if (var->index_expr != NULL || !is_integer_type(var->symbol->type))
+        return NULL;
+
+    return var->symbol;
+}
+
+static int64_t trip_count(int64_t from, int64_t to, int16_t step)
+{
+    uint64_t span;
+    uint64_t stride;
+
+    if (step > 0)
+    {
+        if (to <= from)
+            return 0;
+        span = (uint64_t) to - (uint64_t) from;
+        stride = step;
+    }
+    else
+    {
+        if (to >= from)
+            return 0;
+        span = (uint64_t) from - (uint64_t) to;
+        stride = -(int64_t) step;
+    }
+
+    uint64_t trips = span / stride + (span % stride != 0);
+    return trips > INT64_MAX ? INT64_MAX : (int64_t) trips;
+}
+
+// Matches `i = <from>; i < <limit>; i = i + <step>` (or <=) where the limit
+// is a constant or a variable the loop does not assign
+static bool_t counted_loop(ast_for_loop_t* loop, unroll_t* unroll, bool_t* known, int64_t* trips)
+{
+    if (loop->condition == NULL || loop->post == NULL || loop->condition->base->kind != AST_BINARY)
+        return false;
+
+    ast_binary_t* cond = (ast_binary_t*) loop->condition;
+    symbol_t* symbol = scalar_symbol(cond->lhs_expr);
+    ast_t* limit = cond->rhs_expr;
+
+    if (symbol == NULL || (cond->op != TK_LT && cond->op != TK_LTE) || !is_integer_type(limit->base->type))
+        return false;
+
+    if (limit->base->kind == AST_VARIABLE)
+    {
+        symbol_t* limit_symbol = scalar_symbol(limit);
+        if (limit_symbol == NULL || limit_symbol == symbol ||
+            ast_assigns(loop->body, limit_symbol) || ast_assigns(loop->post, limit_symbol))
+            return false;
+    }
+    else if (limit->base->kind != AST_CONSTANT)
+        return false;
+
+    if (loop->post->base->kind != AST_ASSIGN)
+        return false;
+
+    ast_assign_t* post = (ast_assign_t*) loop->post;
+
+    if (post->symbol != symbol || post->index_expr != NULL || post->expr->base->kind != AST_BINARY)
+        return false;
+
+    ast_binary_t* next = (ast_binary_t*) post->expr;
+    int64_t step;
+
+    if (next->op != TK_PLUS)
+        return false;
+    if (!(scalar_symbol(next->lhs_expr) == symbol && constant_int(next->rhs_expr, &step)) &&
+        !(scalar_symbol(next->rhs_expr) == symbol && constant_int(next->lhs_expr, &step)))
+        return false;
+    if (step <= 0 || step > INT16_MAX)
+        return false;
+
+    if (ast_assigns(loop->body, symbol))
+        return false;
+
+    unroll->step = step;
+    unroll->counter_addr = symbol->addr_on_stack;
+    unroll->limit = limit;
+
+    if (cond->op == TK_LTE)
+    {
+        value_t one = { .as_int64 = 1 };
+        unroll->limit = (ast_t*) ast_new_binary(limit->base->type, TK_PLUS, limit, (ast_t*) ast_new_constant(limit->base->type, one));
+    }
+
+    int64_t to;
+    ast_assign_t* init = (ast_assign_t*) loop->init;
+
+    *known = init != NULL && init->base->kind == AST_ASSIGN && init->symbol == symbol &&
+        init->index_expr == NULL && constant_int(init->expr, &unroll->from) && constant_int(limit, &to);
+
+    if (*known && cond->op == TK_LTE && to == INT64_MAX)
+        *known = false;
+
+    if (*known)
+        *trips = trip_count(unroll->from, cond->op == TK_LTE ? to + 1 : to, unroll->step);
+
+    return true;
+}
+
+void unroll_plan(ast_t* loop, context_t* context, uint8_t level)
+{
+    unroll_t unroll = { 0 };
+    ast_t* body = NULL;
+    bool_t known = false;
+    int64_t trips = 0;
+
+    if (level == 0)
+        return;
+
+    if (loop->base->kind == AST_FOR_IN)
+    {
+        ast_for_in_t* for_in = (ast_for_in_t*) loop;
+        int64_t to;
+
+        // A map has no trip count to split
+        if (for_in->loop == NULL || for_in->map != NULL)
+            return;
+
+        body = for_in->body;
+        unroll.step = for_in->step;
+        unroll.counter_addr = for_in->index_addr;
+
+        if (for_in->array != NULL)
+        {
+            unroll.from = 0;
+            to = for_in->array->extra.array.len;
+            known = true;
+        }
+        else
+        {
+            if (ast_assigns(body, for_in->symbol))
+                return;
+            known = constant_int(for_in->from, &unroll.from) && constant_int(for_in->to, &to);
+        }
+
+        if (known)
+            trips = trip_count(unroll.from, to, unroll.step);
+    }
+    else if (loop->base->kind == AST_FOR_LOOP)
+    {
+        ast_for_loop_t* for_loop = (ast_for_loop_t*) loop;
+
+        if (for_loop->loop == NULL || !counted_loop(for_loop, &unroll, &known, &trips))
+            return;
+
+        body = for_loop->body;
+    }
+    else
+        return;
+
+    body_t info = { 0, true, true };
+    ast_walk(body, body_visit, &info);
+
+    if (!info.copyable)
+        return;
+
+    if (known && trips <= UNROLL_FULL_TRIPS && (size_t) trips * info.size <= UNROLL_FULL_SIZE)
+    {
+        unroll.full = true;
+        unroll.copies = trips;
+    }
+    else if (level >= 2 && info.straight && info.size <= UNROLL_BY_4_SIZE)
+    {
+        unroll.copies = info.size <= UNROLL_BY_8_SIZE ? 8 : 4;
+
+        if (known && trips < unroll.copies)
+            return;
+
+        unroll.limit_addr = context_alloc_stack_addr(context, 1);
+    }
+    else
+        return;
+
+    unroll_t* plan = malloc(sizeof (unroll_t));
+    *plan = unroll;
+
+    if (loop->base->kind == AST_FOR_IN)
+        ((ast_for_in_t*) loop)->unroll = plan;
+    else
+        ((ast_for_loop_t*) loop)->unroll = plan;
+}
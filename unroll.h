@@ -0,0 +1,19 @@
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include "ast.h"
+#include "context.h"
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void unroll_plan(ast_t* loop, context_t* context, uint8_t level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UNROLL_H */
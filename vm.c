@@ -2,6 +2,12 @@
 #include "utf8.h"
 #include "types.h"
 #include "buffer.h"
+#include "simd.h"
+#include "sort.h"
+#include "profile.h"
+#include "tier.h"
+#include "map.h"
+#include "queue.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -10,6 +16,24 @@
 #include <math.h>
 #include <inttypes.h>
 #include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Where a call returns to, kept apart from the values
+typedef struct
+{
+    uint32_t ip;
+    uint32_t bp;
+} frame_t;
+
+// Kinds of the native objects
+enum
+{
+    VM_MAP,
+    VM_HEAP,
+    VM_DEQUE,
+};
 
 typedef struct
 {
@@ -17,12 +41,21 @@ typedef struct
     uint32_t sp;          // Points the top element of the machine stack: stack[sp]
     uint32_t bp;          // Base index
     value_t* stack;
-    size_t stack_size;
+    frame_t* frames;      // The control stack, frames[fp - 1] is the innermost call
+    uint32_t fp;
+    uint8_t* stack_guard;
+    uint8_t* frames_guard;
+    void* fault_stack;    // vm_fault runs on it, the C stack may be the one that ran out
     buffer_t code;
     buffer_t data;
     struct {
         uint8_t halt: 1;
+        uint8_t tier: 1;
+        uint8_t profile: 1;
     } flags;
+    profile_t* profile;
+    const char* profile_name;
+    map_t* objects;       // Maps, heaps and deques by the absolute slot they are in and their kind
 } vm_t;
 
 static vm_t vm;
@@ -126,26 +159,210 @@ const opcode_t OPCODES[] = {
     {XCONST, 2, "xconst"},
     {SPRINT, 0, "sprint"},
     {SLEN, 0, "slen"},
-    {ASTORE, 5, "astore"},
+    {ASTORE, 7, "astore"},
     {ALEN, 0, "alen"},
     {NPRINT, 0, "nprint"},
+    {XLOADI8, 2, "xloadi8"},
+    {XLOADIU8, 2, "xloadiu8"},
+    {XLOADI16, 2, "xloadi16"},
+    {XLOADIU16, 2, "xloadiu16"},
+    {XLOADI32, 2, "xloadi32"},
+    {XLOADIU32, 2, "xloadiu32"},
+    {XSTOREI8, 2, "xstorei8"},
+    {XSTOREI16, 2, "xstorei16"},
+    {XSTOREI32, 2, "xstorei32"},
+    {AREF, 2, "aref"},
+    {ASUM, 0, "asum"},
+    {AMIN, 0, "amin"},
+    {AMAX, 0, "amax"},
+    {ADOT, 0, "adot"},
+    {ACOUNT, 0, "acount"},
+    {AARGMIN, 0, "aargmin"},
+    {AARGMAX, 0, "aargmax"},
+    {ASORT, 0, "asort"},
+    {ASORTD, 0, "asortd"},
+    {ACOPY, 0, "acopy"},
+    {AFILL, 0, "afill"},
+    {ASLICE_COPY, 0, "aslice_copy"},
+    {AEQ, 0, "aeq"},
+    {ACHECK, 2, "acheck"},
+    {FORI, 8, "fori"},
+    {FORNEXT, 8, "fornext"},
+    {ISHRU, 0, "ishru"},
+    {IDIVM, 13, "idivm"},
+    {IMODM, 13, "imodm"},
+    {XINC, 2, "xinc"},
+    {XDEC, 2, "xdec"},
+    {XADDI, 6, "xaddi"},
+    {AADDI, 6, "aaddi"},
+    {IPRINTS, 1, "iprints"},
+    {IPRINTU, 1, "iprintu"},
+    {IGTJ, 0, "igtj"},
+    {ILTJ, 0, "iltj"},
+    {IGEJ, 0, "igej"},
+    {ILEJ, 0, "ilej"},
+    {IEQJ, 0, "ieqj"},
+    {INQJ, 0, "inqj"},
+    {RGTJ, 0, "rgtj"},
+    {RLTJ, 0, "rltj"},
+    {RGEJ, 0, "rgej"},
+    {RLEJ, 0, "rlej"},
+    {REQJ, 0, "reqj"},
+    {RNQJ, 0, "rnqj"},
+    {XALEN, 2, "xalen"},
+    {MNEW, 3, "mnew"},
+    {MGET, 0, "mget"},
+    {MGETD, 0, "mgetd"},
+    {MSET, 0, "mset"},
+    {MHAS, 0, "mhas"},
+    {MDEL, 0, "mdel"},
+    {MLEN, 0, "mlen"},
+    {MNEXT, 0, "mnext"},
+    {MKEY, 0, "mkey"},
+    {HNEW, 3, "hnew"},
+    {HPUSH, 0, "hpush"},
+    {HPOP, 0, "hpop"},
+    {HTOP, 0, "htop"},
+    {HLEN, 0, "hlen"},
+    {DNEW, 2, "dnew"},
+    {DPUSH, 0, "dpush"},
+    {DPUSHF, 0, "dpushf"},
+    {DPOP, 0, "dpop"},
+    {DPOPF, 0, "dpopf"},
+    {DFRONT, 0, "dfront"},
+    {DBACK, 0, "dback"},
+    {DLEN, 0, "dlen"},
+    {IADDX, 2, "iaddx"},
+    {ISUBX, 2, "isubx"},
+    {IMULX, 2, "imulx"},
 };
 
+// No access past the end of either stack. The guard is larger than the
+// most a single instruction moves sp by, a frame of UINT16_MAX slots, so
+// any overflow faults in it rather than in memory beyond
+#define VM_GUARD_SIZE (((UINT16_MAX + 2) * sizeof (value_t) + 4095) & ~(size_t) 4095)
+
+static void* vm_reserve(size_t size, uint8_t** guard)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) / page * page;
+
+    uint8_t* base = mmap(NULL, size + VM_GUARD_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (base == MAP_FAILED || mprotect(base + size, VM_GUARD_SIZE, PROT_NONE) != 0)
+    {
+        fprintf(stderr, "Error: Cannot reserve %zu bytes for the stack\n", size);
+        exit(1);
+    }
+
+    *guard = base + size;
+    return base;
+}
+
+static bool_t vm_in_guard(uint8_t* addr, uint8_t* guard)
+{
+    return guard != NULL && addr >= guard && addr < guard + VM_GUARD_SIZE;
+}
+
+static size_t vm_fault_append(char* text, size_t len, const char* s)
+{
+    while (*s)
+        text[len++] = *s++;
+    return len;
+}
+
+// vm_error for a signal handler, with write and _exit only. Output stdio
+// still buffers is lost, flushing it here is not safe.
+static void vm_fault_error(const char* msg)
+{
+    char text[128];
+    size_t len = vm_fault_append(text, 0, "Runtime error: ");
+    len = vm_fault_append(text, len, msg);
+    len = vm_fault_append(text, len, " : ip ");
+
+    int shift = 28;
+    while (shift > 0 && (vm.ip >> shift) == 0)
+        shift -= 4;
+    for (; shift >= 0; shift -= 4)
+        text[len++] = "0123456789abcdef"[(vm.ip >> shift) & 0xF];
+    text[len++] = '\n';
+
+    ssize_t written = write(STDERR_FILENO, text, len);
+    (void) written;
+    _exit(1);
+}
+
+// Pushes are not checked, running off a stack faults in its guard
+static void vm_fault(int sig, siginfo_t* info, void* context)
+{
+    uint8_t* addr = info->si_addr;
+
+    if (vm_in_guard(addr, vm.stack_guard) || vm_in_guard(addr, vm.frames_guard))
+        vm_fault_error("Stack overflow");
+
+    // Not ours, the fault happens again with the default action
+    signal(sig, SIG_DFL);
+}
+
 void vm_init()
 {
     buffer_init(&vm.data, 0);
     buffer_init(&vm.code, 128);
-    vm.stack_size = 32; // 32 * 8 = 256 as initial stack size
-    vm.stack = malloc(sizeof (value_t) * vm.stack_size);
+    vm.stack = vm_reserve(sizeof (value_t) * VM_STACK_SLOTS, &vm.stack_guard);
+    vm.frames = vm_reserve(sizeof (frame_t) * VM_STACK_FRAMES, &vm.frames_guard);
+    vm.fp = 0;
     vm.ip = 0;
     vm.sp = 0;
     vm.bp = 0;
     vm.flags.halt = 0;
+    vm.flags.tier = 0;
+    vm.flags.profile = 0;
+    vm.objects = map_new(MT_UINT64, NULL);
+    simd_init();
+
+    stack_t fault_stack;
+    fault_stack.ss_sp = vm.fault_stack = malloc(SIGSTKSZ);
+    fault_stack.ss_size = SIGSTKSZ;
+    fault_stack.ss_flags = 0;
+    sigaltstack(&fault_stack, NULL);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof (action));
+    action.sa_sigaction = vm_fault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+    sigaction(SIGBUS, &action, NULL);
 }
 
 void vm_free()
 {
-    free(vm.stack);
+    munmap(vm.stack, vm.stack_guard + VM_GUARD_SIZE - (uint8_t*) vm.stack);
+    munmap(vm.frames, vm.frames_guard + VM_GUARD_SIZE - (uint8_t*) vm.frames);
+    vm.stack_guard = NULL;
+    vm.frames_guard = NULL;
+
+    stack_t fault_stack = { .ss_flags = SS_DISABLE };
+    sigaltstack(&fault_stack, NULL);
+    free(vm.fault_stack);
+    vm.fault_stack = NULL;
+
+    for (int64_t pos = map_next(vm.objects, 0); pos >= 0; pos = map_next(vm.objects, pos + 1))
+    {
+        map_entry_t* entry = &vm.objects->entries[pos];
+        void* object = (void*) entry->value.as_ptr;
+
+        switch (entry->key.as_uint64 & 3)
+        {
+            case VM_MAP: map_free(object); break;
+            case VM_HEAP: heap_free(object); break;
+            case VM_DEQUE: deque_free(object); break;
+        }
+    }
+    map_free(vm.objects);
+    vm.objects = NULL;
+
     buffer_free(&vm.data);
     buffer_free(&vm.code);
 }
@@ -153,7 +370,7 @@ void vm_free()
 void print_vm_info()
 {
     printf("stack: [");
-    for (int i=0; i<vm.stack_size; i++)
+    for (int i=0; i<=vm.sp; i++)
     {
         printf("%2lx%2c ", vm.stack[i].as_uint64, (i==vm.sp)?'<':' ');
     }
@@ -173,14 +390,232 @@ void print_vm_info()
     vm_dasm_opcode(stdout, vm.ip);
 }
 
-void vm_check_stack(size_t n)
+static void vm_error(const char* msg)
+{
+    fprintf(stderr, "Runtime error: %s : ip %x\n", msg, vm.ip);
+    exit(1);
+}
+
+// Elements of an array start right after its header slot, packed by
+// array_elmnt_size() of the element type
+static inline uint8_t* vm_array_base(uint8_t* opcode)
+{
+    return (uint8_t*) &vm.stack[vm.bp + *((uint16_t*) (opcode + 1)) + 1];
+}
+
+// An array reference is the absolute stack index of the array header,
+// the header holds (len << 16) | elmnt_type
+static inline value_t* vm_array_ref(value_t ref)
+{
+    return &vm.stack[ref.as_uint64];
+}
+
+static inline size_t vm_array_len(value_t* header)
+{
+    return header->as_uint64 >> 16;
+}
+
+// A map, heap or deque is a pointer in the slot of its variable. MNEW,
+// HNEW and DNEW make the one of a slot or empty the one of the kind made
+// there before, a frame at the same place can only hold it after the
+// last frame using it returned
+static value_t* vm_object(uint32_t slot, uint8_t kind)
+{
+    return map_insert(vm.objects, (value_t) { .as_uint64 = (uint64_t) slot << 2 | kind });
+}
+
+static map_t* vm_map_new(uint32_t slot, type_t key_type)
+{
+    value_t* object = vm_object(slot, VM_MAP);
+    map_t* map = (map_t*) object->as_ptr;
+
+    if (map == NULL)
+    {
+        map = map_new(key_type, vm.data.data);
+        object->as_ptr = (uintptr_t) map;
+    }
+    else
+    {
+        map_clear(map);
+        map->key_type = key_type;
+        map->data = vm.data.data;
+    }
+
+    return map;
+}
+
+static heap_t* vm_heap_new(uint32_t slot, type_t type)
 {
-    if (vm.sp + n >= vm.stack_size)
+    value_t* object = vm_object(slot, VM_HEAP);
+    heap_t* heap = (heap_t*) object->as_ptr;
+
+    if (heap == NULL)
     {
-        size_t new_size = min_coverage_size(vm.sp + n);
-        vm.stack = realloc(vm.stack, sizeof (value_t) * new_size);
-        vm.stack_size = new_size;
+        heap = heap_new(type);
+        object->as_ptr = (uintptr_t) heap;
     }
+    else
+        heap_clear(heap, type);
+
+    return heap;
+}
+
+static deque_t* vm_deque_new(uint32_t slot)
+{
+    value_t* object = vm_object(slot, VM_DEQUE);
+    deque_t* deque = (deque_t*) object->as_ptr;
+
+    if (deque == NULL)
+    {
+        deque = deque_new();
+        object->as_ptr = (uintptr_t) deque;
+    }
+    else
+        deque_clear(deque);
+
+    return deque;
+}
+
+static inline map_t* vm_map(value_t ref)
+{
+    return (map_t*) ref.as_ptr;
+}
+
+static inline heap_t* vm_heap(value_t ref)
+{
+    return (heap_t*) ref.as_ptr;
+}
+
+static inline deque_t* vm_deque(value_t ref)
+{
+    return (deque_t*) ref.as_ptr;
+}
+
+static inline type_t vm_array_type(value_t* header)
+{
+    return header->as_uint64 & 0xFF;
+}
+
+static void vm_array_fill(value_t* header, value_t value)
+{
+    uint8_t* elmnts = (uint8_t*) (header + 1);
+    size_t len = vm_array_len(header);
+
+    switch (array_elmnt_size(vm_array_type(header)))
+    {
+        case 1:
+            memset(elmnts, value.as_uint8, len);
+            break;
+        case 2:
+            for (size_t i = 0; i < len; i++)
+                ((uint16_t*) elmnts)[i] = value.as_uint16;
+            break;
+        case 4:
+            for (size_t i = 0; i < len; i++)
+                ((uint32_t*) elmnts)[i] = value.as_uint32;
+            break;
+        default:
+            if (value.as_uint64 == 0)
+                memset(elmnts, 0, len * sizeof (value_t));
+            else
+                for (size_t i = 0; i < len; i++)
+                    ((value_t*) elmnts)[i] = value;
+    }
+}
+
+static bool_t vm_array_equal(value_t* a, value_t* b)
+{
+    size_t len = vm_array_len(a);
+    type_t type = vm_array_type(a);
+
+    if (len != vm_array_len(b) || type != vm_array_type(b))
+        return false;
+
+    // Strings are offsets into the data section, equal strings may live
+    // at different offsets
+    if (is_str_type(type))
+    {
+        for (size_t i = 1; i <= len; i++)
+        {
+            if (strcmp((char*) vm.data.data + a[i].as_uint16, (char*) vm.data.data + b[i].as_uint16) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    return memcmp(a + 1, b + 1, len * array_elmnt_size(type)) == 0;
+}
+
+// n / divisor rounded toward zero like IDIV, as the high half of n * magic
+// plus fixups (Hacker's Delight, 10-4)
+static inline int64_t vm_magic_quotient(int64_t n, int64_t magic, int32_t divisor, uint8_t shift)
+{
+    int64_t q = (int64_t) (((__int128) n * magic) >> 64);
+
+    if (divisor > 0 && magic < 0)
+        q = (int64_t) ((uint64_t) q + (uint64_t) n);
+    else if (divisor < 0 && magic > 0)
+        q = (int64_t) ((uint64_t) q - (uint64_t) n);
+
+    q >>= shift;
+    return q + (int64_t) ((uint64_t) q >> 63);
+}
+
+// Quickening: a few opcodes rewrite themselves on their first execution
+// into a variant that skips work they would otherwise repeat every time.
+// The variant keeps the size of the code it replaces and runs from the
+// same address right away. Only the code in memory changes, never what
+// vm_save writes.
+//
+//   IPRINT type         IPRINTS/IPRINTU with the shift that extends the type
+//   <compare>; JEZ|JNZ  <compare>J, compares and branches in one dispatch
+//   AREF slot; ALEN     XALEN slot, the length straight from the header
+//
+// Tiering (see tier.c) makes the compare and branch forms in the bodies
+// it emits right away, and one more that only it makes:
+//
+//   XLOAD slot; IADD    IADDX slot, and ISUBX and IMULX for ISUB and IMUL
+
+// A compare followed by a branch becomes the fused form, the branch stays
+// in place behind it for code jumping there directly
+static inline bool_t vm_quicken_compare(uint8_t* opcode, uint8_t fused)
+{
+    if (opcode[1] != JEZ && opcode[1] != JNZ)
+        return false;
+
+    *opcode = fused;
+    return true;
+}
+
+// Jumps backwards close a loop, tiering counts them
+static inline void vm_jump(uint32_t target)
+{
+    if (vm.flags.tier && target <= vm.ip)
+        tier_loop(target);
+    vm.ip = target;
+}
+
+// Counts by the address of the JEZ or JNZ, whether fused or not
+static inline void vm_profile_branch(uint32_t addr, bool_t taken)
+{
+    if (taken)
+        vm.profile->taken[addr]++;
+    else
+        vm.profile->not_taken[addr]++;
+}
+
+static inline void vm_compare_branch(uint8_t* opcode, bool_t cond)
+{
+    bool_t taken = cond == (opcode[1] == JNZ);
+
+    if (vm.flags.profile)
+        vm_profile_branch(vm.ip + 1, taken);
+
+    vm.sp -= 2;
+    if (taken)
+        vm_jump(*((uint16_t*) (opcode + 2)));
+    else
+        vm.ip += 4;
 }
 
 void exec_opcode(uint8_t* opcode)
@@ -201,7 +636,6 @@ void exec_opcode(uint8_t* opcode)
     }
     case DUP:
     {
-        vm_check_stack(1);
         vm.stack[vm.sp + 1] = vm.stack[vm.sp];
         ++vm.sp;
         ++vm.ip;
@@ -223,58 +657,89 @@ void exec_opcode(uint8_t* opcode)
     }
     case ALLC:
     {
-        vm_check_stack(1);
         ++vm.sp;
         ++vm.ip;
         break;
     }
     case PROC:
     {
+        // Only the main body runs its PROC, a CALL does the work of the
+        // PROC it lands on and goes past it
         uint16_t args = *((uint16_t*) (opcode + 1));
         uint16_t vars = *((uint16_t*) (opcode + 3));
-        uint32_t _bp = vm.stack[vm.sp--].as_uint32;
-        uint32_t _ip = vm.stack[vm.sp--].as_uint32;
-        vm.stack[vm.sp+1].as_uint32 = 0;
-        vm.stack[vm.sp+2].as_uint32 = 0;
         vm.bp = vm.sp - args;
-        vm_check_stack(vars);
+        memset(&vm.stack[vm.sp + 1], 0, sizeof (value_t) * vars);
         vm.sp += vars;
-        vm.stack[++vm.sp].as_uint32 = _ip;
-        vm.stack[++vm.sp].as_uint32 = _bp;
-        vm.stack[++vm.sp].as_uint32 = args + vars;
         vm.ip += 5;
         break;
     }
+    case FORI:
+    case FORNEXT:
+    {
+        // target, counter, limit, step
+        value_t* counter = &vm.stack[vm.bp + *((uint16_t*) (opcode + 3))];
+        int64_t limit = vm.stack[vm.bp + *((uint16_t*) (opcode + 5))].as_int64;
+        int16_t step = *((int16_t*) (opcode + 7));
+
+        if (*opcode == FORNEXT)
+            counter->as_int64 += step;
+
+        bool_t more = step > 0 ? counter->as_int64 < limit : counter->as_int64 > limit;
+
+        if (more == (*opcode == FORNEXT))
+            vm_jump(*((uint16_t*) (opcode + 1)));
+        else
+            vm.ip += 9;
+        break;
+    }
     case CALL:
     {
-        vm_check_stack(2);
-        vm.stack[++vm.sp].as_uint32 = vm.ip + 3;
-        vm.stack[++vm.sp].as_uint32 = vm.bp;
-        vm.ip = *((uint16_t*) (opcode + 1));
+        // The arguments on top of the stack become the first slots of the
+        // frame, the locals follow them zeroed
+        uint32_t entry = *((uint16_t*) (opcode + 1));
+
+        if (vm.flags.profile)
+            vm.profile->calls[entry]++;
+        if (vm.flags.tier)
+            entry = tier_call(entry);
+
+        uint8_t* proc = vm.code.data + entry;
+        uint16_t args = *((uint16_t*) (proc + 1));
+        uint16_t vars = *((uint16_t*) (proc + 3));
+
+        vm.frames[vm.fp].ip = vm.ip + 3;
+        vm.frames[vm.fp].bp = vm.bp;
+        vm.fp++;
+
+        vm.bp = vm.sp - args;
+        for (uint16_t i = 0; i < vars; i++)
+            vm.stack[++vm.sp].as_uint64 = 0;
+        vm.ip = entry + 5;
         break;
     }
     case RET:
     {
-        value_t retv = vm.stack[vm.sp--];
-        uint32_t drops = vm.stack[vm.sp--].as_uint32;
-        uint32_t _bp = vm.stack[vm.sp--].as_uint32;
-        uint32_t _ip = vm.stack[vm.sp--].as_uint32;
-        vm.sp -= drops;
-        vm.stack[++vm.sp] = retv;
-        vm.ip = (uint16_t) _ip;
-        vm.bp = (uint16_t) _bp;
+        // The return value takes the place of the arguments
+        vm.stack[vm.bp + 1] = vm.stack[vm.sp];
+        vm.sp = vm.bp + 1;
+        vm.fp--;
+        vm.ip = vm.frames[vm.fp].ip;
+        vm.bp = vm.frames[vm.fp].bp;
         break;
     }
     case JMP:
     {
-        vm.ip = *((uint16_t*) (opcode + 1));
+        vm_jump(*((uint16_t*) (opcode + 1)));
         break;
     }
     case JEZ:
     {
+        if (vm.flags.profile)
+            vm_profile_branch(vm.ip, vm.stack[vm.sp].as_int64 == 0);
+
         // TODO: real type has problem with this
         if (vm.stack[vm.sp].as_int64 == 0)
-            vm.ip = *((uint16_t*) (opcode + 1));
+            vm_jump(*((uint16_t*) (opcode + 1)));
         else
             vm.ip += 3;
         --vm.sp;
@@ -282,9 +747,12 @@ void exec_opcode(uint8_t* opcode)
     }
     case JNZ:
     {
+        if (vm.flags.profile)
+            vm_profile_branch(vm.ip, vm.stack[vm.sp].as_int64 != 0);
+
         // TODO: real type has problem with this
         if (vm.stack[vm.sp].as_int64 != 0)
-            vm.ip = *((uint16_t*) (opcode + 1));
+            vm_jump(*((uint16_t*) (opcode + 1)));
         else
             vm.ip += 3;
         --vm.sp;
@@ -390,22 +858,48 @@ void exec_opcode(uint8_t* opcode)
         ++vm.ip;
         break;
     }
+    // Shift counts are taken modulo 64
     case ISHL:
     {
-        vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_int64 << vm.stack[vm.sp].as_int64;
+        vm.stack[vm.sp - 1].as_uint64 = vm.stack[vm.sp - 1].as_uint64 << (vm.stack[vm.sp].as_int64 & 63);
         --vm.sp;
         ++vm.ip;
         break;
     }
     case ISHR:
     {
-        vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_int64 >> vm.stack[vm.sp].as_int64;
+        vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_int64 >> (vm.stack[vm.sp].as_int64 & 63);
+        --vm.sp;
+        ++vm.ip;
+        break;
+    }
+    case ISHRU:
+    {
+        vm.stack[vm.sp - 1].as_uint64 = vm.stack[vm.sp - 1].as_uint64 >> (vm.stack[vm.sp].as_int64 & 63);
         --vm.sp;
         ++vm.ip;
         break;
     }
+    case IDIVM:
+    case IMODM:
+    {
+        // magic, divisor, shift
+        int64_t magic = *((int64_t*) (opcode + 1));
+        int32_t divisor = *((int32_t*) (opcode + 9));
+        int64_t n = vm.stack[vm.sp].as_int64;
+        int64_t q = vm_magic_quotient(n, magic, divisor, opcode[13]);
+
+        if (*opcode == IMODM)
+            q = (int64_t) ((uint64_t) n - (uint64_t) q * (uint64_t) (int64_t) divisor);
+
+        vm.stack[vm.sp].as_int64 = q;
+        vm.ip += 14;
+        break;
+    }
     case IGT:
     {
+        if (vm_quicken_compare(opcode, IGTJ))
+            break;
         vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_int64 > vm.stack[vm.sp].as_int64;
         --vm.sp;
         ++vm.ip;
@@ -413,6 +907,8 @@ void exec_opcode(uint8_t* opcode)
     }
     case ILT:
     {
+        if (vm_quicken_compare(opcode, ILTJ))
+            break;
         vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_int64 < vm.stack[vm.sp].as_int64;
         --vm.sp;
         ++vm.ip;
@@ -420,6 +916,8 @@ void exec_opcode(uint8_t* opcode)
     }
     case IGE:
     {
+        if (vm_quicken_compare(opcode, IGEJ))
+            break;
         vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_int64 >= vm.stack[vm.sp].as_int64;
         --vm.sp;
         ++vm.ip;
@@ -427,6 +925,8 @@ void exec_opcode(uint8_t* opcode)
     }
     case ILE:
     {
+        if (vm_quicken_compare(opcode, ILEJ))
+            break;
         vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_int64 <= vm.stack[vm.sp].as_int64;
         --vm.sp;
         ++vm.ip;
@@ -434,6 +934,8 @@ void exec_opcode(uint8_t* opcode)
     }
     case IEQ:
     {
+        if (vm_quicken_compare(opcode, IEQJ))
+            break;
         vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_int64 == vm.stack[vm.sp].as_int64;
         --vm.sp;
         ++vm.ip;
@@ -441,6 +943,8 @@ void exec_opcode(uint8_t* opcode)
     }
     case INQ:
     {
+        if (vm_quicken_compare(opcode, INQJ))
+            break;
         vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_int64 != vm.stack[vm.sp].as_int64;
         --vm.sp;
         ++vm.ip;
@@ -448,7 +952,6 @@ void exec_opcode(uint8_t* opcode)
     }
     case I8CONST:
     {
-        vm_check_stack(1);
         int8_t val = (int8_t)opcode[1];
         vm.stack[++vm.sp].as_int64 = (int64_t)val;
         vm.ip += 2;
@@ -456,7 +959,6 @@ void exec_opcode(uint8_t* opcode)
     }
     case I16CONST:
     {
-        vm_check_stack(1);
         int16_t val = *((int16_t*)(opcode + 1));
         vm.stack[++vm.sp].as_int64 = (int64_t)val;
         vm.ip += 3;
@@ -464,7 +966,6 @@ void exec_opcode(uint8_t* opcode)
     }
     case I32CONST:
     {
-        vm_check_stack(1);
         int32_t val = *((int32_t*)(opcode + 1));
         vm.stack[++vm.sp].as_int64 = (int64_t)val;
         vm.ip += 5;
@@ -472,21 +973,18 @@ void exec_opcode(uint8_t* opcode)
     }
     case I64CONST:
     {
-        vm_check_stack(1);
         vm.stack[++vm.sp].as_int64 = *((int64_t*) (opcode + 1));
         vm.ip += 9;
         break;
     }
     case ICONST_0:
     {
-        vm_check_stack(1);
         vm.stack[++vm.sp].as_int64 = 0;
         ++vm.ip;
         break;
     }
     case ICONST_1:
     {
-        vm_check_stack(1);
         vm.stack[++vm.sp].as_int64 = 1;
         ++vm.ip;
         break;
@@ -494,6 +992,12 @@ void exec_opcode(uint8_t* opcode)
     case IPRINT:
     {
         type_t type = *((int8_t*) (opcode + 1));
+        if (is_integer_type(type))
+        {
+            opcode[0] = is_unsigned_integer_type(type) ? IPRINTU : IPRINTS;
+            opcode[1] = 64 - 8 * type_size(type);
+            break;
+        }
         switch (type)
         {
             case MT_INT8: printf("%" PRIi8, vm.stack[vm.sp].as_int8); break;
@@ -718,70 +1222,78 @@ void exec_opcode(uint8_t* opcode)
     }
     case RGT:
     {
-        vm.stack[vm.sp - 1].as_real = vm.stack[vm.sp - 1].as_real > vm.stack[vm.sp].as_real;
+        if (vm_quicken_compare(opcode, RGTJ))
+            break;
+        vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_real > vm.stack[vm.sp].as_real;
         --vm.sp;
         ++vm.ip;
         break;
     }
     case RLT:
     {
-        vm.stack[vm.sp - 1].as_real = vm.stack[vm.sp - 1].as_real < vm.stack[vm.sp].as_real;
+        if (vm_quicken_compare(opcode, RLTJ))
+            break;
+        vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_real < vm.stack[vm.sp].as_real;
         --vm.sp;
         ++vm.ip;
         break;
     }
     case RGE:
     {
-        vm.stack[vm.sp - 1].as_real = vm.stack[vm.sp - 1].as_real >= vm.stack[vm.sp].as_real;
+        if (vm_quicken_compare(opcode, RGEJ))
+            break;
+        vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_real >= vm.stack[vm.sp].as_real;
         --vm.sp;
         ++vm.ip;
         break;
     }
     case RLE:
     {
-        vm.stack[vm.sp - 1].as_real = vm.stack[vm.sp - 1].as_real <= vm.stack[vm.sp].as_real;
+        if (vm_quicken_compare(opcode, RLEJ))
+            break;
+        vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_real <= vm.stack[vm.sp].as_real;
         --vm.sp;
         ++vm.ip;
         break;
     }
     case REQ:
     {
-        vm.stack[vm.sp - 1].as_real = vm.stack[vm.sp - 1].as_real == vm.stack[vm.sp].as_real;
+        if (vm_quicken_compare(opcode, REQJ))
+            break;
+        vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_real == vm.stack[vm.sp].as_real;
         --vm.sp;
         ++vm.ip;
         break;
     }
     case RNQ:
     {
-        vm.stack[vm.sp - 1].as_real = vm.stack[vm.sp - 1].as_real != vm.stack[vm.sp].as_real;
+        if (vm_quicken_compare(opcode, RNQJ))
+            break;
+        vm.stack[vm.sp - 1].as_int64 = vm.stack[vm.sp - 1].as_real != vm.stack[vm.sp].as_real;
         --vm.sp;
         ++vm.ip;
         break;
     }
     case RCONST:
     {
-        vm_check_stack(1);
         vm.stack[++vm.sp].as_uint64 = *((uint64_t*) (opcode + 1));
         vm.ip += 9;
         break;
     }
     case RCONST_0:
     {
-        vm_check_stack(1);
         vm.stack[++vm.sp].as_real = 0.0;
         ++vm.ip;
         break;
     }
     case RCONST_1:
     {
-        vm_check_stack(1);
         vm.stack[++vm.sp].as_real = 1.0;
         ++vm.ip;
         break;
     }
     case RCONST_PI:
     {
-        vm_check_stack(1);
         vm.stack[++vm.sp].as_real = 3.14159265358979323846;
         ++vm.ip;
         break;
@@ -802,7 +1314,6 @@ void exec_opcode(uint8_t* opcode)
     }
     case XLOAD:
     {
-        vm_check_stack(1);
         vm.stack[vm.sp + 1] = vm.stack[vm.bp + *((uint16_t*) (opcode + 1))];
         ++vm.sp;
         vm.ip += 3;
@@ -815,25 +1326,123 @@ void exec_opcode(uint8_t* opcode)
         vm.ip += 3;
         break;
     }
+    // Integer updates in place: slot, and the 32 bit addend of XADDI and
+    // AADDI. AADDI adds to the element at the index on top.
+    case XINC:
+    {
+        vm.stack[vm.bp + *((uint16_t*) (opcode + 1))].as_uint64++;
+        vm.ip += 3;
+        break;
+    }
+    case XDEC:
+    {
+        vm.stack[vm.bp + *((uint16_t*) (opcode + 1))].as_uint64--;
+        vm.ip += 3;
+        break;
+    }
+    case XADDI:
+    {
+        vm.stack[vm.bp + *((uint16_t*) (opcode + 1))].as_uint64 += *((int32_t*) (opcode + 3));
+        vm.ip += 7;
+        break;
+    }
+    case AADDI:
+    {
+        size_t index = vm.stack[vm.sp--].as_uint64;
+        value_t* header = &vm.stack[vm.bp + *((uint16_t*) (opcode + 1))];
+        uint8_t* elmnts = vm_array_base(opcode);
+        int32_t addend = *((int32_t*) (opcode + 3));
+
+        switch (array_elmnt_size(vm_array_type(header)))
+        {
+            case 1: ((uint8_t*) elmnts)[index] += addend; break;
+            case 2: ((uint16_t*) elmnts)[index] += addend; break;
+            case 4: ((uint32_t*) elmnts)[index] += addend; break;
+            default: ((uint64_t*) elmnts)[index] += addend; break;
+        }
+        vm.ip += 7;
+        break;
+    }
     case XLOADI:
     {
-        vm_check_stack(1);
-        size_t index = vm.stack[vm.sp--].as_uint16;
-        vm.stack[++vm.sp] = vm.stack[vm.bp + *((uint16_t*) (opcode + 1)) + index + 1];
+        size_t index = vm.stack[vm.sp].as_uint64;
+        vm.stack[vm.sp] = vm.stack[vm.bp + *((uint16_t*) (opcode + 1)) + index + 1];
         vm.ip += 3;
         break;
     }
     case XSTOREI:
     {
-        size_t index = vm.stack[vm.sp--].as_uint16;
+        size_t index = vm.stack[vm.sp--].as_uint64;
         value_t value = vm.stack[vm.sp--];
         vm.stack[vm.bp + *((uint16_t*) (opcode + 1)) + index + 1] = value;
         vm.ip += 3;
         break;
     }
+    case XLOADI8:
+    {
+        size_t index = vm.stack[vm.sp].as_uint64;
+        vm.stack[vm.sp].as_int64 = ((int8_t*) vm_array_base(opcode))[index];
+        vm.ip += 3;
+        break;
+    }
+    case XLOADIU8:
+    {
+        size_t index = vm.stack[vm.sp].as_uint64;
+        vm.stack[vm.sp].as_int64 = ((uint8_t*) vm_array_base(opcode))[index];
+        vm.ip += 3;
+        break;
+    }
+    case XLOADI16:
+    {
+        size_t index = vm.stack[vm.sp].as_uint64;
+        vm.stack[vm.sp].as_int64 = ((int16_t*) vm_array_base(opcode))[index];
+        vm.ip += 3;
+        break;
+    }
+    case XLOADIU16:
+    {
+        size_t index = vm.stack[vm.sp].as_uint64;
+        vm.stack[vm.sp].as_int64 = ((uint16_t*) vm_array_base(opcode))[index];
+        vm.ip += 3;
+        break;
+    }
+    case XLOADI32:
+    {
+        size_t index = vm.stack[vm.sp].as_uint64;
+        vm.stack[vm.sp].as_int64 = ((int32_t*) vm_array_base(opcode))[index];
+        vm.ip += 3;
+        break;
+    }
+    case XLOADIU32:
+    {
+        size_t index = vm.stack[vm.sp].as_uint64;
+        vm.stack[vm.sp].as_int64 = ((uint32_t*) vm_array_base(opcode))[index];
+        vm.ip += 3;
+        break;
+    }
+    case XSTOREI8:
+    {
+        size_t index = vm.stack[vm.sp--].as_uint64;
+        ((uint8_t*) vm_array_base(opcode))[index] = vm.stack[vm.sp--].as_uint8;
+        vm.ip += 3;
+        break;
+    }
+    case XSTOREI16:
+    {
+        size_t index = vm.stack[vm.sp--].as_uint64;
+        ((uint16_t*) vm_array_base(opcode))[index] = vm.stack[vm.sp--].as_uint16;
+        vm.ip += 3;
+        break;
+    }
+    case XSTOREI32:
+    {
+        size_t index = vm.stack[vm.sp--].as_uint64;
+        ((uint32_t*) vm_array_base(opcode))[index] = vm.stack[vm.sp--].as_uint32;
+        vm.ip += 3;
+        break;
+    }
     case XCONST:
     {
-        vm_check_stack(1);
         vm.stack[++vm.sp].as_int16 = *((uint16_t*) (opcode + 1));
         vm.ip += 3;
         break;
@@ -848,7 +1457,6 @@ void exec_opcode(uint8_t* opcode)
     }
     case SLEN:
     {
-        vm_check_stack(1);
         uint16_t str_addr = vm.stack[vm.sp].as_uint16;
         const char* str = (const char*)&vm.data.data[str_addr];
         vm.stack[vm.sp].as_int64 = (int64_t)utf8len(str);
@@ -858,23 +1466,393 @@ void exec_opcode(uint8_t* opcode)
     case ASTORE:
     {
         uint64_t addr = *((uint16_t*) (opcode + 1));
-        uint64_t len = *((uint16_t*) (opcode + 3));
-        uint64_t type = *((uint8_t*) (opcode + 5));
+        uint64_t len = *((uint32_t*) (opcode + 3));
+        uint64_t type = *((uint8_t*) (opcode + 7));
 
         vm.stack[vm.bp + addr].as_uint64 = (len << 16) | type;
 
-        for (int32_t i = len - 1; i >= 0; i--)
+        uint8_t* base = (uint8_t*) &vm.stack[vm.bp + addr + 1];
+        size_t size = array_elmnt_size(type);
+
+        for (int64_t i = len - 1; i >= 0; i--)
         {
             value_t v = vm.stack[vm.sp--];
-            vm.stack[vm.bp + addr + i + 1] = v;
+            switch (size)
+            {
+                case 1: ((uint8_t*) base)[i] = v.as_uint8; break;
+                case 2: ((uint16_t*) base)[i] = v.as_uint16; break;
+                case 4: ((uint32_t*) base)[i] = v.as_uint32; break;
+                default: ((value_t*) base)[i] = v; break;
+            }
         }
 
-        vm.ip += 6;
+        vm.ip += 8;
         break;
     }
     case ALEN:
     {
-        vm.stack[vm.sp].as_int64 = vm.stack[vm.bp + vm.sp].as_uint64 >> 16;
+        vm.stack[vm.sp].as_int64 = vm_array_len(vm_array_ref(vm.stack[vm.sp]));
+        ++vm.ip;
+        break;
+    }
+    case ACHECK:
+    {
+        // Peeks the index of the following array access
+        value_t* header = &vm.stack[vm.bp + *((uint16_t*) (opcode + 1))];
+        if (vm.stack[vm.sp].as_uint64 >= vm_array_len(header))
+            vm_error("Array index out of bounds.");
+        vm.ip += 3;
+        break;
+    }
+    case AREF:
+    {
+        if (opcode[3] == ALEN)
+        {
+            *opcode = XALEN;
+            break;
+        }
+        vm.stack[++vm.sp].as_uint64 = vm.bp + *((uint16_t*) (opcode + 1));
+        vm.ip += 3;
+        break;
+    }
+    case ASUM:
+    {
+        value_t* header = vm_array_ref(vm.stack[vm.sp]);
+        vm.stack[vm.sp] = simd_sum(header + 1, vm_array_len(header), vm_array_type(header));
+        ++vm.ip;
+        break;
+    }
+    case AMIN:
+    {
+        value_t* header = vm_array_ref(vm.stack[vm.sp]);
+        vm.stack[vm.sp] = simd_min(header + 1, vm_array_len(header), vm_array_type(header));
+        ++vm.ip;
+        break;
+    }
+    case AMAX:
+    {
+        value_t* header = vm_array_ref(vm.stack[vm.sp]);
+        vm.stack[vm.sp] = simd_max(header + 1, vm_array_len(header), vm_array_type(header));
+        ++vm.ip;
+        break;
+    }
+    case ADOT:
+    {
+        value_t* b = vm_array_ref(vm.stack[vm.sp--]);
+        value_t* a = vm_array_ref(vm.stack[vm.sp]);
+
+        if (vm_array_len(a) != vm_array_len(b))
+            vm_error("Array lengths differ.");
+
+        vm.stack[vm.sp] = simd_dot(a + 1, b + 1, vm_array_len(a), vm_array_type(a));
+        ++vm.ip;
+        break;
+    }
+    case ACOUNT:
+    {
+        value_t value = vm.stack[vm.sp--];
+        value_t* header = vm_array_ref(vm.stack[vm.sp]);
+        vm.stack[vm.sp].as_int64 = simd_count_eq(header + 1, vm_array_len(header), vm_array_type(header), value);
+        ++vm.ip;
+        break;
+    }
+    case AARGMIN:
+    {
+        value_t* header = vm_array_ref(vm.stack[vm.sp]);
+        vm.stack[vm.sp].as_int64 = simd_argmin(header + 1, vm_array_len(header), vm_array_type(header));
+        ++vm.ip;
+        break;
+    }
+    case AARGMAX:
+    {
+        value_t* header = vm_array_ref(vm.stack[vm.sp]);
+        vm.stack[vm.sp].as_int64 = simd_argmax(header + 1, vm_array_len(header), vm_array_type(header));
+        ++vm.ip;
+        break;
+    }
+    case ASORT:
+    case ASORTD:
+    {
+        // The reference slot stays on the stack as the void result
+        value_t* header = vm_array_ref(vm.stack[vm.sp]);
+        sort_array(header + 1, vm_array_len(header), vm_array_type(header), *opcode == ASORTD, vm.data.data);
+        ++vm.ip;
+        break;
+    }
+    case ACOPY:
+    {
+        // The destination reference stays as the void result
+        value_t* src = vm_array_ref(vm.stack[vm.sp--]);
+        value_t* dst = vm_array_ref(vm.stack[vm.sp]);
+
+        if (vm_array_len(dst) != vm_array_len(src))
+            vm_error("Array lengths differ.");
+
+        memmove(dst + 1, src + 1, vm_array_len(dst) * array_elmnt_size(vm_array_type(dst)));
+        ++vm.ip;
+        break;
+    }
+    case AFILL:
+    {
+        value_t value = vm.stack[vm.sp--];
+        vm_array_fill(vm_array_ref(vm.stack[vm.sp]), value);
+        ++vm.ip;
+        break;
+    }
+    case ASLICE_COPY:
+    {
+        // dst, dst_at, src, src_at, count
+        uint64_t count = vm.stack[vm.sp--].as_uint64;
+        uint64_t src_at = vm.stack[vm.sp--].as_uint64;
+        value_t* src = vm_array_ref(vm.stack[vm.sp--]);
+        uint64_t dst_at = vm.stack[vm.sp--].as_uint64;
+        value_t* dst = vm_array_ref(vm.stack[vm.sp]);
+
+        if (src_at > vm_array_len(src) || count > vm_array_len(src) - src_at ||
+            dst_at > vm_array_len(dst) || count > vm_array_len(dst) - dst_at)
+            vm_error("Array slice out of bounds.");
+
+        size_t size = array_elmnt_size(vm_array_type(dst));
+        memmove((uint8_t*) (dst + 1) + dst_at * size, (uint8_t*) (src + 1) + src_at * size, count * size);
+        ++vm.ip;
+        break;
+    }
+    case AEQ:
+    {
+        value_t* b = vm_array_ref(vm.stack[vm.sp--]);
+        value_t* a = vm_array_ref(vm.stack[vm.sp]);
+        vm.stack[vm.sp].as_int64 = vm_array_equal(a, b);
+        ++vm.ip;
+        break;
+    }
+    case IPRINTS:
+    {
+        uint8_t shift = opcode[1];
+        printf("%" PRIi64, (int64_t) (vm.stack[vm.sp].as_uint64 << shift) >> shift);
+        fflush(stdout);
+        --vm.sp;
+        vm.ip += 2;
+        break;
+    }
+    case IPRINTU:
+    {
+        uint8_t shift = opcode[1];
+        printf("%" PRIu64, (vm.stack[vm.sp].as_uint64 << shift) >> shift);
+        fflush(stdout);
+        --vm.sp;
+        vm.ip += 2;
+        break;
+    }
+    case IGTJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_int64 > vm.stack[vm.sp].as_int64);
+        break;
+    case ILTJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_int64 < vm.stack[vm.sp].as_int64);
+        break;
+    case IGEJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_int64 >= vm.stack[vm.sp].as_int64);
+        break;
+    case ILEJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_int64 <= vm.stack[vm.sp].as_int64);
+        break;
+    case IEQJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_int64 == vm.stack[vm.sp].as_int64);
+        break;
+    case INQJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_int64 != vm.stack[vm.sp].as_int64);
+        break;
+    case RGTJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_real > vm.stack[vm.sp].as_real);
+        break;
+    case RLTJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_real < vm.stack[vm.sp].as_real);
+        break;
+    case RGEJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_real >= vm.stack[vm.sp].as_real);
+        break;
+    case RLEJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_real <= vm.stack[vm.sp].as_real);
+        break;
+    case REQJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_real == vm.stack[vm.sp].as_real);
+        break;
+    case RNQJ:
+        vm_compare_branch(opcode, vm.stack[vm.sp - 1].as_real != vm.stack[vm.sp].as_real);
+        break;
+    case XALEN:
+    {
+        vm.stack[++vm.sp].as_int64 = vm_array_len(&vm.stack[vm.bp + *((uint16_t*) (opcode + 1))]);
+        vm.ip += 4;
+        break;
+    }
+    case IADDX:
+    {
+        vm.stack[vm.sp].as_int64 = vm.stack[vm.sp].as_int64 + vm.stack[vm.bp + *((uint16_t*) (opcode + 1))].as_int64;
+        vm.ip += 4;
+        break;
+    }
+    case ISUBX:
+    {
+        vm.stack[vm.sp].as_int64 = vm.stack[vm.sp].as_int64 - vm.stack[vm.bp + *((uint16_t*) (opcode + 1))].as_int64;
+        vm.ip += 4;
+        break;
+    }
+    case IMULX:
+    {
+        vm.stack[vm.sp].as_int64 = vm.stack[vm.sp].as_int64 * vm.stack[vm.bp + *((uint16_t*) (opcode + 1))].as_int64;
+        vm.ip += 4;
+        break;
+    }
+    case MNEW:
+    {
+        uint32_t slot = vm.bp + *((uint16_t*) (opcode + 1));
+        vm.stack[slot].as_ptr = (uintptr_t) vm_map_new(slot, opcode[3]);
+        vm.ip += 4;
+        break;
+    }
+    case MGET:
+    {
+        value_t* value = map_find(vm_map(vm.stack[vm.sp - 1]), vm.stack[vm.sp]);
+        if (value == NULL)
+            vm_error("Key not found in the map.");
+        vm.stack[--vm.sp] = *value;
+        ++vm.ip;
+        break;
+    }
+    case MGETD:
+    {
+        value_t* value = map_find(vm_map(vm.stack[vm.sp - 2]), vm.stack[vm.sp - 1]);
+        vm.sp -= 2;
+        vm.stack[vm.sp] = value != NULL ? *value : vm.stack[vm.sp + 2];
+        ++vm.ip;
+        break;
+    }
+    case MSET:
+    {
+        *map_insert(vm_map(vm.stack[vm.sp - 2]), vm.stack[vm.sp - 1]) = vm.stack[vm.sp];
+        vm.sp -= 2;
+        vm.stack[vm.sp] = vm.stack[vm.sp + 2];
+        ++vm.ip;
+        break;
+    }
+    case MHAS:
+    {
+        value_t* value = map_find(vm_map(vm.stack[vm.sp - 1]), vm.stack[vm.sp]);
+        vm.stack[--vm.sp].as_int64 = value != NULL;
+        ++vm.ip;
+        break;
+    }
+    case MDEL:
+    {
+        bool_t removed = map_remove(vm_map(vm.stack[vm.sp - 1]), vm.stack[vm.sp]);
+        vm.stack[--vm.sp].as_int64 = removed;
+        ++vm.ip;
+        break;
+    }
+    case MLEN:
+    {
+        vm.stack[vm.sp].as_int64 = vm_map(vm.stack[vm.sp])->count;
+        ++vm.ip;
+        break;
+    }
+    case MNEXT:
+    {
+        int64_t pos = vm.stack[vm.sp--].as_int64;
+        vm.stack[vm.sp].as_int64 = map_next(vm_map(vm.stack[vm.sp]), pos);
+        ++vm.ip;
+        break;
+    }
+    case MKEY:
+    {
+        // The position comes from MNEXT, it is gone if the map changed
+        map_t* map = vm_map(vm.stack[vm.sp - 1]);
+        uint64_t pos = vm.stack[vm.sp].as_uint64;
+        if (pos >= map->capacity || map->entries[pos].dist == 0)
+            vm_error("The map changed while iterating it.");
+        vm.stack[--vm.sp] = map->entries[pos].key;
+        ++vm.ip;
+        break;
+    }
+    case HNEW:
+    {
+        uint32_t slot = vm.bp + *((uint16_t*) (opcode + 1));
+        vm.stack[slot].as_ptr = (uintptr_t) vm_heap_new(slot, opcode[3]);
+        vm.ip += 4;
+        break;
+    }
+    case HPUSH:
+    {
+        heap_push(vm_heap(vm.stack[vm.sp - 1]), vm.stack[vm.sp]);
+        vm.stack[vm.sp - 1] = vm.stack[vm.sp];
+        --vm.sp;
+        ++vm.ip;
+        break;
+    }
+    case HPOP:
+    {
+        heap_t* heap = vm_heap(vm.stack[vm.sp]);
+        if (heap->len == 0)
+            vm_error("The heap is empty.");
+        vm.stack[vm.sp] = heap_pop(heap);
+        ++vm.ip;
+        break;
+    }
+    case HTOP:
+    {
+        heap_t* heap = vm_heap(vm.stack[vm.sp]);
+        if (heap->len == 0)
+            vm_error("The heap is empty.");
+        vm.stack[vm.sp] = heap->elmnts[0];
+        ++vm.ip;
+        break;
+    }
+    case HLEN:
+    {
+        vm.stack[vm.sp].as_int64 = vm_heap(vm.stack[vm.sp])->len;
+        ++vm.ip;
+        break;
+    }
+    case DNEW:
+    {
+        uint32_t slot = vm.bp + *((uint16_t*) (opcode + 1));
+        vm.stack[slot].as_ptr = (uintptr_t) vm_deque_new(slot);
+        vm.ip += 3;
+        break;
+    }
+    case DPUSH:
+    case DPUSHF:
+    {
+        deque_t* deque = vm_deque(vm.stack[vm.sp - 1]);
+        if (*opcode == DPUSH)
+            deque_push_back(deque, vm.stack[vm.sp]);
+        else
+            deque_push_front(deque, vm.stack[vm.sp]);
+        vm.stack[vm.sp - 1] = vm.stack[vm.sp];
+        --vm.sp;
+        ++vm.ip;
+        break;
+    }
+    case DPOP:
+    case DPOPF:
+    case DFRONT:
+    case DBACK:
+    {
+        deque_t* deque = vm_deque(vm.stack[vm.sp]);
+        if (deque->len == 0)
+            vm_error("The deque is empty.");
+        switch (*opcode)
+        {
+            case DPOP: vm.stack[vm.sp] = deque_pop_back(deque); break;
+            case DPOPF: vm.stack[vm.sp] = deque_pop_front(deque); break;
+            case DFRONT: vm.stack[vm.sp] = deque_front(deque); break;
+            default: vm.stack[vm.sp] = deque_back(deque); break;
+        }
+        ++vm.ip;
+        break;
+    }
+    case DLEN:
+    {
+        vm.stack[vm.sp].as_int64 = vm_deque(vm.stack[vm.sp])->len;
         ++vm.ip;
         break;
     }
@@ -898,6 +1876,34 @@ void vm_exec()
     {
         exec_opcode(vm.code.data + vm.ip);
     }
+
+    if (vm.flags.tier)
+    {
+        tier_report();
+        tier_free();
+    }
+
+    if (vm.flags.profile)
+    {
+        profile_save(vm.profile, vm.profile_name);
+        profile_free(vm.profile);
+    }
+}
+
+// Hot functions are reoptimized while the program runs, see tier.c
+void vm_tier(bool_t stats)
+{
+    vm.flags.tier = 1;
+    tier_init(stats);
+}
+
+// Branch and call counts are written to the file at exit, for the
+// compiler to lay the code out by, see layout.c
+void vm_profile(const char* name)
+{
+    vm.flags.profile = 1;
+    vm.profile = profile_new(vm.code.data, buffer_size(&vm.code));
+    vm.profile_name = name;
 }
 
 void vm_dump()
@@ -958,6 +1964,60 @@ size_t vm_code_addr()
     return buffer_size(&vm.code);
 }
 
+uint8_t* vm_code_ptr()
+{
+    return vm.code.data;
+}
+
+void vm_code_replace(uint8_t* bytes, size_t len)
+{
+    buffer_clear(&vm.code);
+    buffer_adds(&vm.code, bytes, len);
+}
+
+// Back to the generic opcodes the compiler emits, for code taken out of
+// the running program
+void vm_code_dequicken(uint8_t* code, size_t len)
+{
+    for (size_t ip = 0; ip < len; ip += 1 + OPCODES[code[ip]].arg_size)
+    {
+        switch (code[ip])
+        {
+            case IPRINTS:
+            case IPRINTU:
+            {
+                bool_t is_signed = code[ip] == IPRINTS;
+                switch (code[ip + 1])
+                {
+                    case 56: code[ip + 1] = is_signed ? MT_INT8 : MT_UINT8; break;
+                    case 48: code[ip + 1] = is_signed ? MT_INT16 : MT_UINT16; break;
+                    case 32: code[ip + 1] = is_signed ? MT_INT32 : MT_UINT32; break;
+                    default: code[ip + 1] = is_signed ? MT_INT64 : MT_UINT64; break;
+                }
+                code[ip] = IPRINT;
+                break;
+            }
+            case IGTJ: code[ip] = IGT; break;
+            case ILTJ: code[ip] = ILT; break;
+            case IGEJ: code[ip] = IGE; break;
+            case ILEJ: code[ip] = ILE; break;
+            case IEQJ: code[ip] = IEQ; break;
+            case INQJ: code[ip] = INQ; break;
+            case RGTJ: code[ip] = RGT; break;
+            case RLTJ: code[ip] = RLT; break;
+            case RGEJ: code[ip] = RGE; break;
+            case RLEJ: code[ip] = RLE; break;
+            case REQJ: code[ip] = REQ; break;
+            case RNQJ: code[ip] = RNQ; break;
+            case XALEN: code[ip] = AREF; break;
+            case IADDX:
+            case ISUBX:
+            case IMULX: code[ip] = XLOAD; break;
+            default: break;
+        }
+    }
+}
+
 void vm_data_emit(uint8_t* bytes, size_t len)
 {
     buffer_adds(&vm.data, bytes, len);
@@ -1089,5 +2149,6 @@ void vm_load(char* name)
     vm.ip = 0;
     vm.sp = 0;
     vm.bp = 0;
+    vm.fp = 0;
     vm.flags.halt = 0;
 }
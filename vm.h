@@ -5,6 +5,17 @@
 
 #define EMIT(...) do{uint8_t b[] = { __VA_ARGS__ }; vm_code_emit(b, sizeof(b) / sizeof(b[0]));}while(0)
 #define CODE(i, ...) do{uint8_t b[] = { __VA_ARGS__ }; vm_code_set(i, b, sizeof(b) / sizeof(b[0]));}while(0)
+// Values the stack holds and calls that can be nested before the program
+// stops with a stack overflow. Both stacks are reserved up front, memory
+// comes with the pages they reach
+#ifndef VM_STACK_SLOTS
+#define VM_STACK_SLOTS (16 * 1024 * 1024)
+#endif
+
+#ifndef VM_STACK_FRAMES
+#define VM_STACK_FRAMES (4 * 1024 * 1024)
+#endif
+
 // #define DATA(...) do{uint8_t b[] = { __VA_ARGS__ }; vm_data_emit(b, sizeof(b) / sizeof(b[0]));}while(0)
 
 enum
@@ -110,6 +121,79 @@ enum
     // AINDXW,
     ALEN,
     NPRINT,
+    XLOADI8,
+    XLOADIU8,
+    XLOADI16,
+    XLOADIU16,
+    XLOADI32,
+    XLOADIU32,
+    XSTOREI8,
+    XSTOREI16,
+    XSTOREI32,
+    AREF,
+    ASUM,
+    AMIN,
+    AMAX,
+    ADOT,
+    ACOUNT,
+    AARGMIN,
+    AARGMAX,
+    ASORT,
+    ASORTD,
+    ACOPY,
+    AFILL,
+    ASLICE_COPY,
+    AEQ,
+    ACHECK,
+    FORI,
+    FORNEXT,
+    ISHRU,
+    IDIVM,
+    IMODM,
+    XINC,
+    XDEC,
+    XADDI,
+    AADDI,
+    IPRINTS,
+    IPRINTU,
+    IGTJ,
+    ILTJ,
+    IGEJ,
+    ILEJ,
+    IEQJ,
+    INQJ,
+    RGTJ,
+    RLTJ,
+    RGEJ,
+    RLEJ,
+    REQJ,
+    RNQJ,
+    XALEN,
+    MNEW,
+    MGET,
+    MGETD,
+    MSET,
+    MHAS,
+    MDEL,
+    MLEN,
+    MNEXT,
+    MKEY,
+    HNEW,
+    HPUSH,
+    HPOP,
+    HTOP,
+    HLEN,
+    DNEW,
+    DPUSH,
+    DPUSHF,
+    DPOP,
+    DPOPF,
+    DFRONT,
+    DBACK,
+    DLEN,
+    IADDX,
+    ISUBX,
+    IMULX,
 };
 
 #define NUM64(X) \
@@ -147,6 +231,8 @@ extern const opcode_t OPCODES[];
 void vm_init();
 void vm_free();
 void vm_exec();
+void vm_tier(bool_t stats);
+void vm_profile(const char* name);
 void vm_dump();
 void vm_dasm(const char* filename);
 void vm_save(char* name);
@@ -154,6 +240,9 @@ void vm_load(char* name);
 void vm_code_emit(uint8_t* bytes, size_t len);
 void vm_code_set(size_t index, uint8_t* bytes, size_t len);
 size_t vm_code_addr();
+uint8_t* vm_code_ptr();
+void vm_code_replace(uint8_t* bytes, size_t len);
+void vm_code_dequicken(uint8_t* code, size_t len);
 void vm_data_emit(uint8_t* bytes, size_t len);
 uint8_t* vm_data_ptr();
 size_t vm_data_used();